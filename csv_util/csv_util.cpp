@@ -12,91 +12,34 @@ The function returns a std::vector of char* for the filenames and a 2D std::vect
 */
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <string>
 #include <vector>
 #include "opencv2/opencv.hpp"
+#include "featureStore.h"
 
 /*
-  reads a string from a CSV file. the 0-terminated string is returned in the char array os.
-
-  The function returns false if it is successfully read. It returns true if it reaches the end of the line or the file.
+  Both functions go through the feature index codec in src/featureStore.cpp: the reader maps the
+  file and parses it with std::from_chars, and rows are formatted with std::to_chars, byte for
+  byte what the old "%.4f" sprintf loop produced.
+
+  The most recently written file stays open between calls, so appending a row no longer opens and
+  closes the file, and rows are left in the stdio buffer rather than written one syscall at a
+  time. The buffer is flushed when the file is closed (another file is written, or the program
+  exits) and before read_image_data_csv reads the same file.
  */
-int getstring( FILE *fp, char os[] ) {
-  int p = 0;
-  int eol = 0;
-  
-  for(;;) {
-    char ch = fgetc( fp );
-    if( ch == ',' ) {
-      break;
-    }
-    else if( ch == '\n' || ch == EOF ) {
-      eol = 1;
-      break;
+static FILE *csvFile = NULL;
+static std::string csvPath;
+static std::string csvLine;
+
+static void closeCsvFile() {
+  if( csvFile ) {
+    if( fclose( csvFile ) != 0 ) {
+      printf("Error writing %s\n", csvPath.c_str() );
     }
-    // printf("%c", ch ); // uncomment for debugging
-    os[p] = ch;
-    p++;
+    csvFile = NULL;
   }
-  // printf("\n"); // uncomment for debugging
-  os[p] = '\0';
-
-  return(eol); // return true if eol
-}
-
-int getint(FILE *fp, int *v) {
-  char s[256];
-  int p = 0;
-  int eol = 0;
-
-  for(;;) {
-    char ch = fgetc( fp );
-    if( ch == ',') {
-      break;
-    }
-    else if(ch == '\n' || ch == EOF) {
-      eol = 1;
-      break;
-    }
-      
-    s[p] = ch;
-    p++;
-  }
-  s[p] = '\0'; // terminator
-  *v = atoi(s);
-
-  return(eol); // return true if eol
-}
-
-/*
-  Utility function for reading one float value from a CSV file
-
-  The value is stored in the v parameter
-
-  The function returns true if it reaches the end of a line or the file
- */
-int getfloat(FILE *fp, float *v) {
-  char s[256];
-  int p = 0;
-  int eol = 0;
-
-  for(;;) {
-    char ch = fgetc( fp );
-    if( ch == ',') {
-      break;
-    }
-    else if(ch == '\n' || ch == EOF) {
-      eol = 1;
-      break;
-    }
-      
-    s[p] = ch;
-    p++;
-  }
-  s[p] = '\0'; // terminator
-  *v = atof(s);
-
-  return(eol); // return true if eol
 }
 
 /*
@@ -112,35 +55,28 @@ int getfloat(FILE *fp, float *v) {
   The function returns a non-zero value in case of an error.
  */
 int append_image_data_csv( char *filename, char *image_filename, std::vector<float> &image_data, int reset_file ) {
-  char buffer[256];
-  char mode[8];
-  FILE *fp;
-
-  strcpy(mode, "a");
-
-  if( reset_file ) {
-    strcpy( mode, "w" );
+  static bool registered = false;
+  if( !registered ) {
+    atexit( closeCsvFile );
+    registered = true;
   }
-  
-  fp = fopen( filename, mode );
-  if(!fp) {
-    printf("Unable to open output file %s\n", filename );
-    exit(-1);
+
+  if( reset_file || !csvFile || csvPath != filename ) {
+    closeCsvFile();
+    csvFile = fopen( filename, reset_file ? "w" : "a" );
+    if(!csvFile) {
+      printf("Unable to open output file %s\n", filename );
+      exit(-1);
+    }
+    csvPath = filename;
   }
 
   // write the filename and the feature vector to the CSV file
-  strcpy(buffer, image_filename);
-  std::fwrite(buffer, sizeof(char), strlen(buffer), fp );
-  for(int i=0;i<image_data.size();i++) {
-    char tmp[256];
-    sprintf(tmp, ",%.4f", image_data[i] );
-    std::fwrite(tmp, sizeof(char), strlen(tmp), fp );
+  formatFeatureCSVRow( image_filename, image_data.data(), image_data.size(), csvLine );
+  if( fwrite( csvLine.data(), 1, csvLine.size(), csvFile ) != csvLine.size() ) {
+    return(-1);
   }
-      
-  std::fwrite("\n", sizeof(char), 1, fp); // EOL
 
-  fclose(fp);
-  
   return(0);
 }
 
@@ -159,48 +95,34 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
   The function returns a non-zero value if something goes wrong.
  */
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file ) {
-  FILE *fp;
-  float fval;
-  char img_file[256];
+  FeatureStore store;
 
-  fp = fopen(filename, "r");
-  if( !fp ) {
-    printf("Unable to open feature file\n");
+  // rows appended to this file may still be buffered
+  if( csvFile && csvPath == filename && fflush( csvFile ) != 0 ) {
+    printf("Error writing %s\n", filename );
     return(-1);
   }
 
   printf("Reading %s\n", filename);
-  for(;;) {
-    std::vector<float> dvec;
-    
-    
-    // read the filename
-    if( getstring( fp, img_file ) ) {
-      break;
-    }
-    // printf("Evaluting %s\n", filename);
-
-    // read the whole feature file into memory
-    for(;;) {
-      // get next feature
-      float eol = getfloat( fp, &fval );
-      dvec.push_back( fval );
-      if( eol ) break;
-    }
-    // printf("read %lu features\n", dvec.size() );
+  if( importFeatureCSV( filename, store ) != 0 ) {
+    return(-1);
+  }
 
-    data.push_back(dvec);
+  data.reserve( data.size() + store.count );
+  filenames.reserve( filenames.size() + store.count );
+  for(size_t i=0;i<store.count;i++) {
+    data.push_back( std::vector<float>( store.row(i), store.row(i) + store.dim ) );
 
+    const char *img_file = store.filename(i);
     char *fname = new char[strlen(img_file)+1];
     strcpy(fname, img_file);
     filenames.push_back( fname );
   }
-  fclose(fp);
   printf("Finished reading CSV file\n");
 
   if(echo_file) {
-    for(int i=0;i<data.size();i++) {
-      for(int j=0;j<data[i].size();j++) {
+    for(size_t i=0;i<data.size();i++) {
+      for(size_t j=0;j<data[i].size();j++) {
 	printf("%.4f  ", data[i][j] );
       }
       printf("\n");
@@ -0,0 +1,166 @@
+// batchScoring.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Cache-blocked scoring of a batch of queries against a feature index.
+//
+// The index is walked in blocks of rows small enough to stay in L2 while a block of queries is scored against them,
+// so each row is read from memory once per query block instead of once per query. For SSD, Euclidean and cosine the
+// block of scores comes from dotProductBlock, a register-tiled matrix product, plus the precomputed norms; the other
+// metrics (histogram intersection) use the row scan of each query over the block.
+//
+// The dot-product form cancels badly when the norms are large and the distance small: for baseline features (0-255
+// pixel values) |a|^2 + |b|^2 is around 10^6 while a near-duplicate's SSD is a few units, below the rounding of the
+// float dot product. So the norms are kept in double, each query collects a wider pool of candidates from the blocked
+// scores, and the pool is re-scored exactly with the metric's own kernel before the final K are taken.
+
+#include "batchScoring.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <unordered_set>
+#include "distanceKernels.h"
+#include "trace.h"
+
+#define BATCH_QUERY_BLOCK 32                // queries scored together against each row block
+#define BATCH_ROW_BLOCK_BYTES (128 * 1024)  // target size of a row block, about half of a typical L2
+#define BATCH_RESCORE_SLACK 16              // extra candidates beyond 2K that a dot-form query re-scores exactly
+
+static void computeRowNormsDouble(const float* data, size_t count, size_t dim, std::vector<double>& norms) {
+    norms.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const float* row = data + i * dim;
+        double sum = 0.0;
+        for (size_t d = 0; d < dim; ++d) {
+            sum += static_cast<double>(row[d]) * row[d];
+        }
+        norms[i] = std::sqrt(sum);
+    }
+}
+
+// The k best of candidates by the metric's exact per-pair score, with float norms as the single-query scan uses
+static std::vector<ScoredId> rescoreCandidates(const float* query, const std::vector<ScoredId>& candidates, const FeatureStore& store,
+                                               const MatchMetric& metric, size_t k) {
+    TopKSelector best(k, metric.largerIsBetter);
+    float queryNorm = metric.needsNorms ? l2Norm(query, store.dim) : 0.0f;
+    for (const ScoredId& candidate : candidates) {
+        const float* row = store.row(candidate.id);
+        float rowNorm = metric.needsNorms ? l2Norm(row, store.dim) : 0.0f;
+        best.push(metric.score(query, queryNorm, row, rowNorm, store.dim), candidate.id);
+    }
+    return best.results();
+}
+
+void scoreQueryBatch(const float* queries, size_t numQueries, const std::vector<uint32_t>& excludeIds, const FeatureStore& store,
+                     const MatchMetric& metric, size_t k, int threads, std::vector<std::vector<ScoredId>>& results) {
+    const size_t dim = store.dim;
+    results.assign(numQueries, std::vector<ScoredId>());
+    if (numQueries == 0) {
+        return;
+    }
+
+    std::vector<double> rowNorms, queryNorms;
+    if (metric.fromDot || metric.needsNorms) {
+        computeRowNormsDouble(store.data, store.count, dim, rowNorms);
+        computeRowNormsDouble(queries, numQueries, dim, queryNorms);
+    }
+    size_t candidates = metric.fromDot && k > 0 ? 2 * k + BATCH_RESCORE_SLACK : k;
+
+    size_t rowBlock = std::max<size_t>(16, BATCH_ROW_BLOCK_BYTES / (std::max<size_t>(dim, 1) * sizeof(float)));
+    size_t queryBlocks = (numQueries + BATCH_QUERY_BLOCK - 1) / BATCH_QUERY_BLOCK;
+    std::atomic<size_t> nextBlock{0};
+
+    auto worker = [&]() {
+        std::vector<float> scores(BATCH_QUERY_BLOCK * rowBlock);
+        size_t block;
+        while ((block = nextBlock++) < queryBlocks) {
+            TRACE_SCOPE("batch score");
+            size_t q0 = block * BATCH_QUERY_BLOCK;
+            size_t nq = std::min<size_t>(BATCH_QUERY_BLOCK, numQueries - q0);
+            const float* blockQueries = queries + q0 * dim;
+
+            std::vector<TopKSelector> best;
+            best.reserve(nq);
+            for (size_t j = 0; j < nq; ++j) {
+                best.emplace_back(candidates, metric.largerIsBetter, excludeIds[q0 + j]);
+            }
+
+            for (size_t r0 = 0; r0 < store.count; r0 += rowBlock) {
+                size_t nr = std::min(rowBlock, store.count - r0);
+                if (metric.fromDot) {
+                    dotProductBlock(blockQueries, nq, store.row(r0), nr, dim, scores.data());
+                    for (size_t j = 0; j < nq; ++j) {
+                        const float* dots = scores.data() + j * nr;
+                        double queryNorm = queryNorms[q0 + j];
+                        for (size_t r = 0; r < nr; ++r) {
+                            best[j].push(metric.fromDot(dots[r], queryNorm, rowNorms[r0 + r]), static_cast<uint32_t>(r0 + r));
+                        }
+                    }
+                } else {
+                    for (size_t j = 0; j < nq; ++j) {
+                        float queryNorm = queryNorms.empty() ? 0.0f : static_cast<float>(queryNorms[q0 + j]);
+                        scanRows(metric.scan, blockQueries + j * dim, queryNorm, store.row(r0), nr, dim, scores.data());
+                        for (size_t r = 0; r < nr; ++r) {
+                            best[j].push(scores[r], static_cast<uint32_t>(r0 + r));
+                        }
+                    }
+                }
+            }
+
+            for (size_t j = 0; j < nq; ++j) {
+                if (metric.fromDot) {
+                    results[q0 + j] = rescoreCandidates(blockQueries + j * dim, best[j].results(), store, metric, k);
+                } else {
+                    results[q0 + j] = best[j].results();
+                }
+            }
+        }
+    };
+
+    size_t threadCount = std::min<size_t>(std::max(threads, 1), queryBlocks);
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threadCount; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+void reportApproximateRecall(const FeatureStore& store, size_t samples, size_t topN, int threads, const char* settingName,
+                             const std::vector<size_t>& settings, const ApproximateSearch& search) {
+    samples = std::min(samples, store.count);
+    std::vector<uint32_t> queryRows;
+    std::vector<float> queries;
+    for (size_t i = 0; i < samples; ++i) {
+        uint32_t row = static_cast<uint32_t>(i * store.count / samples);
+        queryRows.push_back(row);
+        queries.insert(queries.end(), store.row(row), store.row(row) + store.dim);
+    }
+
+    std::vector<std::vector<ScoredId>> exact;
+    scoreQueryBatch(queries.data(), samples, queryRows, store, *findMatchMetric("cosine"), topN, threads, exact);
+
+    printf("Recall@%zu over %zu queries:\n", topN, samples);
+    for (size_t setting : settings) {
+        size_t found = 0, expected = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t q = 0; q < samples; ++q) {
+            std::vector<ScoredId> approx = search(store.row(queryRows[q]), topN, setting, queryRows[q]);
+            std::unordered_set<uint32_t> approxIds;
+            for (const ScoredId& r : approx) {
+                approxIds.insert(r.id);
+            }
+            for (const ScoredId& r : exact[q]) {
+                found += approxIds.count(r.id);
+            }
+            expected += exact[q].size();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("  %s %4zu: recall %.4f, %.1f us per query\n", settingName, setting, expected ? static_cast<double>(found) / expected : 1.0,
+               seconds * 1e6 / static_cast<double>(samples));
+    }
+}
@@ -0,0 +1,36 @@
+// batchScoring.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for batchScoring.cpp, which scores a whole batch of query vectors against a feature index in
+//          one cache-blocked pass instead of one full scan of the index per query.
+
+#ifndef BATCH_SCORING_H
+#define BATCH_SCORING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "topK.h"
+
+// Finds the k best rows of store for each of the numQueries row-major query vectors (store.dim values each), best
+// first. excludeIds[q] is left out of query q's results (TopKSelector::NO_EXCLUDE for none), as a target's own row is.
+// Metrics with a fromDot form are computed as a blocked query x row matrix product plus norms, and the best of those
+// candidates re-scored exactly, so scores match the per-pair kernel; the others fall back to the per-pair kernel over
+// the same tiles. Query blocks are spread over `threads` threads.
+void scoreQueryBatch(const float* queries, size_t numQueries, const std::vector<uint32_t>& excludeIds, const FeatureStore& store,
+                     const MatchMetric& metric, size_t k, int threads, std::vector<std::vector<ScoredId>>& results);
+
+// One search of an approximate index: the k best rows for query, leaving out excludeId, at a given search setting
+// (efSearch, re-rank depth)
+typedef std::function<std::vector<ScoredId>(const float* query, size_t k, size_t setting, uint32_t excludeId)> ApproximateSearch;
+
+// Prints the mean recall@topN and latency of search at each of settings, labelled settingName, against the exact
+// cosine ranking (what matchImages returns for deepNetwork, self match excluded). The queries are `samples` rows
+// spread evenly through store.
+void reportApproximateRecall(const FeatureStore& store, size_t samples, size_t topN, int threads, const char* settingName,
+                             const std::vector<size_t>& settings, const ApproximateSearch& search);
+
+#endif
@@ -0,0 +1,62 @@
+// boundedQueue.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: A small blocking queue with a fixed capacity, used to connect the stages of the threaded tools.
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    // Blocks while the queue is full. Returns false if the queue was closed before the item could be added.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // Blocks while the queue is empty. Returns false once the queue is closed and fully drained.
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed; consumers drain what is left and then see pop() return false
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_ = false;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+};
+
+#endif
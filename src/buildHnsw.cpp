@@ -0,0 +1,88 @@
+// buildHnsw.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Builds the HNSW graph used by matchImages --hnsw from a feature index, and reports recall@N of the
+//          graph search against the exact brute-force ranking for a range of efSearch values.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batchScoring.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "hnswIndex.h"
+
+// Mean recall@topN and latency of graph search over the sampled rows, for several efSearch values
+static void reportRecall(const HnswIndex& index, const FeatureStore& store, size_t samples, size_t topN, int threads) {
+    std::vector<size_t> efValues;
+    for (size_t ef : {10, 20, 50, 100, 200, 400}) {
+        if (ef >= topN) {
+            efValues.push_back(ef);
+        }
+    }
+    reportApproximateRecall(store, samples, topN, threads, "efSearch", efValues,
+                            [&](const float* query, size_t k, size_t ef, uint32_t excludeId) {
+                                return searchHnswIndex(index, store, query, k, ef, excludeId);
+                            });
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <feature_vectors_file> [output.hnsw] [--M 16] [--efConstruction 200] [--threads N] [--evaluate queries] [--top N]\n";
+        std::cerr << "       the graph is written to <feature_vectors_file>" << HNSW_EXTENSION << " by default\n";
+        return -1;
+    }
+
+    std::string featureVectorsFile = argv[1];
+    std::string output = hnswPathFor(featureVectorsFile);
+    HnswBuildParams params;
+    params.threads = static_cast<int>(std::thread::hardware_concurrency());
+    size_t evaluate = 200, topN = 10;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--M") == 0 && i + 1 < argc) {
+            params.M = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--efConstruction") == 0 && i + 1 < argc) {
+            params.efConstruction = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            params.threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--evaluate") == 0 && i + 1 < argc) {
+            evaluate = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            topN = static_cast<size_t>(atoi(argv[++i]));
+        } else if (argv[i][0] != '-' && i == 2) {
+            output = argv[i];
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return -1;
+        }
+    }
+
+    FeatureStore store;
+    if (openFeatureStore(featureVectorsFile, store) != 0) {
+        return -1;
+    }
+
+    HnswIndex index;
+    auto start = std::chrono::steady_clock::now();
+    if (buildHnswIndex(store, params, index) != 0) {
+        return -1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Built HNSW graph over " << store.count << " vectors (M " << params.M << ", efConstruction " << params.efConstruction
+              << ", " << index.maxLevel + 1 << " levels) in " << seconds << " s\n";
+
+    if (writeHnswIndex(output, index) != 0) {
+        return -1;
+    }
+    std::cout << "Wrote " << output << "\n";
+
+    if (evaluate > 0 && topN > 0) {
+        reportRecall(index, store, evaluate, topN, params.threads);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+// buildQuantizer.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Trains an int8 or product quantizer over a feature index and writes the compact codes used by
+//          matchImages --quantized, then reports their size and recall@N after exact re-ranking against
+//          the brute-force ranking for a range of re-rank depths.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batchScoring.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "quantizedIndex.h"
+
+// Mean recall@topN and latency of the quantized search over the sampled rows, for several re-rank depths
+static void reportRecall(const QuantizedIndex& index, const FeatureStore& store, size_t samples, size_t topN, int threads) {
+    // A depth below topN re-ranks topN candidates, so 0 is reported as topN
+    std::vector<size_t> depths;
+    for (size_t rerank : {0, 20, 50, 100, 200, 500}) {
+        if (rerank == 0 || rerank >= topN) {
+            depths.push_back(std::max(rerank, topN));
+        }
+    }
+    reportApproximateRecall(store, samples, topN, threads, "rerank", depths,
+                            [&](const float* query, size_t k, size_t rerank, uint32_t excludeId) {
+                                return searchQuantizedIndex(index, store, query, k, rerank, excludeId);
+                            });
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <feature_vectors_file> [output.cvq] [--mode pq|int8] [--subspaces M] [--iterations N] [--threads N] [--evaluate queries] [--top N]\n";
+        std::cerr << "       the codes are written to <feature_vectors_file>" << QUANTIZED_EXTENSION << " by default\n";
+        return -1;
+    }
+
+    std::string featureVectorsFile = argv[1];
+    std::string output = quantizedPathFor(featureVectorsFile);
+    QuantizerParams params;
+    params.threads = static_cast<int>(std::thread::hardware_concurrency());
+    size_t evaluate = 200, topN = 10;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode != "pq" && mode != "int8") {
+                std::cerr << "Unknown quantizer mode " << mode << "\n";
+                return -1;
+            }
+            params.mode = mode == "pq" ? QUANTIZER_PQ : QUANTIZER_INT8;
+        } else if (strcmp(argv[i], "--subspaces") == 0 && i + 1 < argc) {
+            params.subspaces = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            params.iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            params.threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--evaluate") == 0 && i + 1 < argc) {
+            evaluate = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            topN = static_cast<size_t>(atoi(argv[++i]));
+        } else if (argv[i][0] != '-' && i == 2) {
+            output = argv[i];
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return -1;
+        }
+    }
+
+    FeatureStore store;
+    if (openFeatureStore(featureVectorsFile, store) != 0) {
+        return -1;
+    }
+
+    QuantizedIndex index;
+    auto start = std::chrono::steady_clock::now();
+    if (buildQuantizedIndex(store, params, index) != 0) {
+        return -1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double floatBytes = static_cast<double>(store.count * store.dim * sizeof(float));
+    double codeBytes = static_cast<double>(store.count * index.codeBytes);
+    printf("Quantized %zu vectors to %zu bytes each (%s) in %.2f s: %.1f MB of codes for %.1f MB of floats, %.1fx smaller\n",
+           store.count, index.codeBytes, index.mode == QUANTIZER_PQ ? "pq" : "int8", seconds, codeBytes / 1e6, floatBytes / 1e6,
+           floatBytes / codeBytes);
+
+    if (writeQuantizedIndex(output, index) != 0) {
+        return -1;
+    }
+    std::cout << "Wrote " << output << "\n";
+
+    if (evaluate > 0 && topN > 0) {
+        reportRecall(index, store, evaluate, topN, params.threads);
+    }
+    return 0;
+}
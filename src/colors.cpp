@@ -1,23 +1,225 @@
+/*
+  Reduces an image, or a directory of images, to a palette of K colors found with kmeans.
+
+  Each pixel is mapped to its palette color through a lookup table rather than a search over the K means: a coarse
+  32x32x32 grid of the color cube, where a cell every color of which has the same nearest mean stores that mean, and a
+  cell split between clusters points to an exact 8x8x8 block of nearest means. The table is built top down, pruning
+  the candidate means of each box of the cube to those that can be nearest to some color in it, so it gives exactly
+  the mean a linear search over the palette would.
+
+  With a directory, or with --output, the program runs headless and writes the quantized images instead of
+  displaying them; directories are processed by the readImages pipeline, one image per thread.
+*/
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
 #include <vector>
 #include <opencv2/opencv.hpp>
 #include "kmeans.h"
+#include "featureExtraction.h"
+#include "indexPipeline.h"
+
+#define LUT_CELL_BITS 3                       // coarse cells are 8x8x8 colors
+#define LUT_CELL_SIZE (1 << LUT_CELL_BITS)
+#define LUT_CELLS (256 >> LUT_CELL_BITS)      // coarse cells per axis
+#define LUT_DIRECT_CANDIDATES 8               // a split box with at most this many candidate means is searched per color
+
+#define LUT_BLOCK_SIZE (LUT_CELL_SIZE * LUT_CELL_SIZE * LUT_CELL_SIZE)
+
+struct PaletteLUT {
+  std::vector<int> cells;                     // LUT_CELLS^3 entries: a palette index, or -(split + 1) for a split cell
+  std::vector<int> splitCell;                 // cell index of each split cell
+  std::vector<std::vector<int>> candidates;   // means that can be nearest to some color of each split cell
+  std::vector<int> splitBlock;                // block of each split cell, -1 until resolved
+  std::vector<int> blocks;                    // LUT_BLOCK_SIZE palette indices per resolved split cell
+};
 
-cv::Vec3b closestColor(cv::Vec3b &pix, std::vector<cv::Vec3b> &colors) {
-  int mincolor = 0;
-  int mindist = SSD(pix, colors[0]);
+static inline int cellIndex(int b, int g, int r) {
+  return(((b >> LUT_CELL_BITS) * LUT_CELLS + (g >> LUT_CELL_BITS)) * LUT_CELLS + (r >> LUT_CELL_BITS));
+}
+
+static inline int blockOffset(int b, int g, int r) {
+  const int mask = LUT_CELL_SIZE - 1;
+  return((((b & mask) << LUT_CELL_BITS | (g & mask)) << LUT_CELL_BITS) | (r & mask));
+}
+
+/*
+  Fills the size^3 box of the cube starting at (b0, g0, r0) given the means that can be nearest to its colors, listed
+  in increasing index order so ties go to the lowest index. block is the block of the split cell containing a box
+  smaller than a cell, or -1 for boxes of whole cells, which stop at split cells and record their candidates.
+ */
+static void fillBox(PaletteLUT &lut, std::vector<cv::Vec3b> &means, const std::vector<int> &candidates,
+                    int b0, int g0, int r0, int size, int block) {
+  // a mean can be nearest to a color of the box only if it is within d0 + 2h of the box center, where d0 is the
+  // distance from the center to its nearest mean and h the box's half diagonal
+  float half = (size - 1) * 0.5f;
+  float cb = b0 + half, cg = g0 + half, cr = r0 + half;
+  float h = half * std::sqrt(3.0f);
+  std::vector<float> dist(candidates.size());
+  float d0 = 1e30f;
+  for(size_t i = 0; i < candidates.size(); i++) {
+    const cv::Vec3b &m = means[candidates[i]];
+    dist[i] = std::sqrt((m[0] - cb) * (m[0] - cb) + (m[1] - cg) * (m[1] - cg) + (m[2] - cr) * (m[2] - cr));
+    d0 = std::min(d0, dist[i]);
+  }
+  float reach = d0 + 2 * h + 1e-3f;
+  std::vector<int> kept;
+  for(size_t i = 0; i < candidates.size(); i++) {
+    if(dist[i] <= reach) {
+      kept.push_back(candidates[i]);
+    }
+  }
+
+  if(kept.size() == 1) {
+    for(int b = b0; b < b0 + size; b += (block < 0 ? LUT_CELL_SIZE : 1)) {
+      for(int g = g0; g < g0 + size; g += (block < 0 ? LUT_CELL_SIZE : 1)) {
+        for(int r = r0; r < r0 + size; r += (block < 0 ? LUT_CELL_SIZE : 1)) {
+          if(block < 0) {
+            lut.cells[cellIndex(b, g, r)] = kept[0];
+          } else {
+            lut.blocks[(size_t)block * LUT_BLOCK_SIZE + blockOffset(b, g, r)] = kept[0];
+          }
+        }
+      }
+    }
+    return;
+  }
+
+  if(block < 0 && size == LUT_CELL_SIZE) {
+    // the cell is split between clusters; it is resolved color by color once an image uses it
+    lut.cells[cellIndex(b0, g0, r0)] = -(int)(lut.splitCell.size() + 1);
+    lut.splitCell.push_back(cellIndex(b0, g0, r0));
+    lut.candidates.push_back(kept);
+    lut.splitBlock.push_back(-1);
+    return;
+  }
+
+  if(block >= 0 && (size == 1 || kept.size() <= LUT_DIRECT_CANDIDATES)) {
+    // few candidates left: a linear search per color is cheaper than splitting the box further
+    int *entries = &lut.blocks[(size_t)block * LUT_BLOCK_SIZE];
+    for(int b = b0; b < b0 + size; b++) {
+      for(int g = g0; g < g0 + size; g++) {
+        for(int r = r0; r < r0 + size; r++) {
+          cv::Vec3b pix((uchar)b, (uchar)g, (uchar)r);
+          int best = kept[0];
+          int mindist = SSD(pix, means[best]);
+          for(size_t i = 1; i < kept.size(); i++) {
+            int sse = SSD(pix, means[kept[i]]);
+            if(sse < mindist) {
+              mindist = sse;
+              best = kept[i];
+            }
+          }
+          entries[blockOffset(b, g, r)] = best;
+        }
+      }
+    }
+    return;
+  }
+
+  int s = size / 2;
+  for(int i = 0; i < 8; i++) {
+    fillBox(lut, means, kept, b0 + (i & 4 ? s : 0), g0 + (i & 2 ? s : 0), r0 + (i & 1 ? s : 0), s, block);
+  }
+}
+
+static void buildPaletteLUT(std::vector<cv::Vec3b> &means, PaletteLUT &lut) {
+  std::vector<int> all(means.size());
+  for(size_t i = 0; i < means.size(); i++) {
+    all[i] = (int)i;
+  }
+  lut = PaletteLUT();
+  lut.cells.assign(LUT_CELLS * LUT_CELLS * LUT_CELLS, 0);
+  fillBox(lut, means, all, 0, 0, 0, 256, -1);
+}
+
+// Resolves the split cells holding colors of src, in parallel over the cells; the others are never looked at
+static void resolvePaletteLUT(const cv::Mat &src, std::vector<cv::Vec3b> &means, PaletteLUT &lut) {
+  std::vector<int> used;
+  int resolved = (int)(lut.blocks.size() / LUT_BLOCK_SIZE);
+  for(int i = 0; i < src.rows; i++) {
+    const cv::Vec3b *sptr = src.ptr<cv::Vec3b>(i);
+    for(int j = 0; j < src.cols; j++) {
+      int entry = lut.cells[cellIndex(sptr[j][0], sptr[j][1], sptr[j][2])];
+      if(entry < 0 && lut.splitBlock[-entry - 1] < 0) {
+        lut.splitBlock[-entry - 1] = resolved + (int)used.size();
+        used.push_back(-entry - 1);
+      }
+    }
+  }
+
+  lut.blocks.resize((resolved + used.size()) * LUT_BLOCK_SIZE);
+  cv::parallel_for_(cv::Range(0, (int)used.size()), [&](const cv::Range &range) {
+    for(int u = range.start; u < range.end; u++) {
+      int split = used[u], cell = lut.splitCell[split];
+      int b0 = cell / (LUT_CELLS * LUT_CELLS) * LUT_CELL_SIZE;
+      int g0 = cell / LUT_CELLS % LUT_CELLS * LUT_CELL_SIZE;
+      int r0 = cell % LUT_CELLS * LUT_CELL_SIZE;
+      fillBox(lut, means, lut.candidates[split], b0, g0, r0, LUT_CELL_SIZE, lut.splitBlock[split]);
+    }
+  });
+}
+
+// Maps every pixel of src to its palette color, in parallel over rows; the split cells it uses must be resolved
+static void applyPalette(const cv::Mat &src, const PaletteLUT &lut, const std::vector<cv::Vec3b> &means, cv::Mat &dst) {
+  dst.create(src.size(), src.type());
+  cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &rows) {
+    for(int i = rows.start; i < rows.end; i++) {
+      const cv::Vec3b *sptr = src.ptr<cv::Vec3b>(i);
+      cv::Vec3b *dptr = dst.ptr<cv::Vec3b>(i);
+      for(int j = 0; j < src.cols; j++) {
+        int b = sptr[j][0], g = sptr[j][1], r = sptr[j][2];
+        int entry = lut.cells[cellIndex(b, g, r)];
+        if(entry < 0) {
+          entry = lut.blocks[(size_t)lut.splitBlock[-entry - 1] * LUT_BLOCK_SIZE + blockOffset(b, g, r)];
+        }
+        dptr[j] = means[entry];
+      }
+    }
+  });
+}
 
-  for(int i = 1; i < colors.size(); i++) {
-    int sse = SSD(pix, colors[i]);
-    if(sse < mindist) {
-      mindist = sse;
-      mincolor = i;
+/*
+  Clusters a sample of the pixels of src into ncolors means and writes the quantized image to dst. The sample takes
+  one jittered pixel per 4x4 block, or a denser grid if that gives fewer pixels than colors.
+ */
+static int quantizeImage(const cv::Mat &src, int ncolors, const KmeansParams &params, cv::Mat &dst) {
+  std::vector<cv::Vec3b> data;
+  std::minstd_rand rng(1);
+  for(int B = 4; B >= 1; B /= 2) {
+    data.clear();
+    for(int i = 0; i + B <= src.rows; i += B) {
+      for(int j = 0; j + B <= src.cols; j += B) {
+        int jx = rng() % B;
+        int jy = rng() % B;
+        data.push_back(src.ptr<cv::Vec3b>(i + jy)[j + jx]);
+      }
+    }
+    if(data.size() >= (size_t)ncolors) {
+      break;
     }
   }
 
-  return(colors[mincolor]);
+  std::vector<cv::Vec3b> means;
+  std::vector<int> labels(data.size());
+
+  if(kmeans(data, means, labels.data(), ncolors, params)) {
+    printf("Error using kmeans\n");
+    return(-1);
+  }
+
+  PaletteLUT lut;
+  buildPaletteLUT(means, lut);
+  resolvePaletteLUT(src, means, lut);
+  applyPalette(src, lut, means, dst);
+
+  return(0);
 }
 
 int main(int argc, char *argv[]) {
@@ -28,23 +230,34 @@ int main(int argc, char *argv[]) {
   char filename[256];
   int ncolors = 16;
   double scaleFactor = 0.5; // Scale factor for resizing the image
+  std::string outputPath;
+  int threads = 0;
+  int batchSize = -1;
+  int iterations = 0;
 
   if(argc < 3) {
-    printf("usage: %s <image filename> <# of colors>\n", argv[0]);
+    printf("usage: %s <image filename or directory> <# of colors> [--output path] [--threads N] [--batch N] [--iterations N]\n", argv[0]);
+    printf("       a directory is quantized headless into the --output directory; a single image is displayed unless\n");
+    printf("       --output names the file to write. --batch sets the mini-batch size (0 runs full k-means; the default\n");
+    printf("       uses 4096 above 256 colors), --iterations the k-means iterations (10, or 100 mini-batches)\n");
     return(-1);
   }
 
-  strcpy(filename, argv[1]);
-  src = cv::imread(filename);
-  if(src.data == NULL) {
-    printf("error: unable to read filename %s\n", filename);
-    return(-2);
+  for(int i = 3; i < argc; i++) {
+    if(strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batchSize = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else {
+      printf("error: unknown option %s\n", argv[i]);
+      return(-1);
+    }
   }
 
-  // Resize the original image for display
-  // cv::resize(src, resizedSrc, cv::Size(), scaleFactor, scaleFactor);
-  cv::imshow("Original", resizedSrc);
-
   int tcolors = atoi(argv[2]);
   if(tcolors < 1 || tcolors > 66000) {
     printf("error: number of colors must be in [1, 66000]\n");
@@ -52,38 +265,81 @@ int main(int argc, char *argv[]) {
     ncolors = tcolors;
   }
 
-  std::vector<cv::Vec3b> data;
-  int B = 4;
-  for(int i = 0; i < src.rows - B; i += B) {
-    for(int j = 0; j < src.cols - B; j += B) {
-      int jx = rand() % B;
-      int jy = rand() % B;
-      data.push_back(src.at<cv::Vec3b>(i + jy, j + jx));
+  KmeansParams params;
+  params.threads = threads;
+  params.batchSize = batchSize >= 0 ? batchSize : (ncolors > 256 ? 4096 : 0);
+  params.maxIterations = iterations > 0 ? iterations : (params.batchSize > 0 ? 100 : 10);
+
+  if(std::filesystem::is_directory(argv[1])) {
+    // headless batch: each worker clusters and writes one image, so kmeans itself runs single threaded
+    if(outputPath.empty()) {
+      printf("error: quantizing a directory needs --output <directory>\n");
+      return(-1);
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(outputPath, ec);
+    if(ec) {
+      printf("error: unable to create directory %s\n", outputPath.c_str());
+      return(-1);
     }
+    KmeansParams imageParams = params;
+    imageParams.threads = 1;
+    int nthreads = threads > 0 ? threads : (int)std::max(1u, std::thread::hardware_concurrency());
+    int written = 0, skipped = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    int result = runIndexPipeline(argv[1], nthreads,
+      [&](IndexResult &result) {
+        cv::Mat image = readImage(result.path);
+        cv::Mat quantized;
+        if(image.empty() || quantizeImage(image, ncolors, imageParams, quantized) != 0) {
+          return(false);
+        }
+        std::string outfile = (std::filesystem::path(outputPath) / std::filesystem::path(result.path).filename()).string();
+        return(cv::imwrite(outfile, quantized));
+      },
+      [&](const IndexResult &result) {
+        if(result.ok) {
+          written++;
+        } else {
+          printf("skipping %s\n", result.path.c_str());
+          skipped++;
+        }
+        return(0);
+      });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Quantized %d images to %d colors in %.2f s (%.1f images/s), %d skipped\n", written, ncolors, seconds,
+           seconds > 0 ? written / seconds : 0.0, skipped);
+    return(result);
   }
 
-  std::vector<cv::Vec3b> means;
-  int *labels = new int[data.size()];
+  strcpy(filename, argv[1]);
+  src = cv::imread(filename);
+  if(src.data == NULL) {
+    printf("error: unable to read filename %s\n", filename);
+    return(-2);
+  }
 
-  if(kmeans(data, means, labels, ncolors)) {
-    printf("Error using kmeans\n");
+  if(quantizeImage(src, ncolors, params, dst) != 0) {
     return(-1);
   }
 
-  dst.create(src.size(), src.type());
-  for(int i = 0; i < src.rows; i++) {
-    for(int j = 0; j < src.cols; j++) {
-      dst.at<cv::Vec3b>(i, j) = closestColor(src.at<cv::Vec3b>(i, j), means);
+  if(!outputPath.empty()) {
+    if(!cv::imwrite(outputPath, dst)) {
+      printf("error: unable to write %s\n", outputPath.c_str());
+      return(-1);
     }
+    return(0);
   }
 
-  // Resize the clustered image for display
-  // cv::resize(dst, resizedDst, cv::Size(), scaleFactor, scaleFactor);
+  // Resize the original and clustered images for display
+  cv::resize(src, resizedSrc, cv::Size(), scaleFactor, scaleFactor);
+  cv::resize(dst, resizedDst, cv::Size(), scaleFactor, scaleFactor);
+  cv::imshow("Original", resizedSrc);
   cv::imshow("clustered", resizedDst);
 
   cv::waitKey(0);
 
-  delete[] labels;
-
   return(0);
 }
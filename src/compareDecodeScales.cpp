@@ -0,0 +1,210 @@
+// compareDecodeScales.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Indexes a directory at several decode scales and reports, for each scale, the decode plus extraction time and
+//          how many of the full-resolution top N matches of sampled images it still returns, to choose a --scale for
+//          readImages and the match tools.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "batchScoring.h"
+#include "featureExtraction.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "indexPipeline.h"
+#include "mappedFile.h"
+
+// Features of every image extracted at one decode scale, by scan position
+struct ScaleRun {
+    int scale = 1;
+    double seconds = 0;
+    std::vector<std::vector<float>> rows;
+    std::vector<char> ok;
+    FeatureStore store;   // rows of the images every scale could read, in scan order
+};
+
+static int extractAtScale(const std::vector<std::string>& paths, const FeatureMethod& method, int threads, ScaleRun& run) {
+    run.rows.assign(paths.size(), std::vector<float>());
+    run.ok.assign(paths.size(), 0);
+    auto extract = [&](IndexResult& result) {
+        cv::Mat image = readImage(result.path, run.scale);
+        if (image.empty()) {
+            return false;
+        }
+        PreparedImage prepared(image);
+        result.features.assign(1, method.extract(prepared));
+        return true;
+    };
+    auto collect = [&](const IndexResult& result) {
+        if (result.ok) {
+            run.rows[result.seq] = result.features[0];
+            run.ok[result.seq] = 1;
+        }
+        return 0;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    int status = runIndexPipeline(paths, threads, extract, collect);
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return status;
+}
+
+// Reads every page of every file once, untimed, so that each scale decodes from the page cache. Otherwise the first
+// scale timed would pay for reading the files from disk and every later scale would look faster than it is.
+static void warmPageCache(const std::vector<std::string>& paths) {
+    volatile char sink = 0;
+    for (const std::string& path : paths) {
+        MappedFile file;
+        if (mapFile(path, file) != 0) {
+            continue;
+        }
+        char touched = 0;
+        for (size_t offset = 0; offset < file.size; offset += 4096) {
+            touched ^= file.data[offset];
+        }
+        sink = sink ^ touched;
+    }
+}
+
+static int parseScales(const std::string& list, std::vector<int>& scales) {
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int scale = 1;
+        if (parseDecodeScale(item, scale) != 0) {
+            return -1;
+        }
+        scales.push_back(scale);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <directory> <feature_type> [--scales 1,2,4,8] [--top N] [--queries Q] [--threads N]\n";
+        std::cerr << "       overlap is the mean fraction of the full-resolution top N matches found at each scale\n";
+        return -1;
+    }
+
+    std::string directory = argv[1], featureType = argv[2];
+    std::vector<int> scales;
+    size_t topN = 10, queries = 500;
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--scales") == 0 && i + 1 < argc) {
+            if (parseScales(argv[++i], scales) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            topN = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            queries = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return -1;
+        }
+    }
+    if (scales.empty()) {
+        scales = {1, 2, 4, 8};
+    }
+    // Full resolution is the reference, so it is always run, and first
+    scales.erase(std::remove(scales.begin(), scales.end(), 1), scales.end());
+    scales.insert(scales.begin(), 1);
+
+    const FeatureMethod* method = findFeatureMethod(featureType);
+    if (!method || !method->extract) {
+        std::cerr << "Feature type " << featureType << " is not extracted from images\n";
+        return -1;
+    }
+    const MatchMetric* metric = findMatchMetric(method->defaultMetric);
+
+    std::vector<std::string> paths;
+    if (scanDirectory(directory, paths) != 0) {
+        return -1;
+    }
+    if (threads > 1) {
+        cv::setNumThreads(1);
+    }
+
+    warmPageCache(paths);
+    std::vector<ScaleRun> runs(scales.size());
+    for (size_t s = 0; s < scales.size(); ++s) {
+        runs[s].scale = scales[s];
+        if (extractAtScale(paths, *method, threads, runs[s]) != 0) {
+            return -1;
+        }
+    }
+
+    // Compare only images that decoded at every scale, so the row ids of all the indexes line up
+    std::vector<size_t> common;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        bool everywhere = true;
+        for (const ScaleRun& run : runs) {
+            everywhere = everywhere && run.ok[i];
+        }
+        if (everywhere) {
+            common.push_back(i);
+        }
+    }
+    if (common.size() < 2) {
+        std::cerr << "Need at least two readable images in " << directory << "\n";
+        return -1;
+    }
+    for (ScaleRun& run : runs) {
+        run.store.featureType = featureType;
+        run.store.decodeScale = static_cast<uint32_t>(run.scale);
+        run.store.dim = run.rows[common[0]].size();
+        run.store.count = common.size();
+        for (size_t i : common) {
+            run.store.ownedData.insert(run.store.ownedData.end(), run.rows[i].begin(), run.rows[i].end());
+        }
+        run.store.data = run.store.ownedData.data();
+    }
+
+    // Each sampled image queries the index built at the same scale, as a reduced index would be used
+    queries = std::min(queries, common.size());
+    std::vector<uint32_t> queryRows;
+    for (size_t q = 0; q < queries; ++q) {
+        queryRows.push_back(static_cast<uint32_t>(q * common.size() / queries));
+    }
+    std::vector<std::vector<std::vector<ScoredId>>> results(runs.size());
+    for (size_t s = 0; s < runs.size(); ++s) {
+        std::vector<float> queryData;
+        for (uint32_t row : queryRows) {
+            queryData.insert(queryData.end(), runs[s].store.row(row), runs[s].store.row(row) + runs[s].store.dim);
+        }
+        scoreQueryBatch(queryData.data(), queries, queryRows, runs[s].store, *metric, topN, threads, results[s]);
+    }
+
+    printf("%s over %zu images, %zu queries, top %zu by %s; every scale decodes from a page cache warmed by an untimed read\n",
+           featureType.c_str(), common.size(), queries, topN, metric->name);
+    printf("scale  decode+extract (ms/image)  speedup  overlap@%zu\n", topN);
+    for (size_t s = 0; s < runs.size(); ++s) {
+        size_t found = 0, expected = 0;
+        for (size_t q = 0; q < queries; ++q) {
+            std::unordered_set<uint32_t> ids;
+            for (const ScoredId& r : results[s][q]) {
+                ids.insert(r.id);
+            }
+            for (const ScoredId& r : results[0][q]) {
+                found += ids.count(r.id);
+            }
+            expected += results[0][q].size();
+        }
+        printf("1/%-4d %26.3f  %6.2fx  %10.4f\n", runs[s].scale, runs[s].seconds * 1e3 / static_cast<double>(paths.size()),
+               runs[0].seconds / runs[s].seconds, expected ? static_cast<double>(found) / expected : 1.0);
+    }
+    return 0;
+}
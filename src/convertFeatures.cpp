@@ -0,0 +1,80 @@
+// convertFeatures.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Converts feature indexes between the CSV format and the binary feature store (.cvfs). The direction is
+//          chosen by the output file's extension, so CSV files (e.g. precomputed ResNet embeddings) can be imported
+//          and binary stores exported back to CSV.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "featureStore.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s <input_features> <output_features> [feature_type] [--dtype f32|u8|u16]\n", argv[0]);
+        printf("       output ending in %s is written as a binary store, anything else as CSV; u8 and u16 binary stores\n", FEATURE_STORE_EXTENSION);
+        printf("       hold histogram features as fixed-point values\n");
+        return -1;
+    }
+
+    const std::string input = argv[1];
+    const std::string output = argv[2];
+
+    FeatureStore store;
+    if (openFeatureStore(input, store) != 0)
+    {
+        return -1;
+    }
+
+    // CSV files carry no feature type, so allow it to be supplied when importing
+    std::string featureType = store.featureType;
+    FeatureDType dtype = FEATURE_DTYPE_F32;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--dtype") == 0 && i + 1 < argc)
+        {
+            if (parseFeatureDType(argv[++i], dtype) != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            featureType = argv[i];
+        }
+    }
+
+    if (isFeatureStorePath(output))
+    {
+        std::vector<std::string> filenames;
+        filenames.reserve(store.count);
+        for (size_t i = 0; i < store.count; ++i)
+        {
+            filenames.push_back(store.filename(i));
+        }
+        std::vector<float> data(store.data, store.data + store.count * store.dim);
+        if (writeFeatureStore(output, featureType, filenames, data, store.dim, dtype, store.decodeScale) != 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        if (dtype != FEATURE_DTYPE_F32)
+        {
+            printf("The %s dtype needs a %s output\n", featureDTypeName(dtype), FEATURE_STORE_EXTENSION);
+            return -1;
+        }
+        store.featureType = featureType;
+        if (exportFeatureCSV(store, output) != 0)
+        {
+            return -1;
+        }
+    }
+
+    printf("Wrote %zu feature vectors of dimension %zu to %s\n", store.count, store.dim, output.c_str());
+    return 0;
+}
@@ -0,0 +1,877 @@
+// distanceKernels.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Scalar and SIMD implementations of the distance functions used by the match tools, with runtime selection
+//          of the widest instruction set the CPU supports.
+
+#include "distanceKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define DISTANCE_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define KERNEL_TARGET(isa)
+#else
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// Scalar reference implementations; the accumulation order matches the original per-tool loops
+static float ssdScalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+static float intersectionScalar(const float* a, const float* b, size_t n) {
+    float intersection = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        intersection += std::min(a[i], b[i]);
+    }
+    return intersection;
+}
+
+static float dotScalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void dotNormScalar(const float* a, const float* b, size_t n, float* dot, float* normB2) {
+    float d = 0.0f, bb = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        d += a[i] * b[i];
+        bb += b[i] * b[i];
+    }
+    *dot = d;
+    *normB2 = bb;
+}
+
+static float dotU8Scalar(const float* a, const uint8_t* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * static_cast<float>(b[i]);
+    }
+    return sum;
+}
+
+static uint64_t intersectionU8Scalar(const uint8_t* a, const uint8_t* b, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += std::min(a[i], b[i]);
+    }
+    return sum;
+}
+
+static uint64_t intersectionU16Scalar(const uint16_t* a, const uint16_t* b, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += std::min(a[i], b[i]);
+    }
+    return sum;
+}
+
+// Dot products of four query rows with two database rows, out[2 * q + r] = q[q] . r[r]
+static void dot4x2Scalar(const float* const* q, const float* r0, const float* r1, size_t n, float* out) {
+    for (int j = 0; j < 4; ++j) {
+        out[2 * j] = dotScalar(q[j], r0, n);
+        out[2 * j + 1] = dotScalar(q[j], r1, n);
+    }
+}
+
+// Adds the scalar tail [i, n) of a 4x2 block to out
+static void dot4x2Tail(const float* const* q, const float* r0, const float* r1, size_t i, size_t n, float* out) {
+    for (; i < n; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            out[2 * j] += q[j][i] * r0[i];
+            out[2 * j + 1] += q[j][i] * r1[i];
+        }
+    }
+}
+
+// ---- Row scans: one query against many rows, specialized per feature dimension ----
+//
+// The loop is written once, over SCAN_LANES independent partial sums per row, so the compiler can vectorize it without
+// reassociating float additions. Four rows are scored together so that every query value loaded is used four times.
+// It is instantiated for every dimension in ROW_SCAN_DIMS, where the trip counts are constants and the tail loop
+// disappears, plus a dynamic-dimension fallback (Dim 0), and compiled once per instruction set below.
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define KERNEL_INLINE __forceinline
+#else
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#endif
+
+#define SCAN_LANES 8
+
+struct SsdOp {
+    static constexpr bool rowNorm = false;
+    static float step(float acc, float a, float b) { float d = a - b; return acc + d * d; }
+    static float finish(float sum, float, float) { return sum; }
+};
+
+struct EuclideanOp {
+    static constexpr bool rowNorm = false;
+    static float step(float acc, float a, float b) { float d = a - b; return acc + d * d; }
+    static float finish(float sum, float, float) { return std::sqrt(sum); }
+};
+
+struct IntersectionOp {
+    static constexpr bool rowNorm = false;
+    static float step(float acc, float a, float b) { return acc + (a < b ? a : b); }
+    static float finish(float sum, float, float) { return sum; }
+};
+
+// Accumulates the dot product and, alongside it, the squared norm of the row
+struct CosineOp {
+    static constexpr bool rowNorm = true;
+    static float step(float acc, float a, float b) { return acc + a * b; }
+    static float finish(float dot, float rowNorm2, float queryNorm) {
+        float rowNorm = std::sqrt(rowNorm2);
+        if (queryNorm == 0.0f || rowNorm == 0.0f) {
+            return 1.0f;
+        }
+        return 1.0f - dot / (queryNorm * rowNorm);
+    }
+};
+
+static KERNEL_INLINE float sumLanes(const float* v) {
+    return ((v[0] + v[4]) + (v[1] + v[5])) + ((v[2] + v[6]) + (v[3] + v[7]));
+}
+
+// Scores four consecutive rows; each query value is loaded once for all four
+template <class Op, size_t Dim>
+static KERNEL_INLINE void scanFourRows(const float* query, float queryNorm, const float* rows, size_t n, float* scores) {
+    const float *b0 = rows, *b1 = rows + n, *b2 = rows + 2 * n, *b3 = rows + 3 * n;
+    float a0[SCAN_LANES] = {}, a1[SCAN_LANES] = {}, a2[SCAN_LANES] = {}, a3[SCAN_LANES] = {};
+    float n0[SCAN_LANES] = {}, n1[SCAN_LANES] = {}, n2[SCAN_LANES] = {}, n3[SCAN_LANES] = {};
+    size_t i = 0;
+    for (; i + SCAN_LANES <= n; i += SCAN_LANES) {
+        for (size_t l = 0; l < SCAN_LANES; ++l) {
+            float q = query[i + l];
+            a0[l] = Op::step(a0[l], q, b0[i + l]);
+            a1[l] = Op::step(a1[l], q, b1[i + l]);
+            a2[l] = Op::step(a2[l], q, b2[i + l]);
+            a3[l] = Op::step(a3[l], q, b3[i + l]);
+            if (Op::rowNorm) {
+                n0[l] += b0[i + l] * b0[i + l];
+                n1[l] += b1[i + l] * b1[i + l];
+                n2[l] += b2[i + l] * b2[i + l];
+                n3[l] += b3[i + l] * b3[i + l];
+            }
+        }
+    }
+    float s0 = sumLanes(a0), s1 = sumLanes(a1), s2 = sumLanes(a2), s3 = sumLanes(a3);
+    float m0 = sumLanes(n0), m1 = sumLanes(n1), m2 = sumLanes(n2), m3 = sumLanes(n3);
+    for (; i < n; ++i) {
+        float q = query[i];
+        s0 = Op::step(s0, q, b0[i]);
+        s1 = Op::step(s1, q, b1[i]);
+        s2 = Op::step(s2, q, b2[i]);
+        s3 = Op::step(s3, q, b3[i]);
+        if (Op::rowNorm) {
+            m0 += b0[i] * b0[i];
+            m1 += b1[i] * b1[i];
+            m2 += b2[i] * b2[i];
+            m3 += b3[i] * b3[i];
+        }
+    }
+    scores[0] = Op::finish(s0, m0, queryNorm);
+    scores[1] = Op::finish(s1, m1, queryNorm);
+    scores[2] = Op::finish(s2, m2, queryNorm);
+    scores[3] = Op::finish(s3, m3, queryNorm);
+}
+
+template <class Op, size_t Dim>
+static KERNEL_INLINE float scanOneRow(const float* query, float queryNorm, const float* row, size_t n) {
+    float acc[SCAN_LANES] = {}, norm[SCAN_LANES] = {};
+    size_t i = 0;
+    for (; i + SCAN_LANES <= n; i += SCAN_LANES) {
+        for (size_t l = 0; l < SCAN_LANES; ++l) {
+            acc[l] = Op::step(acc[l], query[i + l], row[i + l]);
+            if (Op::rowNorm) {
+                norm[l] += row[i + l] * row[i + l];
+            }
+        }
+    }
+    float sum = sumLanes(acc), norm2 = sumLanes(norm);
+    for (; i < n; ++i) {
+        sum = Op::step(sum, query[i], row[i]);
+        if (Op::rowNorm) {
+            norm2 += row[i] * row[i];
+        }
+    }
+    return Op::finish(sum, norm2, queryNorm);
+}
+
+template <class Op, size_t Dim>
+static KERNEL_INLINE void scanRowsBody(const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores) {
+    const size_t n = Dim ? Dim : dim;
+    size_t r = 0;
+    for (; r + 4 <= count; r += 4) {
+        scanFourRows<Op, Dim>(query, queryNorm, rows + r * n, n, scores + r);
+    }
+    for (; r < count; ++r) {
+        scores[r] = scanOneRow<Op, Dim>(query, queryNorm, rows + r * n, n);
+    }
+}
+
+typedef void (*RowScanFunction)(const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores);
+
+static const size_t rowScanDims[] = {ROW_SCAN_DIMS};
+#define ROW_SCAN_DIM_COUNT (sizeof(rowScanDims) / sizeof(rowScanDims[0]))
+
+// Scan functions of one instruction set, by metric and then by dimension: entry 0 is the dynamic fallback, entry
+// d + 1 the specialization for rowScanDims[d]
+struct RowScanTable {
+    RowScanFunction scans[ROW_SCAN_METRICS][ROW_SCAN_DIM_COUNT + 1];
+};
+
+template <size_t... Dims>
+struct RowScanDimList {};
+
+// Fills one metric's entries with make(Op*, integral_constant<Dim>) for the fallback and every dimension in Dims
+template <class Op, class Make, size_t... Dims>
+static constexpr void fillRowScans(RowScanFunction* entries, Make make, RowScanDimList<Dims...>) {
+    entries[0] = make(static_cast<Op*>(nullptr), std::integral_constant<size_t, 0>());
+    size_t d = 1;
+    ((entries[d++] = make(static_cast<Op*>(nullptr), std::integral_constant<size_t, Dims>())), ...);
+}
+
+template <class Make>
+static constexpr RowScanTable makeRowScanTable(Make make) {
+    RowScanTable table{};
+    fillRowScans<SsdOp>(table.scans[ROW_SCAN_SSD], make, RowScanDimList<ROW_SCAN_DIMS>());
+    fillRowScans<EuclideanOp>(table.scans[ROW_SCAN_EUCLIDEAN], make, RowScanDimList<ROW_SCAN_DIMS>());
+    fillRowScans<IntersectionOp>(table.scans[ROW_SCAN_INTERSECTION], make, RowScanDimList<ROW_SCAN_DIMS>());
+    fillRowScans<CosineOp>(table.scans[ROW_SCAN_COSINE], make, RowScanDimList<ROW_SCAN_DIMS>());
+    return table;
+}
+
+// The table of scan<Op, Dim> instantiations; the dimensions come from ROW_SCAN_DIMS, the same list as rowScanDims
+#define ROW_SCAN_TABLE(scan) makeRowScanTable([](auto op, auto dim) -> RowScanFunction { \
+    return scan<std::remove_pointer_t<decltype(op)>, decltype(dim)::value>; })
+
+template <class Op, size_t Dim>
+static void scanRowsScalar(const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores) {
+    scanRowsBody<Op, Dim>(query, queryNorm, rows, count, dim, scores);
+}
+
+static constexpr RowScanTable rowScansScalar = ROW_SCAN_TABLE(scanRowsScalar);
+
+#ifdef DISTANCE_KERNELS_X86
+
+// ---- SSE: 4 lanes, two accumulators ----
+
+KERNEL_TARGET("sse2") static inline float hsumSSE(__m128 v) {
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+KERNEL_TARGET("sse2") static float ssdSSE(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+    }
+    float sum = hsumSSE(_mm_add_ps(acc0, acc1));
+    return sum + ssdScalar(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("sse2") static float intersectionSSE(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_min_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_min_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float sum = hsumSSE(_mm_add_ps(acc0, acc1));
+    return sum + intersectionScalar(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("sse2") static float dotSSE(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float sum = hsumSSE(_mm_add_ps(acc0, acc1));
+    return sum + dotScalar(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("sse2") static void dotNormSSE(const float* a, const float* b, size_t n, float* dot, float* normB2) {
+    __m128 accD = _mm_setzero_ps(), accB = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vb = _mm_loadu_ps(b + i);
+        accD = _mm_add_ps(accD, _mm_mul_ps(_mm_loadu_ps(a + i), vb));
+        accB = _mm_add_ps(accB, _mm_mul_ps(vb, vb));
+    }
+    float d, bb;
+    dotNormScalar(a + i, b + i, n - i, &d, &bb);
+    *dot = hsumSSE(accD) + d;
+    *normB2 = hsumSSE(accB) + bb;
+}
+
+// SSE2 has no direct byte -> int32 widening, so the bytes are unpacked against zero twice
+KERNEL_TARGET("sse2") static float dotU8SSE(const float* a, const uint8_t* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i words = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i)), zero);
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), lo));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), hi));
+    }
+    return hsumSSE(_mm_add_ps(acc0, acc1)) + dotU8Scalar(a + i, b + i, n - i);
+}
+
+// Byte minimums summed with psadbw against zero, which adds eight bytes into each 64-bit lane
+KERNEL_TARGET("sse2") static uint64_t intersectionU8SSE(const uint8_t* a, const uint8_t* b, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_min_epu8(va, vb), zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    return lanes[0] + lanes[1] + intersectionU8Scalar(a + i, b + i, n - i);
+}
+
+// SSE2 has no unsigned 16-bit minimum; min(a, b) = a - saturating(a - b). The minimums are widened to 32-bit lanes,
+// which cannot overflow for any realistic histogram length.
+KERNEL_TARGET("sse2") static uint64_t intersectionU16SSE(const uint16_t* a, const uint16_t* b, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i m = _mm_sub_epi16(va, _mm_subs_epu16(va, vb));
+        acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(m, zero), _mm_unpackhi_epi16(m, zero)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    return static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3] + intersectionU16Scalar(a + i, b + i, n - i);
+}
+
+// Each loaded value feeds two (query) or four (row) multiplies. The eight accumulators are separate variables rather
+// than an array so they stay in registers even in unoptimized or -O2 builds.
+KERNEL_TARGET("sse2") static void dot4x2SSE(const float* const* q, const float* r0, const float* r1, size_t n, float* out) {
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps(), c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps(), c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 b0 = _mm_loadu_ps(r0 + i), b1 = _mm_loadu_ps(r1 + i);
+        __m128 a = _mm_loadu_ps(q[0] + i);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(a, b0));
+        c01 = _mm_add_ps(c01, _mm_mul_ps(a, b1));
+        a = _mm_loadu_ps(q[1] + i);
+        c10 = _mm_add_ps(c10, _mm_mul_ps(a, b0));
+        c11 = _mm_add_ps(c11, _mm_mul_ps(a, b1));
+        a = _mm_loadu_ps(q[2] + i);
+        c20 = _mm_add_ps(c20, _mm_mul_ps(a, b0));
+        c21 = _mm_add_ps(c21, _mm_mul_ps(a, b1));
+        a = _mm_loadu_ps(q[3] + i);
+        c30 = _mm_add_ps(c30, _mm_mul_ps(a, b0));
+        c31 = _mm_add_ps(c31, _mm_mul_ps(a, b1));
+    }
+    out[0] = hsumSSE(c00);
+    out[1] = hsumSSE(c01);
+    out[2] = hsumSSE(c10);
+    out[3] = hsumSSE(c11);
+    out[4] = hsumSSE(c20);
+    out[5] = hsumSSE(c21);
+    out[6] = hsumSSE(c30);
+    out[7] = hsumSSE(c31);
+    dot4x2Tail(q, r0, r1, i, n, out);
+}
+
+// ---- AVX2 + FMA: 8 lanes, four accumulators ----
+
+KERNEL_TARGET("avx2,fma") static inline float hsumAVX(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    return hsumSSE(_mm_add_ps(lo, hi));
+}
+
+KERNEL_TARGET("avx2,fma") static float ssdAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return sum + ssdScalar(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("avx2,fma") static float intersectionAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_min_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+        acc2 = _mm256_add_ps(acc2, _mm256_min_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16)));
+        acc3 = _mm256_add_ps(acc3, _mm256_min_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24)));
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_ps(acc0, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return sum + intersectionScalar(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("avx2,fma") static float dotAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsumAVX(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    return sum + dotScalar(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("avx2,fma") static void dotNormAVX2(const float* a, const float* b, size_t n, float* dot, float* normB2) {
+    __m256 accD0 = _mm256_setzero_ps(), accD1 = _mm256_setzero_ps(), accB0 = _mm256_setzero_ps(), accB1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 b0 = _mm256_loadu_ps(b + i), b1 = _mm256_loadu_ps(b + i + 8);
+        accD0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), b0, accD0);
+        accD1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), b1, accD1);
+        accB0 = _mm256_fmadd_ps(b0, b0, accB0);
+        accB1 = _mm256_fmadd_ps(b1, b1, accB1);
+    }
+    float d, bb;
+    dotNormScalar(a + i, b + i, n - i, &d, &bb);
+    *dot = hsumAVX(_mm256_add_ps(accD0, accD1)) + d;
+    *normB2 = hsumAVX(_mm256_add_ps(accB0, accB1)) + bb;
+}
+
+KERNEL_TARGET("avx2,fma") static float dotU8AVX2(const float* a, const uint8_t* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 b0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i))));
+        __m256 b1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i + 8))));
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), b0, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), b1, acc1);
+    }
+    return hsumAVX(_mm256_add_ps(acc0, acc1)) + dotU8Scalar(a + i, b + i, n - i);
+}
+
+// The 256-bit integer kernels also serve the avx512 set; byte and word minimums at 512 bits would need AVX-512BW
+KERNEL_TARGET("avx2,fma") static uint64_t intersectionU8AVX2(const uint8_t* a, const uint8_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_min_epu8(va, vb), zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + intersectionU8SSE(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("avx2,fma") static uint64_t intersectionU16AVX2(const uint16_t* a, const uint16_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i m = _mm256_min_epu16(va, vb);
+        acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_unpacklo_epi16(m, zero), _mm256_unpackhi_epi16(m, zero)));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    uint64_t sum = 0;
+    for (uint32_t lane : lanes) {
+        sum += lane;
+    }
+    return sum + intersectionU16SSE(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("avx2,fma") static void dot4x2AVX2(const float* const* q, const float* r0, const float* r1, size_t n, float* out) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps(), c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps(), c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 b0 = _mm256_loadu_ps(r0 + i), b1 = _mm256_loadu_ps(r1 + i);
+        __m256 a = _mm256_loadu_ps(q[0] + i);
+        c00 = _mm256_fmadd_ps(a, b0, c00);
+        c01 = _mm256_fmadd_ps(a, b1, c01);
+        a = _mm256_loadu_ps(q[1] + i);
+        c10 = _mm256_fmadd_ps(a, b0, c10);
+        c11 = _mm256_fmadd_ps(a, b1, c11);
+        a = _mm256_loadu_ps(q[2] + i);
+        c20 = _mm256_fmadd_ps(a, b0, c20);
+        c21 = _mm256_fmadd_ps(a, b1, c21);
+        a = _mm256_loadu_ps(q[3] + i);
+        c30 = _mm256_fmadd_ps(a, b0, c30);
+        c31 = _mm256_fmadd_ps(a, b1, c31);
+    }
+    out[0] = hsumAVX(c00);
+    out[1] = hsumAVX(c01);
+    out[2] = hsumAVX(c10);
+    out[3] = hsumAVX(c11);
+    out[4] = hsumAVX(c20);
+    out[5] = hsumAVX(c21);
+    out[6] = hsumAVX(c30);
+    out[7] = hsumAVX(c31);
+    dot4x2Tail(q, r0, r1, i, n, out);
+}
+
+// ---- AVX-512F: 16 lanes, masked loads for the tail ----
+
+KERNEL_TARGET("avx512f") static float ssdAVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+KERNEL_TARGET("avx512f") static float intersectionAVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        acc1 = _mm512_add_ps(acc1, _mm512_min_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16)));
+    }
+    for (; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc0 = _mm512_add_ps(acc0, _mm512_min_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i)));
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+KERNEL_TARGET("avx512f") static float dotAVX512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+KERNEL_TARGET("avx512f") static void dotNormAVX512(const float* a, const float* b, size_t n, float* dot, float* normB2) {
+    __m512 accD = _mm512_setzero_ps(), accB = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 vb = _mm512_maskz_loadu_ps(mask, b + i);
+        accD = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), vb, accD);
+        accB = _mm512_fmadd_ps(vb, vb, accB);
+    }
+    *dot = _mm512_reduce_add_ps(accD);
+    *normB2 = _mm512_reduce_add_ps(accB);
+}
+
+KERNEL_TARGET("avx512f") static float dotU8AVX512(const float* a, const uint8_t* b, size_t n) {
+    __m512 acc = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 vb = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), vb, acc);
+    }
+    return _mm512_reduce_add_ps(acc) + dotU8Scalar(a + i, b + i, n - i);
+}
+
+KERNEL_TARGET("avx512f") static void dot4x2AVX512(const float* const* q, const float* r0, const float* r1, size_t n, float* out) {
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps(), c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps(), c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 b0 = _mm512_maskz_loadu_ps(mask, r0 + i), b1 = _mm512_maskz_loadu_ps(mask, r1 + i);
+        __m512 a = _mm512_maskz_loadu_ps(mask, q[0] + i);
+        c00 = _mm512_fmadd_ps(a, b0, c00);
+        c01 = _mm512_fmadd_ps(a, b1, c01);
+        a = _mm512_maskz_loadu_ps(mask, q[1] + i);
+        c10 = _mm512_fmadd_ps(a, b0, c10);
+        c11 = _mm512_fmadd_ps(a, b1, c11);
+        a = _mm512_maskz_loadu_ps(mask, q[2] + i);
+        c20 = _mm512_fmadd_ps(a, b0, c20);
+        c21 = _mm512_fmadd_ps(a, b1, c21);
+        a = _mm512_maskz_loadu_ps(mask, q[3] + i);
+        c30 = _mm512_fmadd_ps(a, b0, c30);
+        c31 = _mm512_fmadd_ps(a, b1, c31);
+    }
+    out[0] = _mm512_reduce_add_ps(c00);
+    out[1] = _mm512_reduce_add_ps(c01);
+    out[2] = _mm512_reduce_add_ps(c10);
+    out[3] = _mm512_reduce_add_ps(c11);
+    out[4] = _mm512_reduce_add_ps(c20);
+    out[5] = _mm512_reduce_add_ps(c21);
+    out[6] = _mm512_reduce_add_ps(c30);
+    out[7] = _mm512_reduce_add_ps(c31);
+}
+
+// Row scans compiled for each instruction set; the shared body is inlined into each, so it is vectorized for that set
+template <class Op, size_t Dim>
+KERNEL_TARGET("sse2") static void scanRowsSSE(const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores) {
+    scanRowsBody<Op, Dim>(query, queryNorm, rows, count, dim, scores);
+}
+
+template <class Op, size_t Dim>
+KERNEL_TARGET("avx2,fma") static void scanRowsAVX2(const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores) {
+    scanRowsBody<Op, Dim>(query, queryNorm, rows, count, dim, scores);
+}
+
+template <class Op, size_t Dim>
+KERNEL_TARGET("avx512f") static void scanRowsAVX512(const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores) {
+    scanRowsBody<Op, Dim>(query, queryNorm, rows, count, dim, scores);
+}
+
+static constexpr RowScanTable rowScansSSE = ROW_SCAN_TABLE(scanRowsSSE);
+static constexpr RowScanTable rowScansAVX2 = ROW_SCAN_TABLE(scanRowsAVX2);
+static constexpr RowScanTable rowScansAVX512 = ROW_SCAN_TABLE(scanRowsAVX512);
+
+// CPU feature detection, including the OS support (XSAVE state) needed for the wider registers
+static bool cpuSupports(const std::string& isa) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool avxState = (xcr0 & 0x6) == 0x6;
+    bool avx512State = (xcr0 & 0xE6) == 0xE6;
+    bool avx2 = false, avx512f = false;
+    if (maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512f = (info[1] & (1 << 16)) != 0;
+    }
+    if (isa == "sse") return sse2;
+    if (isa == "avx2") return avx2 && fma && avxState;
+    if (isa == "avx512") return avx512f && avx512State;
+    return false;
+#else
+    __builtin_cpu_init();
+    if (isa == "sse") return __builtin_cpu_supports("sse2");
+    if (isa == "avx2") return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (isa == "avx512") return __builtin_cpu_supports("avx512f");
+    return false;
+#endif
+}
+
+#endif // DISTANCE_KERNELS_X86
+
+struct KernelSet {
+    const char* isa;
+    float (*ssd)(const float*, const float*, size_t);
+    float (*intersection)(const float*, const float*, size_t);
+    float (*dot)(const float*, const float*, size_t);
+    void (*dotNorm)(const float*, const float*, size_t, float*, float*);
+    void (*dot4x2)(const float* const*, const float*, const float*, size_t, float*);
+    float (*dotU8)(const float*, const uint8_t*, size_t);
+    uint64_t (*intersectionU8)(const uint8_t*, const uint8_t*, size_t);
+    uint64_t (*intersectionU16)(const uint16_t*, const uint16_t*, size_t);
+    const RowScanTable* rowScans;
+};
+
+static const KernelSet kernelSets[] = {
+#ifdef DISTANCE_KERNELS_X86
+    {"avx512", ssdAVX512, intersectionAVX512, dotAVX512, dotNormAVX512, dot4x2AVX512, dotU8AVX512, intersectionU8AVX2, intersectionU16AVX2, &rowScansAVX512},
+    {"avx2", ssdAVX2, intersectionAVX2, dotAVX2, dotNormAVX2, dot4x2AVX2, dotU8AVX2, intersectionU8AVX2, intersectionU16AVX2, &rowScansAVX2},
+    {"sse", ssdSSE, intersectionSSE, dotSSE, dotNormSSE, dot4x2SSE, dotU8SSE, intersectionU8SSE, intersectionU16SSE, &rowScansSSE},
+#endif
+    {"scalar", ssdScalar, intersectionScalar, dotScalar, dotNormScalar, dot4x2Scalar, dotU8Scalar, intersectionU8Scalar, intersectionU16Scalar, &rowScansScalar},
+};
+
+static bool isaSupported(const KernelSet& set) {
+#ifdef DISTANCE_KERNELS_X86
+    if (std::string(set.isa) != "scalar") {
+        return cpuSupports(set.isa);
+    }
+#endif
+    return true;
+}
+
+static const KernelSet* activeKernels = nullptr;
+
+// Picks the first (widest) supported set; a function-local static makes the first call thread-safe
+static const KernelSet& kernels() {
+    static const KernelSet* detected = []() {
+        for (const auto& set : kernelSets) {
+            if (isaSupported(set)) {
+                return &set;
+            }
+        }
+        return &kernelSets[sizeof(kernelSets) / sizeof(kernelSets[0]) - 1];
+    }();
+    return activeKernels ? *activeKernels : *detected;
+}
+
+float computeSSD(const float* a, const float* b, size_t n) {
+    return kernels().ssd(a, b, n);
+}
+
+float computeEuclideanDistance(const float* a, const float* b, size_t n) {
+    return std::sqrt(kernels().ssd(a, b, n));
+}
+
+float histogramIntersection(const float* a, const float* b, size_t n) {
+    return kernels().intersection(a, b, n);
+}
+
+float dotProduct(const float* a, const float* b, size_t n) {
+    return kernels().dot(a, b, n);
+}
+
+float l2Norm(const float* a, size_t n) {
+    return std::sqrt(kernels().dot(a, a, n));
+}
+
+float cosineDistance(const float* a, float normA, const float* b, size_t n) {
+    float dot, normB2;
+    kernels().dotNorm(a, b, n, &dot, &normB2);
+    float normB = std::sqrt(normB2);
+    // Avoid division by zero
+    if (normA == 0.0f || normB == 0.0f) {
+        return 1.0f; // Max distance in case of zero vector
+    }
+    return 1.0f - dot / (normA * normB);
+}
+
+float cosineDistance(const float* a, float normA, const float* b, float normB, size_t n) {
+    // Avoid division by zero
+    if (normA == 0.0f || normB == 0.0f) {
+        return 1.0f; // Max distance in case of zero vector
+    }
+    return 1.0f - kernels().dot(a, b, n) / (normA * normB);
+}
+
+uint64_t histogramIntersectionU8(const uint8_t* a, const uint8_t* b, size_t n) {
+    return kernels().intersectionU8(a, b, n);
+}
+
+uint64_t histogramIntersectionU16(const uint16_t* a, const uint16_t* b, size_t n) {
+    return kernels().intersectionU16(a, b, n);
+}
+
+float dotProductU8(const float* a, const uint8_t* b, size_t n) {
+    return kernels().dotU8(a, b, n);
+}
+
+void computeRowNorms(const float* data, size_t count, size_t dim, std::vector<float>& norms) {
+    norms.resize(count);
+    const KernelSet& set = kernels();
+    for (size_t i = 0; i < count; ++i) {
+        const float* row = data + i * dim;
+        norms[i] = std::sqrt(set.dot(row, row, dim));
+    }
+}
+
+void dotProductBlock(const float* queries, size_t numQueries, const float* rows, size_t numRows, size_t dim, float* out) {
+    const KernelSet& set = kernels();
+    float tile[8];
+    for (size_t q = 0; q < numQueries; q += 4) {
+        // A short last group repeats its final query; the duplicate results are simply not stored
+        size_t groupSize = std::min<size_t>(4, numQueries - q);
+        const float* group[4];
+        for (size_t j = 0; j < 4; ++j) {
+            group[j] = queries + (q + std::min(j, groupSize - 1)) * dim;
+        }
+        for (size_t r = 0; r < numRows; r += 2) {
+            const float* r0 = rows + r * dim;
+            const float* r1 = r + 1 < numRows ? r0 + dim : r0;
+            set.dot4x2(group, r0, r1, dim, tile);
+            for (size_t j = 0; j < groupSize; ++j) {
+                out[(q + j) * numRows + r] = tile[2 * j];
+                if (r + 1 < numRows) {
+                    out[(q + j) * numRows + r + 1] = tile[2 * j + 1];
+                }
+            }
+        }
+    }
+}
+
+void scanRows(RowScanMetric metric, const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores) {
+    size_t entry = 0;
+    for (size_t d = 0; d < ROW_SCAN_DIM_COUNT; ++d) {
+        if (rowScanDims[d] == dim) {
+            entry = d + 1;
+            break;
+        }
+    }
+    kernels().rowScans->scans[metric][entry](query, queryNorm, rows, count, dim, scores);
+}
+
+bool rowScanSpecialized(size_t dim) {
+    return std::find(std::begin(rowScanDims), std::end(rowScanDims), dim) != std::end(rowScanDims);
+}
+
+const char* distanceKernelIsa() {
+    return kernels().isa;
+}
+
+int selectDistanceKernels(const std::string& isa) {
+    for (const auto& set : kernelSets) {
+        if (isa == set.isa) {
+            if (!isaSupported(set)) {
+                return -1;
+            }
+            activeKernels = &set;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,80 @@
+// distanceKernels.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for distanceKernels.cpp, the distance and similarity functions shared by all of the match tools.
+//          Each function has scalar, SSE, AVX2 and AVX-512 implementations; the fastest one the CPU supports is chosen at
+//          runtime the first time any kernel is called.
+
+#ifndef DISTANCE_KERNELS_H
+#define DISTANCE_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Sum of squared differences between a and b
+float computeSSD(const float* a, const float* b, size_t n);
+
+// Euclidean (L2) distance, i.e. sqrt(computeSSD)
+float computeEuclideanDistance(const float* a, const float* b, size_t n);
+
+// Histogram intersection: sum of min(a[i], b[i]). Higher values mean more similar histograms.
+float histogramIntersection(const float* a, const float* b, size_t n);
+
+// Histogram intersection of fixed-point histograms (see quantizeFeatureRow); divide by the scale for the float value
+uint64_t histogramIntersectionU8(const uint8_t* a, const uint8_t* b, size_t n);
+uint64_t histogramIntersectionU16(const uint16_t* a, const uint16_t* b, size_t n);
+
+float dotProduct(const float* a, const float* b, size_t n);
+
+// Dot product of float weights with byte codes, e.g. a query against int8 quantized rows
+float dotProductU8(const float* a, const uint8_t* b, size_t n);
+
+float l2Norm(const float* a, size_t n);
+
+// Cosine distance 1 - a.b / (|a| |b|) given the precomputed norm of a; |b| is accumulated in the same pass as
+// the dot product. Returns 1 (maximum distance) if either vector is zero.
+float cosineDistance(const float* a, float normA, const float* b, size_t n);
+
+// Cosine distance with both norms precomputed, e.g. from computeRowNorms over a whole index
+float cosineDistance(const float* a, float normA, const float* b, float normB, size_t n);
+
+// L2 norm of each of the count rows of a row-major count x dim matrix
+void computeRowNorms(const float* data, size_t count, size_t dim, std::vector<float>& norms);
+
+// Dot products of every query with every row, out[q * numRows + r] = queries[q] . rows[r], for row-major blocks of
+// dim-value vectors. Computed four queries by two rows at a time so each loaded value is reused from registers;
+// callers tile large problems so that the row block stays in cache across query groups.
+void dotProductBlock(const float* queries, size_t numQueries, const float* rows, size_t numRows, size_t dim, float* out);
+
+// Metrics with a specialized row scan
+enum RowScanMetric {
+    ROW_SCAN_SSD,
+    ROW_SCAN_EUCLIDEAN,
+    ROW_SCAN_INTERSECTION,
+    ROW_SCAN_COSINE,
+    ROW_SCAN_METRICS
+};
+
+// Dimensions with a fully unrolled row scan: the fixed dimensions of the feature registry
+// (baseline, histogramMatching, multiHistogramMatching and centerSurroundHistogram, quadrantHistogram, gridHistogram,
+// cellGrid, wholeHistogram, deepNetwork, combinedFeatures)
+#define ROW_SCAN_DIMS 32, 48, 96, 147, 216, 384, 450, 512, 675
+
+// Scores query against count contiguous rows of dim values, scores[r] = metric(query, row r). Cosine takes the query's
+// norm and accumulates each row's norm in the same pass. Dimensions in ROW_SCAN_DIMS use a loop specialized for that
+// length; any other dimension uses the generic loop.
+void scanRows(RowScanMetric metric, const float* query, float queryNorm, const float* rows, size_t count, size_t dim, float* scores);
+
+// True if scanRows has a specialization for dim
+bool rowScanSpecialized(size_t dim);
+
+// Name of the instruction set the kernels are using: "avx512", "avx2", "sse" or "scalar"
+const char* distanceKernelIsa();
+
+// Forces a particular implementation (one of the names above), e.g. to compare against the scalar code.
+// Returns -1 if the name is unknown or the CPU does not support it.
+int selectDistanceKernels(const std::string& isa);
+
+#endif
@@ -0,0 +1,376 @@
+// evaluateRetrieval.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Runs every image of a query directory (e.g. olympus/test) against a feature index and reports the latency of
+//          each stage of a match - decode, extract, score and select, or search for --hnsw / --quantized - as p50, p95
+//          and p99, plus the one-off index load time. Given a ground-truth relevance file it also reports precision@k,
+//          recall@k and mAP, so a speed optimization (quantized stores, ANN search, reduced decode) can be judged
+//          together with what it costs in retrieval quality.
+//
+// Relevance file: one line per query, "<query filename>,<relevant filename>,<relevant filename>,...". Blank lines and
+// lines starting with # are ignored. The query's own row is never counted as relevant, as it is never returned.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "featureExtraction.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "hnswIndex.h"
+#include "indexPipeline.h"
+#include "matchEngine.h"
+#include "quantizedIndex.h"
+#include "topK.h"
+#include "trace.h"
+
+enum Stage { STAGE_DECODE, STAGE_EXTRACT, STAGE_SCORE, STAGE_SELECT, STAGE_SEARCH, STAGE_TOTAL, STAGE_COUNT };
+static const char* stageNames[STAGE_COUNT] = {"decode", "extract", "score", "select", "search", "total"};
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static int parseCutoffs(const std::string& list, std::vector<size_t>& cutoffs) {
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int k = atoi(item.c_str());
+        if (k <= 0) {
+            std::cerr << "Invalid cutoff " << item << "\n";
+            return -1;
+        }
+        cutoffs.push_back(static_cast<size_t>(k));
+    }
+    std::sort(cutoffs.begin(), cutoffs.end());
+    cutoffs.erase(std::unique(cutoffs.begin(), cutoffs.end()), cutoffs.end());
+    return cutoffs.empty() ? -1 : 0;
+}
+
+static int readRelevance(const std::string& path, std::unordered_map<std::string, std::vector<std::string>>& relevance) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Unable to open relevance file " << path << "\n";
+        return -1;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::stringstream ss(line);
+        std::string query, name;
+        std::getline(ss, query, ',');
+        std::vector<std::string>& relevant = relevance[query];
+        while (std::getline(ss, name, ',')) {
+            if (!name.empty()) {
+                relevant.push_back(name);
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <query_directory> <feature_vectors_file> <feature_type> [--metric name] [--scale 1|2|4|8]\n";
+        std::cerr << "       [--truth relevance_file] [--k 1,5,10] [--depth 100] [--hnsw graph_file] [--ef N] [--quantized code_file]\n";
+        std::cerr << "       [--rerank N] [--output per_query.csv]\n";
+        std::cerr << "       every image in the directory is matched; --depth results are retrieved per query and mAP is computed\n";
+        std::cerr << "       over them. Feature types that are not extracted from images match the queries by indexed filename\n";
+        return -1;
+    }
+
+    std::string queryDirectory = argv[1], featureVectorsFile = argv[2], featureType = argv[3];
+    std::string metricName, truthFile, graphFile, codeFile, outputFile;
+    std::vector<size_t> cutoffs;
+    size_t depth = 100, efSearch = 100, rerank = 100;
+    int decodeScale = 0;
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--metric") == 0 && i + 1 < argc) {
+            metricName = argv[++i];
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            if (parseDecodeScale(argv[++i], decodeScale) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--truth") == 0 && i + 1 < argc) {
+            truthFile = argv[++i];
+        } else if (strcmp(argv[i], "--k") == 0 && i + 1 < argc) {
+            if (parseCutoffs(argv[++i], cutoffs) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+        } else if (strcmp(argv[i], "--hnsw") == 0 && i + 1 < argc) {
+            graphFile = argv[++i];
+        } else if (strcmp(argv[i], "--ef") == 0 && i + 1 < argc) {
+            efSearch = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--quantized") == 0 && i + 1 < argc) {
+            codeFile = argv[++i];
+        } else if (strcmp(argv[i], "--rerank") == 0 && i + 1 < argc) {
+            rerank = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return -1;
+        }
+    }
+    if (cutoffs.empty()) {
+        cutoffs = {1, 5, 10};
+    }
+    depth = std::max(depth, cutoffs.back());
+    bool approximate = !graphFile.empty() || !codeFile.empty();
+
+    const FeatureMethod* method = findFeatureMethod(featureType);
+    if (!method) {
+        std::cerr << "Unknown feature type " << featureType << "\n";
+        return -1;
+    }
+    if (metricName.empty()) {
+        metricName = method->defaultMetric;
+    }
+    const MatchMetric* metric = findMatchMetric(metricName);
+    if (!metric) {
+        std::cerr << "Unknown metric " << metricName << "\n";
+        return -1;
+    }
+    if (!graphFile.empty() && !codeFile.empty()) {
+        std::cerr << "Use either --hnsw or --quantized, not both\n";
+        return -1;
+    }
+    if (approximate && metric->scan != ROW_SCAN_COSINE) {
+        std::cerr << "--hnsw and --quantized rank by cosine distance, not " << metric->name << "\n";
+        return -1;
+    }
+
+    std::unordered_map<std::string, std::vector<std::string>> relevance;
+    if (!truthFile.empty() && readRelevance(truthFile, relevance) != 0) {
+        return -1;
+    }
+
+    // Index load, as matchImages does it: the store plus whichever search structure is used
+    auto loadStart = Clock::now();
+    FeatureStore store;
+    if (openFeatureStore(featureVectorsFile, store, metric->scan != ROW_SCAN_INTERSECTION || approximate) != 0) {
+        return -1;
+    }
+    store.indexNames(); // every query and every relevant image is looked up by name
+    HnswIndex graph;
+    QuantizedIndex codes;
+    if (!graphFile.empty() && openHnswIndex(graphFile, store, graph) != 0) {
+        return -1;
+    }
+    if (!codeFile.empty() && openQuantizedIndex(codeFile, store, codes) != 0) {
+        return -1;
+    }
+    double loadMilliseconds = millisecondsSince(loadStart);
+    if (!store.featureType.empty() && store.featureType != featureType) {
+        std::cerr << "Feature file " << featureVectorsFile << " holds " << store.featureType << " features, not " << featureType << "\n";
+        return -1;
+    }
+    if (store.dim != method->dim) {
+        std::cerr << "Feature file " << featureVectorsFile << " has " << store.dim << " values per image, expected " << method->dim << "\n";
+        return -1;
+    }
+    if (decodeScale == 0) {
+        decodeScale = store.decodeScale > 0 ? static_cast<int>(store.decodeScale) : 1;
+    }
+
+    std::vector<std::string> queries;
+    if (scanDirectory(queryDirectory, queries) != 0) {
+        return -1;
+    }
+    std::sort(queries.begin(), queries.end());
+
+    FILE* out = nullptr;
+    if (!outputFile.empty()) {
+        out = fopen(outputFile.c_str(), "w");
+        if (!out) {
+            std::cerr << "Unable to open output file " << outputFile << "\n";
+            return -1;
+        }
+        fprintf(out, "query,relevant,ap");
+        for (size_t k : cutoffs) {
+            fprintf(out, ",p@%zu,r@%zu", k, k);
+        }
+        fprintf(out, ",total_ms\n");
+    }
+
+    std::vector<double> latencies[STAGE_COUNT];
+    std::vector<double> precisionSum(cutoffs.size(), 0.0), recallSum(cutoffs.size(), 0.0);
+    std::vector<float> scores(approximate ? 0 : store.count);
+    double apSum = 0;
+    size_t evaluated = 0, judged = 0;
+    for (const std::string& path : queries) {
+        std::string name = std::filesystem::path(path).filename().string();
+        long selfRow = store.find(name);
+        uint32_t excludeId = selfRow >= 0 ? static_cast<uint32_t>(selfRow) : TopKSelector::NO_EXCLUDE;
+        auto queryStart = Clock::now();
+
+        // Extractable feature types decode the query; the others can only be matched by indexed filename
+        std::vector<float> features;
+        if (method->extract) {
+            auto start = Clock::now();
+            cv::Mat image = readImage(path, decodeScale);
+            if (image.empty()) {
+                std::cerr << "Skipping query " << path << ": not a readable image\n";
+                continue;
+            }
+            latencies[STAGE_DECODE].push_back(millisecondsSince(start));
+            start = Clock::now();
+            PreparedImage prepared(image);
+            features = method->extract(prepared);
+            latencies[STAGE_EXTRACT].push_back(millisecondsSince(start));
+        } else if (selfRow >= 0 && store.data) {
+            features.assign(store.row(selfRow), store.row(selfRow) + store.dim);
+        } else {
+            std::cerr << "Skipping query " << name << ": not in the index\n";
+            continue;
+        }
+
+        MatchQuery query;
+        if (prepareMatchQuery(store, *metric, features.data(), query) != 0) {
+            return -1;
+        }
+        std::vector<ScoredId> matches;
+        auto start = Clock::now();
+        if (!codeFile.empty()) {
+            matches = searchQuantizedIndex(codes, store, query.values, depth, rerank, excludeId);
+            latencies[STAGE_SEARCH].push_back(millisecondsSince(start));
+        } else if (!graphFile.empty()) {
+            matches = searchHnswIndex(graph, store, query.values, depth, efSearch, excludeId);
+            latencies[STAGE_SEARCH].push_back(millisecondsSince(start));
+        } else {
+            scoreMatchRows(store, *metric, query, 0, store.count, scores.data());
+            latencies[STAGE_SCORE].push_back(millisecondsSince(start));
+            start = Clock::now();
+            TopKSelector best(depth, metric->largerIsBetter, excludeId);
+            for (size_t i = 0; i < store.count; ++i) {
+                best.push(scores[i], static_cast<uint32_t>(i));
+            }
+            matches = best.results();
+            latencies[STAGE_SELECT].push_back(millisecondsSince(start));
+        }
+        double totalMilliseconds = millisecondsSince(queryStart);
+        latencies[STAGE_TOTAL].push_back(totalMilliseconds);
+        ++evaluated;
+
+        auto truth = relevance.find(name);
+        std::unordered_set<uint32_t> relevant;
+        if (truth != relevance.end()) {
+            for (const std::string& relevantName : truth->second) {
+                long row = store.find(relevantName);
+                if (row >= 0 && row != selfRow) {
+                    relevant.insert(static_cast<uint32_t>(row));
+                }
+            }
+            if (relevant.empty()) {
+                std::cerr << "No relevant image of " << name << " is in the index\n";
+            }
+        }
+        // A query with nothing to judge it by still gets its row, with the quality fields left empty
+        if (relevant.empty()) {
+            if (out) {
+                fprintf(out, "%s,,", name.c_str());
+                for (size_t c = 0; c < cutoffs.size(); ++c) {
+                    fprintf(out, ",,");
+                }
+                fprintf(out, ",%.3f\n", totalMilliseconds);
+            }
+            continue;
+        }
+        ++judged;
+
+        // Average precision over the retrieved depth, normalized by the relevant images it could have found
+        double ap = 0;
+        size_t hits = 0;
+        std::vector<size_t> hitsAt(cutoffs.size(), 0);
+        for (size_t i = 0; i < matches.size(); ++i) {
+            if (relevant.count(matches[i].id)) {
+                ++hits;
+                ap += static_cast<double>(hits) / static_cast<double>(i + 1);
+            }
+            for (size_t c = 0; c < cutoffs.size(); ++c) {
+                if (i + 1 == cutoffs[c]) {
+                    hitsAt[c] = hits;
+                }
+            }
+        }
+        for (size_t c = 0; c < cutoffs.size(); ++c) {
+            if (matches.size() < cutoffs[c]) {
+                hitsAt[c] = hits;
+            }
+        }
+        ap /= static_cast<double>(std::min(relevant.size(), depth));
+        apSum += ap;
+        if (out) {
+            fprintf(out, "%s,%zu,%.4f", name.c_str(), relevant.size(), ap);
+        }
+        for (size_t c = 0; c < cutoffs.size(); ++c) {
+            double precision = static_cast<double>(hitsAt[c]) / static_cast<double>(cutoffs[c]);
+            double recall = static_cast<double>(hitsAt[c]) / static_cast<double>(relevant.size());
+            precisionSum[c] += precision;
+            recallSum[c] += recall;
+            if (out) {
+                fprintf(out, ",%.4f,%.4f", precision, recall);
+            }
+        }
+        if (out) {
+            fprintf(out, ",%.3f\n", totalMilliseconds);
+        }
+    }
+    if (out && fclose(out) != 0) {
+        std::cerr << "Error writing " << outputFile << "\n";
+        return -1;
+    }
+    if (evaluated == 0) {
+        std::cerr << "No queries could be evaluated in " << queryDirectory << "\n";
+        return -1;
+    }
+
+    printf("Evaluated %zu queries against %zu images (%s, %s, %s, decode scale %d)\n", evaluated, store.count, featureType.c_str(),
+           metric->name, !graphFile.empty() ? "HNSW" : !codeFile.empty() ? "quantized" : "exact scan", decodeScale);
+    printf("Index load: %.2f ms\n", loadMilliseconds);
+    printf("%-8s %10s %10s %10s %10s\n", "stage", "p50 ms", "p95 ms", "p99 ms", "mean ms");
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        std::vector<double>& samples = latencies[s];
+        if (samples.empty()) {
+            continue;
+        }
+        std::sort(samples.begin(), samples.end());
+        double mean = 0;
+        for (double v : samples) {
+            mean += v;
+        }
+        mean /= static_cast<double>(samples.size());
+        printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", stageNames[s], percentile(samples, 50), percentile(samples, 95), percentile(samples, 99), mean);
+    }
+
+    if (!truthFile.empty()) {
+        printf("Quality over %zu queries with ground truth:\n", judged);
+        if (judged > 0) {
+            for (size_t c = 0; c < cutoffs.size(); ++c) {
+                printf("  P@%-4zu %.4f   R@%-4zu %.4f\n", cutoffs[c], precisionSum[c] / static_cast<double>(judged), cutoffs[c],
+                       recallSum[c] / static_cast<double>(judged));
+            }
+            printf("  mAP@%zu %.4f\n", depth, apSum / static_cast<double>(judged));
+        }
+    }
+    return 0;
+}
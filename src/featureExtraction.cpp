@@ -6,21 +6,25 @@
 #include "featureExtraction.h"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/imgcodecs.hpp"
+#include "mappedFile.h"
+#include "trace.h"
 #include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
 #include <vector>
 #include <algorithm>
 
 void customCalcHist(const cv::Mat& image, std::vector<float>& hist, int bins, float rangeStart, float rangeEnd) {
     hist.assign(bins, 0.0f);
     float binWidth = (rangeEnd - rangeStart) / bins;
-    int pixels = 0;
 
     // Check the depth of the image to determine how to access pixel values
     if (image.depth() == CV_8U) {
         for (int y = 0; y < image.rows; y++) {
+            const uchar* row = image.ptr<uchar>(y); // Accessing pixels as uchar for 8-bit image
             for (int x = 0; x < image.cols; x++) {
-                uchar val = image.at<uchar>(y, x); // Accessing pixel as uchar for 8-bit image
-                int bin = static_cast<int>((val - rangeStart) / binWidth);
+                int bin = static_cast<int>((row[x] - rangeStart) / binWidth);
                 if (bin >= 0 && bin < bins) {
                     hist[bin] += 1.0f;
                 }
@@ -28,9 +32,9 @@ void customCalcHist(const cv::Mat& image, std::vector<float>& hist, int bins, fl
         }
     } else if (image.depth() == CV_32F) {
         for (int y = 0; y < image.rows; y++) {
+            const float* row = image.ptr<float>(y); // Accessing pixels as float for floating-point image
             for (int x = 0; x < image.cols; x++) {
-                float val = image.at<float>(y, x); // Accessing pixel as float for floating-point image
-                int bin = static_cast<int>((val - rangeStart) / binWidth);
+                int bin = static_cast<int>((row[x] - rangeStart) / binWidth);
                 if (bin >= 0 && bin < bins) {
                     hist[bin] += 1.0f;
                 }
@@ -70,20 +74,106 @@ void customNormalizeL1(std::vector<float>& hist, float lower, float upper) {
     }
 }
 
+cv::Mat readImage(const std::string& path, int scale) {
+    TRACE_SCOPE("decode");
+    // The file is mapped and decoded in place rather than read by imread, so bytes prefetched into the page cache
+    // (see prefetchFile) are decoded without another copy or a blocking read
+    MappedFile file;
+    if (mapFile(path, file) != 0 || file.size == 0) {
+        return cv::Mat();
+    }
+    traceCount("bytes read", file.size);
+    cv::Mat bytes(1, static_cast<int>(file.size), CV_8U, const_cast<char*>(file.data));
+    switch (scale) {
+    case 2:
+        return cv::imdecode(bytes, cv::IMREAD_REDUCED_COLOR_2);
+    case 4:
+        return cv::imdecode(bytes, cv::IMREAD_REDUCED_COLOR_4);
+    case 8:
+        return cv::imdecode(bytes, cv::IMREAD_REDUCED_COLOR_8);
+    default:
+        return cv::imdecode(bytes, cv::IMREAD_COLOR);
+    }
+}
+
+int parseDecodeScale(const std::string& text, int& scale) {
+    if (text != "1" && text != "2" && text != "4" && text != "8") {
+        printf("Unknown decode scale %s, expected 1, 2, 4 or 8\n", text.c_str());
+        return -1;
+    }
+    scale = std::stoi(text);
+    return 0;
+}
+
+const std::vector<cv::Mat>& PreparedImage::channels() {
+    if (!hasChannels_) {
+        cv::split(image, channels_);
+        hasChannels_ = true;
+    }
+    return channels_;
+}
+
+const std::vector<uint32_t>& PreparedImage::bandValueCounts() {
+    if (bandValueCounts_.empty()) {
+        const int bandSize = 3 * HISTOGRAM_VALUES;
+        int half = image.rows / 2;
+        bandValueCounts_.assign(3 * bandSize, 0);
+        countChannelValues(image.rowRange(0, half), bandValueCounts_.data());
+        countChannelValues(image.rowRange(half, 2 * half), bandValueCounts_.data() + bandSize);
+        countChannelValues(image.rowRange(2 * half, image.rows), bandValueCounts_.data() + 2 * bandSize);
+    }
+    return bandValueCounts_;
+}
+
+const CellHistogramGrid& PreparedImage::cellGrid(int gridRows, int gridCols) {
+    for (const CellHistogramGrid& grid : cellGrids_) {
+        if (grid.gridRows() == gridRows && grid.gridCols() == gridCols) {
+            return grid;
+        }
+    }
+
+    cv::Mat bgr = image;
+    if (image.type() != CV_8UC3) {
+        image.convertTo(bgr, CV_8U);
+        if (bgr.channels() == 1) {
+            cv::cvtColor(bgr, bgr, cv::COLOR_GRAY2BGR);
+        } else if (bgr.channels() == 4) {
+            cv::cvtColor(bgr, bgr, cv::COLOR_BGRA2BGR);
+        }
+    }
+    cellGrids_.emplace_back();
+    buildCellHistogramGrid(bgr, uniformEdges(bgr.rows, gridRows), uniformEdges(bgr.cols, gridCols), cellGrids_.back());
+    return cellGrids_.back();
+}
+
 // Function to extract a 7x7 feature vector from the center of each channel of the image
-std::vector<float> extractFeatureVector(const cv::Mat& image) {
+std::vector<float> extractFeatureVector(PreparedImage& prepared) {
+    const cv::Mat& image = prepared.image;
     int centerX = image.cols / 2;
     int centerY = image.rows / 2;
     int size = 7;
 
     cv::Rect roi(centerX - size/2, centerY - size/2, size, size);
 
-    std::vector<cv::Mat> channels;
-    cv::split(image, channels);
-
     std::vector<float> featureVector;
     featureVector.reserve(size * size * 3); 
 
+    // 8-bit BGR images are read in place, one channel after the other, rather than split
+    bool inside = roi.x >= 0 && roi.y >= 0 && roi.x + roi.width <= image.cols && roi.y + roi.height <= image.rows;
+    if (image.type() == CV_8UC3 && inside) {
+        for (int c = 0; c < 3; c++) {
+            for (int y = roi.y; y < roi.y + roi.height; y++) {
+                const uchar* row = image.ptr<uchar>(y);
+                for (int x = roi.x; x < roi.x + roi.width; x++) {
+                    featureVector.push_back(static_cast<float>(row[3 * x + c]));
+                }
+            }
+        }
+        return featureVector;
+    }
+
+    const std::vector<cv::Mat>& channels = prepared.channels();
+
     for (const auto& channel : channels) {
         cv::Mat cropped = channel(roi).clone();
         for (int y = 0; y < cropped.rows; y++) {
@@ -96,7 +186,21 @@ std::vector<float> extractFeatureVector(const cv::Mat& image) {
     return featureVector;
 }
 
-std::vector<float> extractColorHistogram(const cv::Mat& image) {
+std::vector<float> extractColorHistogram(PreparedImage& prepared) {
+    const cv::Mat& image = prepared.image;
+    int bins = 16; // 16 bins for each dimension
+
+    // 8-bit BGR images are binned straight from the pixels, with the same bins as the float path below
+    if (image.type() == CV_8UC3) {
+        uint32_t countsR[16], countsG[16];
+        countChromaticity(image, bins, countsR, countsG);
+
+        std::vector<float> histVector;
+        appendNormalizedCounts(countsR, bins, image.total(), histVector);
+        appendNormalizedCounts(countsG, bins, image.total(), histVector);
+        return histVector;
+    }
+
     // Convert image to float and normalize to 1
     cv::Mat imageFloat;
     image.convertTo(imageFloat, CV_32F, 1.0/255);
@@ -108,7 +212,6 @@ std::vector<float> extractColorHistogram(const cv::Mat& image) {
     cv::Mat g = channels[1] / (channels[0] + channels[1] + channels[2] + 1e-6);
 
     // Compute the histogram for r and g channels
-    int bins = 16; // 16 bins for each dimension
     std::vector<float> histR, histG;
     customCalcHist(r, histR, bins, 0, 1); // Compute histogram for r chromaticity
     customCalcHist(g, histG, bins, 0, 1); // Compute histogram for g chromaticity
@@ -125,7 +228,8 @@ std::vector<float> extractColorHistogram(const cv::Mat& image) {
     return histVector;
 }
 
-std::vector<float> extractRGBHistograms(const cv::Mat& image) {
+std::vector<float> extractRGBHistograms(PreparedImage& prepared) {
+    const cv::Mat& image = prepared.image;
     std::vector<float> featureVector;
     int bins = 8; // Number of bins for histogram
 
@@ -133,23 +237,36 @@ std::vector<float> extractRGBHistograms(const cv::Mat& image) {
     cv::Rect topHalf(0, 0, image.cols, image.rows / 2);
     cv::Rect bottomHalf(0, image.rows / 2, image.cols, image.rows / 2);
 
-    // Ensure we're working with an 8-bit image
-    cv::Mat image8u;
+    // 8-bit BGR images fold the shared per-band value counts into bins
+    if (image.type() == CV_8UC3) {
+        int16_t lut[HISTOGRAM_VALUES];
+        makeBinLut(bins, 0, 256, lut);
+        const std::vector<uint32_t>& bands = prepared.bandValueCounts();
+        size_t halfPixels = static_cast<size_t>(image.cols) * (image.rows / 2);
+        uint32_t counts[8];
+        for (int band = 0; band < 2; band++) { // Top half, then bottom half
+            for (int i = 0; i < 3; i++) { // For each color channel
+                foldValueCounts(bands.data() + (band * 3 + i) * HISTOGRAM_VALUES, lut, bins, counts);
+                appendNormalizedCounts(counts, bins, halfPixels, featureVector);
+            }
+        }
+        return featureVector;
+    }
+
+    // Ensure we're working with an 8-bit image; 8-bit images reuse the shared full-image channel split
+    std::vector<cv::Mat> converted;
     if (image.depth() != CV_8U) {
+        cv::Mat image8u;
         image.convertTo(image8u, CV_8U); // Convert to 8-bit if not already
-    } else {
-        image8u = image;
+        cv::split(image8u, converted);
     }
+    const std::vector<cv::Mat>& channels = image.depth() != CV_8U ? converted : prepared.channels();
 
     // Process each half
     for (const auto& region : {topHalf, bottomHalf}) {
-        cv::Mat roi = image8u(region);
-        std::vector<cv::Mat> channels;
-        cv::split(roi, channels); // Split into color channels
-
         for (int i = 0; i < 3; i++) { // For each color channel
             std::vector<float> hist;
-            customCalcHist(channels[i], hist, bins, 0, 256); // Calculate histogram
+            customCalcHist(channels[i](region), hist, bins, 0, 256); // Calculate histogram
             customNormalizeL1(hist, 0, 1); // Normalize the histogram
 
             // Append histogram data to feature vector
@@ -160,13 +277,31 @@ std::vector<float> extractRGBHistograms(const cv::Mat& image) {
     return featureVector;
 }
 
-std::vector<float> extractWholeHistogram(const cv::Mat& image) {
+std::vector<float> extractWholeHistogram(PreparedImage& prepared) {
     int binsPerChannel = 150; // 100 bins for each RGB channel
     std::vector<float> featureVector;
 
+    // 8-bit BGR images sum the shared per-band value counts and fold them into bins
+    if (prepared.image.type() == CV_8UC3) {
+        int16_t lut[HISTOGRAM_VALUES];
+        makeBinLut(binsPerChannel, 0, 256, lut);
+        const std::vector<uint32_t>& bands = prepared.bandValueCounts();
+        uint32_t values[HISTOGRAM_VALUES], counts[150];
+        for (int i = 0; i < 3; i++) {
+            for (int v = 0; v < HISTOGRAM_VALUES; v++) {
+                values[v] = 0;
+                for (int band = 0; band < 3; band++) {
+                    values[v] += bands[(band * 3 + i) * HISTOGRAM_VALUES + v];
+                }
+            }
+            foldValueCounts(values, lut, binsPerChannel, counts);
+            appendNormalizedCounts(counts, binsPerChannel, prepared.image.total(), featureVector);
+        }
+        return featureVector;
+    }
+
     // Assuming image is already in RGB format. If not, convert it using cv::cvtColor if needed.
-    std::vector<cv::Mat> channels(3);
-    cv::split(image, channels); // Split the image into its color channels
+    const std::vector<cv::Mat>& channels = prepared.channels(); // The image split into its color channels
 
     // Compute and normalize histogram for each channel
     for (int i = 0; i < 3; i++) { // Iterate over RGB channels
@@ -180,7 +315,20 @@ std::vector<float> extractWholeHistogram(const cv::Mat& image) {
 }
 
 
-std::vector<float> extractTextureFeatures(const cv::Mat& image) {
+std::vector<float> extractTextureFeatures(PreparedImage& prepared) {
+    const cv::Mat& image = prepared.image;
+    int magBins = 112, angleBins = 113;
+
+    // 8-bit BGR images go through the fused gray/Sobel/binning pass, with no full-image temporaries
+    if (image.type() == CV_8UC3) {
+        uint32_t magCounts[112], angleCounts[113];
+        countGradientBins(image, magBins, angleBins, magCounts, angleCounts);
+        std::vector<float> featureVector;
+        appendNormalizedCounts(magCounts, magBins, image.total(), featureVector);
+        appendNormalizedCounts(angleCounts, angleBins, image.total(), featureVector);
+        return featureVector;
+    }
+
     cv::Mat gray, grad_x, grad_y;
     cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
     cv::Sobel(gray, grad_x, CV_32F, 1, 0, 3);
@@ -189,7 +337,6 @@ std::vector<float> extractTextureFeatures(const cv::Mat& image) {
     cv::Mat magnitude, angle;
     cv::cartToPolar(grad_x, grad_y, magnitude, angle, true);
 
-    int magBins = 112, angleBins = 113;
     std::vector<float> magHist, angleHist;
     std::vector<float> featureVector;
 
@@ -208,11 +355,139 @@ std::vector<float> extractTextureFeatures(const cv::Mat& image) {
     return featureVector;
 }
 
+#define SPATIAL_BINS 8   // bins per channel of the spatial histograms
+
+// Appends the channel histograms of one region of a cell grid, L1-normalized per channel
+static void appendRegionHistograms(const CellHistogramGrid& grid, const CellRegion& region, std::vector<float>& featureVector) {
+    int16_t lut[HISTOGRAM_VALUES];
+    makeBinLut(SPATIAL_BINS, 0, 256, lut);
+    uint32_t values[3 * HISTOGRAM_VALUES], counts[SPATIAL_BINS];
+    size_t pixels = regionValueCounts(grid, region, values);
+    for (int i = 0; i < 3; i++) {
+        if (pixels == 0) { // a cell of an image smaller than the grid
+            featureVector.insert(featureVector.end(), SPATIAL_BINS, 0.0f);
+            continue;
+        }
+        foldValueCounts(values + i * HISTOGRAM_VALUES, lut, SPATIAL_BINS, counts);
+        appendNormalizedCounts(counts, SPATIAL_BINS, pixels, featureVector);
+    }
+}
+
+// Every cell of a gridRows x gridCols grid as its own region, in row order
+static std::vector<float> extractCellRegions(PreparedImage& prepared, int gridRows, int gridCols) {
+    const CellHistogramGrid& grid = prepared.cellGrid(gridRows, gridCols);
+    std::vector<float> featureVector;
+    for (int r = 0; r < gridRows; r++) {
+        for (int c = 0; c < gridCols; c++) {
+            appendRegionHistograms(grid, {r, c, r + 1, c + 1, false}, featureVector);
+        }
+    }
+    return featureVector;
+}
+
+std::vector<float> extractQuadrantHistograms(PreparedImage& prepared) {
+    return extractCellRegions(prepared, 2, 2);
+}
+
+std::vector<float> extractGridHistograms(PreparedImage& prepared) {
+    return extractCellRegions(prepared, 3, 3);
+}
+
+std::vector<float> extractCenterSurroundHistograms(PreparedImage& prepared) {
+    const CellHistogramGrid& grid = prepared.cellGrid(4, 4);
+    std::vector<float> featureVector;
+    appendRegionHistograms(grid, {1, 1, 3, 3, false}, featureVector);
+    appendRegionHistograms(grid, {1, 1, 3, 3, true}, featureVector);
+    return featureVector;
+}
+
+std::vector<float> extractCellGrid(PreparedImage& prepared) {
+    const CellHistogramGrid& grid = prepared.cellGrid(CELL_GRID_SIZE, CELL_GRID_SIZE);
+    int16_t lut[HISTOGRAM_VALUES];
+    makeBinLut(CELL_GRID_BINS, 0, 256, lut);
+    size_t total = static_cast<size_t>(grid.rowEdges.back()) * grid.colEdges.back();
+    uint32_t values[3 * HISTOGRAM_VALUES], counts[CELL_GRID_BINS];
+    std::vector<float> featureVector;
+    featureVector.reserve(CELL_GRID_SIZE * CELL_GRID_SIZE * 3 * CELL_GRID_BINS);
+    for (int r = 0; r < CELL_GRID_SIZE; r++) {
+        for (int c = 0; c < CELL_GRID_SIZE; c++) {
+            regionValueCounts(grid, {r, c, r + 1, c + 1, false}, values);
+            for (int i = 0; i < 3; i++) {
+                foldValueCounts(values + i * HISTOGRAM_VALUES, lut, CELL_GRID_BINS, counts);
+                for (int b = 0; b < CELL_GRID_BINS; b++) {
+                    featureVector.push_back(total > 0 ? static_cast<float>(counts[b]) / total : 0.0f);
+                }
+            }
+        }
+    }
+    return featureVector;
+}
+
+std::vector<float> cellGridRegion(const float* cells, const CellRegion& region) {
+    const int cellValues = 3 * CELL_GRID_BINS;
+    std::vector<float> hist(cellValues, 0.0f);
+    for (int r = 0; r < CELL_GRID_SIZE; r++) {
+        for (int c = 0; c < CELL_GRID_SIZE; c++) {
+            bool inside = r >= region.row0 && r < region.row1 && c >= region.col0 && c < region.col1;
+            if (inside == region.surround) {
+                continue;
+            }
+            const float* cell = cells + (r * CELL_GRID_SIZE + c) * cellValues;
+            for (int v = 0; v < cellValues; v++) {
+                hist[v] += cell[v];
+            }
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        float sum = 0.0f;
+        for (int b = 0; b < CELL_GRID_BINS; b++) {
+            sum += hist[i * CELL_GRID_BINS + b];
+        }
+        if (sum > 0) {
+            for (int b = 0; b < CELL_GRID_BINS; b++) {
+                hist[i * CELL_GRID_BINS + b] /= sum;
+            }
+        }
+    }
+    return hist;
+}
+
 // Combine Color and Texture Features
-std::vector<float> extractCombinedFeatures(const cv::Mat& image) {
-    std::vector<float> colorFeatures = extractWholeHistogram(image);
-    std::vector<float> textureFeatures = extractTextureFeatures(image);
+std::vector<float> extractCombinedFeatures(PreparedImage& prepared) {
+    std::vector<float> colorFeatures = extractWholeHistogram(prepared);
+    std::vector<float> textureFeatures = extractTextureFeatures(prepared);
 
     colorFeatures.insert(colorFeatures.end(), textureFeatures.begin(), textureFeatures.end());
     return colorFeatures;
+}
+
+// Single-image entry points; each prepares the image for one extractor only
+std::vector<float> extractFeatureVector(const cv::Mat& image) {
+    PreparedImage prepared(image);
+    return extractFeatureVector(prepared);
+}
+
+std::vector<float> extractColorHistogram(const cv::Mat& image) {
+    PreparedImage prepared(image);
+    return extractColorHistogram(prepared);
+}
+
+std::vector<float> extractRGBHistograms(const cv::Mat& image) {
+    PreparedImage prepared(image);
+    return extractRGBHistograms(prepared);
+}
+
+std::vector<float> extractWholeHistogram(const cv::Mat& image) {
+    PreparedImage prepared(image);
+    return extractWholeHistogram(prepared);
+}
+
+std::vector<float> extractTextureFeatures(const cv::Mat& image) {
+    PreparedImage prepared(image);
+    return extractTextureFeatures(prepared);
+}
+
+std::vector<float> extractCombinedFeatures(const cv::Mat& image) {
+    PreparedImage prepared(image);
+    return extractCombinedFeatures(prepared);
 }
\ No newline at end of file
@@ -7,7 +7,45 @@
 #define FEATURE_EXTRACTION_H
 
 #include "opencv2/opencv.hpp"
+#include <cstdint>
+#include <deque>
+#include <string>
 #include <vector>
+#include "histogramCore.h"
+
+// A decoded image together with intermediates that several extractors share. Each intermediate is computed
+// on first use, so extracting several features from one PreparedImage decodes and splits the image only once.
+class PreparedImage {
+public:
+    explicit PreparedImage(const cv::Mat& image) : image(image) {}
+
+    const cv::Mat& image;
+
+    // cv::split of the full image
+    const std::vector<cv::Mat>& channels();
+
+    // Raw channel value counts (see countChannelValues) of the bands extractRGBHistograms splits an 8-bit BGR image
+    // into: band 0 is the top half, band 1 the bottom half and band 2 the last row of an odd-height image. Each band
+    // holds 3 * HISTOGRAM_VALUES counts.
+    const std::vector<uint32_t>& bandValueCounts();
+
+    // Cell histogram grid (see buildCellHistogramGrid) of the image over gridRows x gridCols near-equal cells, built
+    // once per grid size; images other than 8-bit BGR are converted first
+    const CellHistogramGrid& cellGrid(int gridRows, int gridCols);
+
+private:
+    std::vector<cv::Mat> channels_;
+    bool hasChannels_ = false;
+    std::vector<uint32_t> bandValueCounts_;
+    std::deque<CellHistogramGrid> cellGrids_;   // a deque, so references handed out stay valid
+};
+
+// Reads an image as 8-bit BGR at 1/scale of its width and height, for scale 1, 2, 4 or 8. JPEGs are downscaled by
+// the decoder in the DCT domain, so a reduced read is also a much cheaper decode; other formats are resized after decoding.
+cv::Mat readImage(const std::string& path, int scale = 1);
+
+// Parses a decode scale of 1, 2, 4 or 8
+int parseDecodeScale(const std::string& text, int& scale);
 
 std::vector<float> extractFeatureVector(const cv::Mat& image);
 
@@ -22,4 +60,29 @@ std::vector<float> extractTextureFeatures(const cv::Mat& image);
 
 std::vector<float> extractCombinedFeatures(const cv::Mat& image);
 
+// Variants that reuse the intermediates cached in a PreparedImage
+std::vector<float> extractFeatureVector(PreparedImage& image);
+std::vector<float> extractColorHistogram(PreparedImage& image);
+std::vector<float> extractRGBHistograms(PreparedImage& image);
+std::vector<float> extractWholeHistogram(PreparedImage& image);
+std::vector<float> extractTextureFeatures(PreparedImage& image);
+std::vector<float> extractCombinedFeatures(PreparedImage& image);
+
+// Spatial colour histograms: 8 bins per channel for every region of a layout of cells, each region L1-normalized per
+// channel as in extractRGBHistograms. The image is counted once into a cell grid and each region is a sum of cells.
+std::vector<float> extractQuadrantHistograms(PreparedImage& image);        // 2x2 quadrants, 96 values
+std::vector<float> extractGridHistograms(PreparedImage& image);            // 3x3 cells, 216 values
+std::vector<float> extractCenterSurroundHistograms(PreparedImage& image);  // inner 2x2 of a 4x4 grid, then the rest: 48 values
+
+// The 8-bin channel histograms of every cell of a CELL_GRID_SIZE x CELL_GRID_SIZE grid as fractions of the whole
+// image: 384 values, cell by cell in row order. Any region of cells can be matched from these with cellGridRegion,
+// without going back to the images.
+#define CELL_GRID_SIZE 4
+#define CELL_GRID_BINS 8
+std::vector<float> extractCellGrid(PreparedImage& image);
+
+// The channel histograms of region (in cells of the cellGrid grid) from a cellGrid vector, L1-normalized per channel:
+// 3 * CELL_GRID_BINS values, comparable between images whatever the region's share of each
+std::vector<float> cellGridRegion(const float* cells, const CellRegion& region);
+
 #endif 
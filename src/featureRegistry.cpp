@@ -0,0 +1,110 @@
+// featureRegistry.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: The tables of feature extraction methods and match metrics selectable by name.
+
+#include "featureRegistry.h"
+#include "distanceKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+static const FeatureMethod featureMethods[] = {
+    {"baseline", &extractFeatureVector, "ssd", 147, nullptr},
+    {"histogramMatching", &extractColorHistogram, "intersection", 32, nullptr},
+    {"multiHistogramMatching", &extractRGBHistograms, "intersection", 48, "score"},
+    {"wholeHistogram", &extractWholeHistogram, "intersection", 450, nullptr},
+    {"quadrantHistogram", &extractQuadrantHistograms, "intersection", 96, nullptr},
+    {"gridHistogram", &extractGridHistograms, "intersection", 216, nullptr},
+    {"centerSurroundHistogram", &extractCenterSurroundHistograms, "intersection", 48, nullptr},
+    {"cellGrid", &extractCellGrid, "intersection", 384, nullptr},
+    {"combinedFeatures", &extractCombinedFeatures, "euclidean", 675, nullptr},
+    {"deepNetwork", nullptr, "cosine", 512, nullptr},
+};
+
+static float ssdScore(const float* a, float, const float* b, float, size_t n) {
+    return computeSSD(a, b, n);
+}
+
+static float euclideanScore(const float* a, float, const float* b, float, size_t n) {
+    return computeEuclideanDistance(a, b, n);
+}
+
+static float intersectionScore(const float* a, float, const float* b, float, size_t n) {
+    return histogramIntersection(a, b, n);
+}
+
+static float cosineScore(const float* a, float normA, const float* b, float normB, size_t n) {
+    return cosineDistance(a, normA, b, normB, n);
+}
+
+// |a - b|^2 = |a|^2 + |b|^2 - 2 a.b in double, clamped because rounding can take it slightly below zero for
+// near-duplicates. The float dot product still limits precision when the norms are large; see scoreQueryBatch.
+static float ssdFromDot(double dot, double normA, double normB) {
+    return static_cast<float>(std::max(0.0, normA * normA + normB * normB - 2.0 * dot));
+}
+
+static float euclideanFromDot(double dot, double normA, double normB) {
+    return static_cast<float>(std::sqrt(std::max(0.0, normA * normA + normB * normB - 2.0 * dot)));
+}
+
+static float cosineFromDot(double dot, double normA, double normB) {
+    if (normA == 0.0 || normB == 0.0) {
+        return 1.0f;
+    }
+    return static_cast<float>(1.0 - dot / (normA * normB));
+}
+
+static const MatchMetric matchMetrics[] = {
+    {"ssd", &ssdScore, false, false, &ssdFromDot, ROW_SCAN_SSD, "distance"},
+    {"euclidean", &euclideanScore, false, false, &euclideanFromDot, ROW_SCAN_EUCLIDEAN, "distance"},
+    {"intersection", &intersectionScore, true, false, nullptr, ROW_SCAN_INTERSECTION, "intersection"},
+    {"cosine", &cosineScore, false, true, &cosineFromDot, ROW_SCAN_COSINE, "distance"},
+};
+
+const FeatureMethod* findFeatureMethod(const std::string& name) {
+    for (const auto& method : featureMethods) {
+        if (name == method.name) {
+            return &method;
+        }
+    }
+    return nullptr;
+}
+
+int parseFeatureMethods(const std::string& list, std::vector<const FeatureMethod*>& methods) {
+    std::istringstream iss(list);
+    std::string name;
+    while (std::getline(iss, name, ',')) {
+        const FeatureMethod* method = findFeatureMethod(name);
+        if (!method) {
+            printf("Unknown feature extraction method %s\n", name.c_str());
+            return -1;
+        }
+        if (!method->extract) {
+            printf("Feature type %s is not extracted from images\n", name.c_str());
+            return -1;
+        }
+        for (const FeatureMethod* existing : methods) {
+            if (existing == method) {
+                printf("Feature extraction method %s listed twice\n", name.c_str());
+                return -1;
+            }
+        }
+        methods.push_back(method);
+    }
+    if (methods.empty()) {
+        printf("No feature extraction method given\n");
+        return -1;
+    }
+    return 0;
+}
+
+const MatchMetric* findMatchMetric(const std::string& name) {
+    for (const auto& metric : matchMetrics) {
+        if (name == metric.name) {
+            return &metric;
+        }
+    }
+    return nullptr;
+}
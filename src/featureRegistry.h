@@ -0,0 +1,54 @@
+// featureRegistry.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for featureRegistry.cpp, the tables of feature extraction methods and match metrics selectable by
+//          name on the command line or in match server queries.
+
+#ifndef FEATURE_REGISTRY_H
+#define FEATURE_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include "distanceKernels.h"
+#include "featureExtraction.h"
+
+typedef std::vector<float> (*PreparedFeatureExtractor)(PreparedImage& image);
+
+struct FeatureMethod {
+    const char* name;                   // name used by readImages and stored in feature indexes
+    PreparedFeatureExtractor extract;   // nullptr for features computed outside this project (deep network embeddings)
+    const char* defaultMetric;          // metric matchImages ranks with unless told otherwise
+    size_t dim;                         // values per image; one of ROW_SCAN_DIMS, so its scans are fully unrolled.
+                                        // Only checked for extracted methods: external embeddings may have any size.
+    const char* scoreName;              // how matchImages labels default-metric scores, as the tool for this method
+                                        // always has; nullptr to use the metric's scoreName
+};
+
+// Every metric takes both vector norms so callers can precompute them once; only metrics with needsNorms use them
+typedef float (*MatchScoreFunction)(const float* a, float normA, const float* b, float normB, size_t n);
+
+// Score from the dot product and the two L2 norms, for metrics that can be computed as a matrix product in batches.
+// Norms are doubles: squaring float norms of 0-255 pixel vectors already costs several units of SSD.
+typedef float (*DotScoreFunction)(double dot, double normA, double normB);
+
+struct MatchMetric {
+    const char* name;
+    MatchScoreFunction score;
+    bool largerIsBetter;                // true for similarities such as histogram intersection
+    bool needsNorms;
+    DotScoreFunction fromDot;           // nullptr if the metric is not a function of a.b, |a| and |b|
+    RowScanMetric scan;                 // the row scan that computes the same score over a block of rows
+    const char* scoreName;              // how matchImages labels the score: "distance" or "intersection"
+};
+
+// Returns the method with the given name, or nullptr if there is none
+const FeatureMethod* findFeatureMethod(const std::string& name);
+
+// Parses a comma-separated list of method names for extraction. Returns -1 (after printing the bad name) if one is
+// unknown or is not extracted from images.
+int parseFeatureMethods(const std::string& list, std::vector<const FeatureMethod*>& methods);
+
+// Returns the metric with the given name ("ssd", "euclidean", "intersection" or "cosine"), or nullptr if there is none
+const MatchMetric* findMatchMetric(const std::string& name);
+
+#endif
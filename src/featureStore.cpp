@@ -0,0 +1,616 @@
+// featureStore.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Reading and writing feature indexes, either as memory-mapped binary stores or as CSV files.
+
+#include "featureStore.h"
+#include "trace.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <filesystem>
+#include <thread>
+
+// stdio buffer of an index writer, so rows reach the file in large blocks
+#define FEATURE_WRITER_BUFFER (1 << 20)
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool writePadding(FILE* fp, uint64_t from, uint64_t to) {
+    static const char zeros[FEATURE_STORE_ALIGNMENT] = {0};
+    while (from < to) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(to - from, sizeof(zeros)));
+        if (fwrite(zeros, 1, n, fp) != n) {
+            return false;
+        }
+        from += n;
+    }
+    return true;
+}
+
+static size_t dtypeSize(uint32_t dtype) {
+    switch (dtype) {
+    case FEATURE_DTYPE_U8:
+        return sizeof(uint8_t);
+    case FEATURE_DTYPE_U16:
+        return sizeof(uint16_t);
+    default:
+        return sizeof(float);
+    }
+}
+
+long FeatureStore::find(const std::string& name) const {
+    if (!rowsByName.empty()) {
+        auto row = rowsByName.find(name);
+        return row != rowsByName.end() ? static_cast<long>(row->second) : -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (name == filename(i)) {
+            return static_cast<long>(i);
+        }
+    }
+    return -1;
+}
+
+void FeatureStore::indexNames() {
+    rowsByName.clear();
+    rowsByName.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        rowsByName.emplace(filename(i), static_cast<uint32_t>(i));   // the first of duplicate names wins, as in a scan
+    }
+}
+
+// The name table holds count + 1 offsets into namesLength bytes of names: each offset must start a name that ends
+// before the next one does, the last must be the end of the names, and the names must end in a NUL
+static bool validNameTable(const uint64_t* offsets, uint64_t count, const char* names, uint64_t namesLength) {
+    if (offsets[0] != 0 || offsets[count] != namesLength || (namesLength > 0 && names[namesLength - 1] != '\0')) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        if (offsets[i] >= namesLength || offsets[i + 1] <= offsets[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isFeatureStorePath(const std::string& path) {
+    return std::filesystem::path(path).extension() == FEATURE_STORE_EXTENSION;
+}
+
+static int openBinaryStore(const std::string& path, FeatureStore& store, bool decodeQuantized) {
+    if (mapFile(path, store.file) != 0) {
+        printf("Unable to map feature store %s\n", path.c_str());
+        return -1;
+    }
+    traceCount("bytes mapped", store.file.size);
+
+    if (store.file.size < sizeof(FeatureStoreHeader)) {
+        printf("Feature store %s is truncated\n", path.c_str());
+        return -1;
+    }
+
+    FeatureStoreHeader header;
+    memcpy(&header, store.file.data, sizeof(header));
+    if (memcmp(header.magic, FEATURE_STORE_MAGIC, sizeof(header.magic)) != 0 || header.version != FEATURE_STORE_VERSION) {
+        printf("Feature store %s has an unsupported format\n", path.c_str());
+        return -1;
+    }
+    if (header.dtype != FEATURE_DTYPE_F32 && header.dtype != FEATURE_DTYPE_U8 && header.dtype != FEATURE_DTYPE_U16) {
+        printf("Feature store %s has an unsupported dtype %u\n", path.c_str(), header.dtype);
+        return -1;
+    }
+    if (header.dtype != FEATURE_DTYPE_F32 && header.quantScale != featureDTypeScale(header.dtype)) {
+        printf("Feature store %s has an unsupported scale %u\n", path.c_str(), header.quantScale);
+        return -1;
+    }
+
+    // Sizes are checked against the file before they are multiplied or added, so a corrupt header cannot overflow them
+    const uint64_t fileSize = store.file.size;
+    const uint64_t elementSize = dtypeSize(header.dtype);
+    if (header.dim > fileSize || header.count > fileSize / sizeof(uint64_t) ||
+        (header.dim > 0 && header.count > fileSize / header.dim / elementSize) ||
+        header.dataOffset > fileSize || header.namesOffset > fileSize || header.namesBytes > fileSize - header.namesOffset) {
+        printf("Feature store %s is corrupt\n", path.c_str());
+        return -1;
+    }
+    uint64_t dataBytes = header.count * header.dim * elementSize;
+    uint64_t offsetsBytes = (header.count + 1) * sizeof(uint64_t);
+    if (header.dataOffset % FEATURE_STORE_ALIGNMENT != 0 || dataBytes > fileSize - header.dataOffset ||
+        header.namesOffset % sizeof(uint64_t) != 0 || offsetsBytes > header.namesBytes ||
+        !validNameTable(reinterpret_cast<const uint64_t*>(store.file.data + header.namesOffset), header.count,
+                        store.file.data + header.namesOffset + offsetsBytes, header.namesBytes - offsetsBytes)) {
+        printf("Feature store %s is corrupt\n", path.c_str());
+        return -1;
+    }
+
+    header.featureType[sizeof(header.featureType) - 1] = '\0';
+    store.featureType = header.featureType;
+    store.dtype = header.dtype;
+    store.quantScale = header.dtype == FEATURE_DTYPE_F32 ? 0 : header.quantScale;
+    store.decodeScale = header.decodeScale;
+    store.dim = static_cast<size_t>(header.dim);
+    store.count = static_cast<size_t>(header.count);
+    store.nameOffsets = reinterpret_cast<const uint64_t*>(store.file.data + header.namesOffset);
+    store.names = store.file.data + header.namesOffset + offsetsBytes;
+
+    const char* block = store.file.data + header.dataOffset;
+    if (store.dtype == FEATURE_DTYPE_F32) {
+        store.data = reinterpret_cast<const float*>(block);
+        return 0;
+    }
+    store.codes = block;
+    if (decodeQuantized) {
+        size_t n = store.count * store.dim;
+        float inverse = 1.0f / static_cast<float>(store.quantScale);
+        store.ownedData.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            float code = store.dtype == FEATURE_DTYPE_U8 ? static_cast<const uint8_t*>(store.codes)[i] : static_cast<const uint16_t*>(store.codes)[i];
+            store.ownedData[i] = code * inverse;
+        }
+        store.data = store.ownedData.data();
+    }
+    return 0;
+}
+
+int openFeatureStore(const std::string& path, FeatureStore& store, bool decodeQuantized) {
+    TRACE_SCOPE("index load");
+    std::ifstream probe(path, std::ios::binary);
+    if (!probe) {
+        printf("Unable to open feature file %s\n", path.c_str());
+        return -1;
+    }
+
+    char magic[8] = {0};
+    probe.read(magic, sizeof(magic));
+    probe.close();
+
+    if (memcmp(magic, FEATURE_STORE_MAGIC, sizeof(magic)) == 0) {
+        return openBinaryStore(path, store, decodeQuantized);
+    }
+    return importFeatureCSV(path, store);
+}
+
+// CSV import splits the file into one chunk of lines per thread, with at least this many bytes per chunk
+#define CSV_CHUNK_BYTES (1 << 20)
+
+// A run of whole lines of a CSV file, parsed by one thread
+struct CsvChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    size_t firstRow = 0;
+    size_t rows = 0;
+    std::string names;
+    std::vector<uint64_t> nameOffsets;
+    size_t badRow = SIZE_MAX;   // first row of the chunk with the wrong number of values
+    size_t badValues = 0;
+};
+
+static inline const char* lineEnd(const char* p, const char* end) {
+    const char* newline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    return newline ? newline : end;
+}
+
+// Lines that are empty, or hold only the '\r' of a CRLF file, carry no row
+static inline bool isBlankLine(const char* p, const char* eol) {
+    return p == eol || (eol - p == 1 && *p == '\r');
+}
+
+static inline const char* skipSpace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+// Parses the comma-separated values of a line (after its filename) into out, storing at most capacity of them, and
+// returns how many there are. As with operator>>, parsing stops at the first field that is not a number.
+static size_t parseCsvValues(const char* p, const char* end, float* out, size_t capacity) {
+    size_t n = 0;
+    while (p < end) {
+        p = skipSpace(p, end);
+        if (p < end && *p == '+') {
+            p++;
+        }
+        float value;
+        std::from_chars_result parsed = std::from_chars(p, end, value);
+        if (parsed.ec != std::errc()) {
+            break;
+        }
+        if (n < capacity) {
+            out[n] = value;
+        }
+        n++;
+        p = skipSpace(parsed.ptr, end);
+        if (p == end || *p != ',') {
+            break;
+        }
+        p++;
+    }
+    return n;
+}
+
+static void countCsvRows(CsvChunk& chunk) {
+    for (const char* p = chunk.begin; p < chunk.end;) {
+        const char* eol = lineEnd(p, chunk.end);
+        chunk.rows += !isBlankLine(p, eol);
+        p = eol + 1;
+    }
+}
+
+// Parses the rows of a chunk straight into their place in data
+static void parseCsvChunk(CsvChunk& chunk, float* data, size_t dim) {
+    size_t row = chunk.firstRow;
+    chunk.nameOffsets.reserve(chunk.rows);
+    for (const char* p = chunk.begin; p < chunk.end;) {
+        const char* eol = lineEnd(p, chunk.end);
+        if (!isBlankLine(p, eol)) {
+            const char* comma = static_cast<const char*>(memchr(p, ',', static_cast<size_t>(eol - p)));
+            const char* nameEnd = comma ? comma : eol;
+            chunk.nameOffsets.push_back(chunk.names.size());
+            chunk.names.append(p, nameEnd);
+            chunk.names.push_back('\0');
+
+            size_t n = comma ? parseCsvValues(comma + 1, eol, data + row * dim, dim) : 0;
+            if (n != dim && chunk.badRow == SIZE_MAX) {
+                chunk.badRow = row;
+                chunk.badValues = n;
+            }
+            row++;
+        }
+        p = eol + 1;
+    }
+}
+
+int importFeatureCSV(const std::string& path, FeatureStore& store) {
+    TRACE_SCOPE("csv parse");
+    if (mapFile(path, store.file) != 0) {
+        printf("Unable to open feature file %s\n", path.c_str());
+        return -1;
+    }
+    traceCount("bytes read", store.file.size);
+    const char* begin = store.file.data;
+    const char* end = begin + store.file.size;
+
+    store.ownedData.clear();
+    store.ownedOffsets.clear();
+    store.ownedNames.clear();
+    store.dim = 0;
+    store.count = 0;
+
+    // The first row fixes the dimension, so every row can be parsed straight into a pre-sized block
+    for (const char* p = begin; p < end;) {
+        const char* eol = lineEnd(p, end);
+        if (!isBlankLine(p, eol)) {
+            const char* comma = static_cast<const char*>(memchr(p, ',', static_cast<size_t>(eol - p)));
+            store.dim = comma ? parseCsvValues(comma + 1, eol, nullptr, 0) : 0;
+            break;
+        }
+        p = eol + 1;
+    }
+
+    // Chunks end after a newline, so no line is split between two threads
+    size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), store.file.size / CSV_CHUNK_BYTES));
+    std::vector<CsvChunk> chunks(threads);
+    const char* chunkStart = begin;
+    for (size_t t = 0; t < threads; ++t) {
+        const char* chunkEnd = t + 1 == threads ? end : std::max(chunkStart, begin + store.file.size * (t + 1) / threads);
+        if (chunkEnd < end) {
+            chunkEnd = std::min(lineEnd(chunkEnd, end) + 1, end);
+        }
+        chunks[t].begin = chunkStart;
+        chunks[t].end = chunkEnd;
+        chunkStart = chunkEnd;
+    }
+
+    auto forEachChunk = [&](const std::function<void(CsvChunk&)>& fn) {
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; ++t) {
+            pool.emplace_back(fn, std::ref(chunks[t]));
+        }
+        fn(chunks[0]);
+        for (auto& thread : pool) {
+            thread.join();
+        }
+    };
+    forEachChunk(countCsvRows);
+    for (CsvChunk& chunk : chunks) {
+        chunk.firstRow = store.count;
+        store.count += chunk.rows;
+    }
+    store.ownedData.resize(store.count * store.dim);
+    forEachChunk([&](CsvChunk& chunk) { parseCsvChunk(chunk, store.ownedData.data(), store.dim); });
+    unmapFile(store.file);
+
+    for (const CsvChunk& chunk : chunks) {
+        if (chunk.badRow != SIZE_MAX) {
+            printf("Feature file %s: row %zu has %zu values, expected %zu\n", path.c_str(), chunk.badRow + 1, chunk.badValues, store.dim);
+            return -1;
+        }
+    }
+
+    store.ownedOffsets.reserve(store.count + 1);
+    for (CsvChunk& chunk : chunks) {
+        uint64_t base = store.ownedNames.size();
+        for (uint64_t offset : chunk.nameOffsets) {
+            store.ownedOffsets.push_back(base + offset);
+        }
+        store.ownedNames.append(chunk.names);
+    }
+    store.ownedOffsets.push_back(store.ownedNames.size());
+
+    store.featureType.clear();
+    store.dtype = FEATURE_DTYPE_F32;
+    store.data = store.ownedData.data();
+    store.nameOffsets = store.ownedOffsets.data();
+    store.names = store.ownedNames.data();
+    return 0;
+}
+
+int exportFeatureCSV(const FeatureStore& store, const std::string& path) {
+    if (isFeatureStorePath(path)) {
+        printf("CSV export path %s must not use the %s extension\n", path.c_str(), FEATURE_STORE_EXTENSION);
+        return -1;
+    }
+
+    FeatureIndexWriter writer;
+    if (openFeatureIndexWriter(path, store.featureType, writer) != 0) {
+        return -1;
+    }
+
+    std::vector<float> values(store.dim);
+    for (size_t i = 0; i < store.count; ++i) {
+        values.assign(store.row(i), store.row(i) + store.dim);
+        if (appendFeatureIndexRow(writer, store.filename(i), values) != 0) {
+            closeFeatureIndexWriter(writer);
+            return -1;
+        }
+    }
+    return closeFeatureIndexWriter(writer);
+}
+
+int writeFeatureStore(const std::string& path, const std::string& featureType, const std::vector<std::string>& filenames,
+                      const std::vector<float>& data, size_t dim, FeatureDType dtype, uint32_t decodeScale) {
+    if (!isFeatureStorePath(path) || data.size() != filenames.size() * dim) {
+        printf("Invalid feature store output %s\n", path.c_str());
+        return -1;
+    }
+
+    FeatureIndexWriter writer;
+    if (openFeatureIndexWriter(path, featureType, writer, false, dtype) != 0) {
+        return -1;
+    }
+    writer.decodeScale = decodeScale;
+
+    std::vector<float> values(dim);
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        values.assign(data.begin() + i * dim, data.begin() + (i + 1) * dim);
+        if (appendFeatureIndexRow(writer, filenames[i], values) != 0) {
+            closeFeatureIndexWriter(writer);
+            return -1;
+        }
+    }
+    return closeFeatureIndexWriter(writer);
+}
+
+int openFeatureIndexWriter(const std::string& path, const std::string& featureType, FeatureIndexWriter& writer, bool append,
+                           FeatureDType dtype) {
+    writer = FeatureIndexWriter();
+    writer.path = path;
+    writer.featureType = featureType;
+    writer.binary = isFeatureStorePath(path);
+    writer.dtype = dtype;
+
+    if (dtype != FEATURE_DTYPE_F32 && !writer.binary) {
+        printf("The %s dtype needs a binary feature store (%s) output, not %s\n", featureDTypeName(dtype), FEATURE_STORE_EXTENSION, path.c_str());
+        return -1;
+    }
+
+    if (append && writer.binary) {
+        printf("Cannot append to binary feature store %s\n", path.c_str());
+        return -1;
+    }
+
+    writer.fp = fopen(path.c_str(), writer.binary ? "wb" : (append ? "a" : "w"));
+    if (!writer.fp) {
+        printf("Unable to open output file %s\n", path.c_str());
+        return -1;
+    }
+    setvbuf(writer.fp, nullptr, _IOFBF, FEATURE_WRITER_BUFFER);
+
+    if (writer.binary) {
+        // Reserve the header and pad to the aligned start of the feature block; the real header
+        // is written once the row count and name table size are known.
+        if (!writePadding(writer.fp, 0, alignUp(sizeof(FeatureStoreHeader), FEATURE_STORE_ALIGNMENT))) {
+            fclose(writer.fp);
+            writer.fp = nullptr;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void formatFeatureCSVRow(const std::string& name, const float* values, size_t n, std::string& line) {
+    // to_chars with fixed precision 4 prints exactly what printf's "%.4f" does, without the per-call format parsing and
+    // locale lookups
+    line.assign(name);
+    char field[64];
+    field[0] = ',';
+    for (size_t i = 0; i < n; ++i) {
+        std::to_chars_result formatted = std::to_chars(field + 1, field + sizeof(field), values[i], std::chars_format::fixed, 4);
+        line.append(field, formatted.ptr);
+    }
+    line.push_back('\n');
+}
+
+int appendFeatureIndexRow(FeatureIndexWriter& writer, const std::string& image_filename, const std::vector<float>& values) {
+    if (!writer.fp) {
+        return -1;
+    }
+
+    if (writer.count == 0) {
+        writer.dim = values.size();
+    } else if (values.size() != writer.dim) {
+        printf("Feature vector for %s has %zu values, expected %zu\n", image_filename.c_str(), values.size(), writer.dim);
+        return -1;
+    }
+
+    std::string filenameOnly = std::filesystem::path(image_filename).filename().string();
+
+    if (writer.binary) {
+        const void* row = values.data();
+        std::vector<uint16_t> codes;
+        if (writer.dtype != FEATURE_DTYPE_F32) {
+            codes.resize(values.size());
+            if (quantizeFeatureRow(values.data(), values.size(), writer.dtype, codes.data()) != 0) {
+                printf("Feature vector for %s has values outside [0, 1], which the %s dtype cannot hold\n", image_filename.c_str(),
+                       featureDTypeName(writer.dtype));
+                return -1;
+            }
+            row = codes.data();
+        }
+        size_t elementSize = dtypeSize(writer.dtype);
+        if (!values.empty() && fwrite(row, elementSize, values.size(), writer.fp) != values.size()) {
+            printf("Unable to write to %s\n", writer.path.c_str());
+            return -1;
+        }
+        writer.nameOffsets.push_back(writer.names.size());
+        writer.names.append(filenameOnly);
+        writer.names.push_back('\0');
+    } else {
+        // The row is formatted into one line and written at once
+        std::string& line = writer.csvLine;
+        formatFeatureCSVRow(filenameOnly, values.data(), values.size(), line);
+        if (fwrite(line.data(), 1, line.size(), writer.fp) != line.size()) {
+            printf("Unable to write to %s\n", writer.path.c_str());
+            return -1;
+        }
+    }
+
+    writer.count++;
+    return 0;
+}
+
+int closeFeatureIndexWriter(FeatureIndexWriter& writer) {
+    if (!writer.fp) {
+        return -1;
+    }
+
+    int status = 0;
+    if (writer.binary) {
+        FeatureStoreHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FEATURE_STORE_MAGIC, sizeof(header.magic));
+        header.version = FEATURE_STORE_VERSION;
+        header.dtype = writer.dtype;
+        header.quantScale = featureDTypeScale(writer.dtype);
+        header.decodeScale = writer.decodeScale;
+        strncpy(header.featureType, writer.featureType.c_str(), sizeof(header.featureType) - 1);
+        header.dim = writer.dim;
+        header.count = writer.count;
+        header.dataOffset = alignUp(sizeof(FeatureStoreHeader), FEATURE_STORE_ALIGNMENT);
+
+        uint64_t dataEnd = header.dataOffset + header.count * header.dim * dtypeSize(writer.dtype);
+        header.namesOffset = alignUp(dataEnd, sizeof(uint64_t));
+        writer.nameOffsets.push_back(writer.names.size());
+        header.namesBytes = writer.nameOffsets.size() * sizeof(uint64_t) + writer.names.size();
+
+        bool ok = writePadding(writer.fp, dataEnd, header.namesOffset) &&
+                  fwrite(writer.nameOffsets.data(), sizeof(uint64_t), writer.nameOffsets.size(), writer.fp) == writer.nameOffsets.size() &&
+                  fwrite(writer.names.data(), 1, writer.names.size(), writer.fp) == writer.names.size() &&
+                  fseek(writer.fp, 0, SEEK_SET) == 0 &&
+                  fwrite(&header, sizeof(header), 1, writer.fp) == 1;
+        if (!ok) {
+            printf("Unable to write feature store %s\n", writer.path.c_str());
+            status = -1;
+        }
+    }
+
+    if (fclose(writer.fp) != 0) {
+        status = -1;
+    }
+    writer.fp = nullptr;
+    return status;
+}
+
+int parseFeatureDType(const std::string& name, FeatureDType& dtype) {
+    if (name == "f32") {
+        dtype = FEATURE_DTYPE_F32;
+    } else if (name == "u8") {
+        dtype = FEATURE_DTYPE_U8;
+    } else if (name == "u16") {
+        dtype = FEATURE_DTYPE_U16;
+    } else {
+        printf("Unknown feature dtype %s (expected f32, u8 or u16)\n", name.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+const char* featureDTypeName(uint32_t dtype) {
+    switch (dtype) {
+    case FEATURE_DTYPE_U8:
+        return "u8";
+    case FEATURE_DTYPE_U16:
+        return "u16";
+    default:
+        return "f32";
+    }
+}
+
+uint32_t featureDTypeScale(uint32_t dtype) {
+    switch (dtype) {
+    case FEATURE_DTYPE_U8:
+        return FEATURE_U8_SCALE;
+    case FEATURE_DTYPE_U16:
+        return FEATURE_U16_SCALE;
+    default:
+        return 0;
+    }
+}
+
+int quantizeFeatureRow(const float* values, size_t n, FeatureDType dtype, void* codes) {
+    double scale = featureDTypeScale(dtype), total = 0.0;
+    std::vector<uint32_t> levels(n);
+    std::vector<std::pair<double, size_t>> remainders(n);
+    int64_t assigned = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!(values[i] >= 0.0f && values[i] <= 1.0f)) {
+            return -1;
+        }
+        double scaled = values[i] * scale;
+        levels[i] = static_cast<uint32_t>(std::floor(scaled));
+        remainders[i] = std::make_pair(scaled - levels[i], i);
+        assigned += levels[i];
+        total += scaled;
+    }
+
+    // Largest remainder rounding: round the total, then give the missing units to the bins that lost the most.
+    // Ties go to the lower bin so the codes are deterministic.
+    int64_t missing = static_cast<int64_t>(std::llround(total)) - assigned;
+    if (missing > 0) {
+        std::sort(remainders.begin(), remainders.end(), [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+        for (int64_t k = 0; k < missing && k < static_cast<int64_t>(n); ++k) {
+            levels[remainders[k].second]++;
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t level = std::min<uint32_t>(levels[i], static_cast<uint32_t>(scale));
+        if (dtype == FEATURE_DTYPE_U8) {
+            static_cast<uint8_t*>(codes)[i] = static_cast<uint8_t>(level);
+        } else {
+            static_cast<uint16_t*>(codes)[i] = static_cast<uint16_t>(level);
+        }
+    }
+    return 0;
+}
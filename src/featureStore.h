@@ -0,0 +1,148 @@
+// featureStore.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for featureStore.cpp, a versioned binary feature index that the match tools can memory-map,
+//          plus the CSV import/export path used by the original tools.
+
+#ifndef FEATURE_STORE_H
+#define FEATURE_STORE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "mappedFile.h"
+
+// Binary layout (native little-endian, offsets from the start of the file):
+//   FeatureStoreHeader
+//   feature block at dataOffset, 64-byte aligned: count rows of dim values of type dtype
+//   (quantized dtypes store round(value * quantScale) per value, see quantizeFeatureRow)
+//   name table at namesOffset: (count + 1) uint64 offsets into the NUL-terminated names that follow
+#define FEATURE_STORE_MAGIC "CVFSTORE"
+#define FEATURE_STORE_VERSION 1
+#define FEATURE_STORE_ALIGNMENT 64
+#define FEATURE_STORE_EXTENSION ".cvfs"
+
+enum FeatureDType : uint32_t {
+    FEATURE_DTYPE_F32 = 0,
+    FEATURE_DTYPE_U8 = 1,     // fixed-point histograms, quantScale 255
+    FEATURE_DTYPE_U16 = 2     // fixed-point histograms, quantScale 65535
+};
+
+#define FEATURE_U8_SCALE 255
+#define FEATURE_U16_SCALE 65535
+
+struct FeatureStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    char featureType[32];   // readImages method name, e.g. "histogramMatching"
+    uint64_t dim;
+    uint64_t count;
+    uint64_t dataOffset;
+    uint64_t namesOffset;
+    uint64_t namesBytes;
+    uint32_t quantScale;    // fixed-point scale of the quantized dtypes, 0 for float stores
+    uint32_t decodeScale;   // images were decoded at 1/decodeScale size before extraction; 0 if not recorded (full size)
+    uint32_t reserved[8];
+};
+
+// An opened feature index. Rows are contiguous, so row(i) is a plain pointer into the mapping
+// (binary stores) or into ownedData (CSV imports); nothing is copied per row either way.
+// Quantized stores expose their codes through codes/rowU8/rowU16; data is only set if they were decoded on open.
+struct FeatureStore {
+    std::string featureType;
+    uint32_t dtype = FEATURE_DTYPE_F32;
+    uint32_t quantScale = 0;
+    uint32_t decodeScale = 0;   // 0 when the index does not record it (CSV files, older stores)
+    size_t dim = 0;
+    size_t count = 0;
+
+    const float* data = nullptr;
+    const void* codes = nullptr;
+    const uint64_t* nameOffsets = nullptr;
+    const char* names = nullptr;
+
+    MappedFile file;
+    std::vector<float> ownedData;
+    std::vector<uint64_t> ownedOffsets;
+    std::string ownedNames;
+    std::unordered_map<std::string, uint32_t> rowsByName;   // filled by indexNames; empty until then
+
+    const float* row(size_t i) const { return data + i * dim; }
+    const uint8_t* rowU8(size_t i) const { return static_cast<const uint8_t*>(codes) + i * dim; }
+    const uint16_t* rowU16(size_t i) const { return static_cast<const uint16_t*>(codes) + i * dim; }
+    const char* filename(size_t i) const { return names + nameOffsets[i]; }
+
+    // Returns the row index of the given image filename, or -1 if it is not in the index. A hash lookup once
+    // indexNames has been called, otherwise a scan of every name.
+    long find(const std::string& name) const;
+
+    // Builds the filename -> row map that find uses, for callers that look up many names. Call it before any
+    // concurrent find.
+    void indexNames();
+};
+
+// True if path names a binary feature store (by extension) rather than a CSV file
+bool isFeatureStorePath(const std::string& path);
+
+// Opens a feature index. Binary stores are memory-mapped in O(1); anything else is imported as CSV.
+// Quantized stores are decoded to floats unless decodeQuantized is false, for callers that score the codes directly.
+int openFeatureStore(const std::string& path, FeatureStore& store, bool decodeQuantized = true);
+
+// Parses "f32", "u8" or "u16"
+int parseFeatureDType(const std::string& name, FeatureDType& dtype);
+
+const char* featureDTypeName(uint32_t dtype);
+
+// Fixed-point scale of a quantized dtype (0 for f32)
+uint32_t featureDTypeScale(uint32_t dtype);
+
+// Quantizes a row of histogram values in [0, 1] to round(value * scale) codes (uint8_t or uint16_t, by dtype) whose sum
+// is exactly round(sum of values * scale): the rounding remainders are distributed to the largest fractions, so an
+// L1-normalized histogram always sums to the scale. Returns -1 if a value is outside [0, 1].
+int quantizeFeatureRow(const float* values, size_t n, FeatureDType dtype, void* codes);
+
+// Parses a CSV feature file (filename followed by feature values on each line) into store. The file is mapped and
+// large files are parsed in parallel, one chunk of lines per core.
+int importFeatureCSV(const std::string& path, FeatureStore& store);
+
+// Formats one CSV feature row, name followed by each value as "%.4f", ending in a newline, into line
+void formatFeatureCSVRow(const std::string& name, const float* values, size_t n, std::string& line);
+
+// Writes the contents of store as a CSV feature file in the format produced by readImages
+int exportFeatureCSV(const FeatureStore& store, const std::string& path);
+
+// Writes a complete binary feature store from in-memory rows
+int writeFeatureStore(const std::string& path, const std::string& featureType, const std::vector<std::string>& filenames,
+                      const std::vector<float>& data, size_t dim, FeatureDType dtype = FEATURE_DTYPE_F32, uint32_t decodeScale = 0);
+
+// Streams rows into either a CSV file or a binary store, chosen by the output path's extension.
+// The file is kept open for the whole run instead of being reopened for every image.
+struct FeatureIndexWriter {
+    FILE* fp = nullptr;
+    bool binary = false;
+    FeatureDType dtype = FEATURE_DTYPE_F32;
+    uint32_t decodeScale = 0;   // recorded in the header of binary stores; may be set any time before closing
+    std::string path;
+    std::string featureType;
+    size_t dim = 0;
+    size_t count = 0;
+    std::vector<uint64_t> nameOffsets;
+    std::string names;
+    std::string csvLine;   // reused buffer for formatting CSV rows
+};
+
+// With append set, rows are added to the end of an existing CSV file; binary stores are always rewritten.
+// Quantized dtypes are only available for binary stores.
+int openFeatureIndexWriter(const std::string& path, const std::string& featureType, FeatureIndexWriter& writer, bool append = false,
+                           FeatureDType dtype = FEATURE_DTYPE_F32);
+
+// Appends one image's feature vector; only the filename component of image_filename is recorded
+int appendFeatureIndexRow(FeatureIndexWriter& writer, const std::string& image_filename, const std::vector<float>& values);
+
+// Finishes the file (for binary stores this writes the name table and the final header)
+int closeFeatureIndexWriter(FeatureIndexWriter& writer);
+
+#endif
@@ -0,0 +1,343 @@
+// histogramCore.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Single-pass histogram engine over interleaved 8-bit BGR rows. Consecutive pixels count into separate
+//          sub-histograms so that runs of equal values do not serialize on one counter; the copies are merged once.
+//          Cell grids keep the counts as a summed-area table, so any rectangle of cells is four corner lookups.
+
+#include "histogramCore.h"
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// Independent copies of every histogram; pixel x of a row counts into copy x % SUB_HISTOGRAMS
+#define SUB_HISTOGRAMS 4
+
+// Largest B + G + R of an 8-bit pixel
+#define MAX_CHANNEL_SUM (3 * 255)
+
+// cvtColor's fixed-point BGR to gray weights for 8-bit images: 0.114, 0.587 and 0.299 in units of 2^-14
+#define GRAY_SHIFT 14
+#define GRAY_B 1868
+#define GRAY_G 9617
+#define GRAY_R 4899
+
+// Squared gradient magnitudes from here on are past the last magnitude bin. The float bin width rounds up, so
+// magnitudes a little over 256 still land in the last bin; the lookup table covers them.
+#define GRADIENT_M2_LIMIT (260 * 260)
+#define NO_BIN 0xFF
+
+// Rows of an image as one run of pixels when it is stored continuously
+template <typename Visit>
+static void forEachRun(const cv::Mat& image, Visit visit) {
+    if (image.isContinuous()) {
+        visit(image.ptr<uchar>(0), image.rows * image.cols);
+        return;
+    }
+    for (int y = 0; y < image.rows; y++) {
+        visit(image.ptr<uchar>(y), image.cols);
+    }
+}
+
+static void countValuesRun(const uchar* p, int pixels, uint32_t* sub) {
+    uint32_t* sub0 = sub;
+    uint32_t* sub1 = sub + 3 * HISTOGRAM_VALUES;
+    uint32_t* sub2 = sub + 6 * HISTOGRAM_VALUES;
+    uint32_t* sub3 = sub + 9 * HISTOGRAM_VALUES;
+    int x = 0;
+    for (; x + SUB_HISTOGRAMS <= pixels; x += SUB_HISTOGRAMS, p += 3 * SUB_HISTOGRAMS) {
+        sub0[p[0]]++;
+        sub0[HISTOGRAM_VALUES + p[1]]++;
+        sub0[2 * HISTOGRAM_VALUES + p[2]]++;
+        sub1[p[3]]++;
+        sub1[HISTOGRAM_VALUES + p[4]]++;
+        sub1[2 * HISTOGRAM_VALUES + p[5]]++;
+        sub2[p[6]]++;
+        sub2[HISTOGRAM_VALUES + p[7]]++;
+        sub2[2 * HISTOGRAM_VALUES + p[8]]++;
+        sub3[p[9]]++;
+        sub3[HISTOGRAM_VALUES + p[10]]++;
+        sub3[2 * HISTOGRAM_VALUES + p[11]]++;
+    }
+    for (; x < pixels; x++, p += 3) {
+        sub0[p[0]]++;
+        sub0[HISTOGRAM_VALUES + p[1]]++;
+        sub0[2 * HISTOGRAM_VALUES + p[2]]++;
+    }
+}
+
+void countChannelValues(const cv::Mat& bgr, uint32_t* counts) {
+    std::array<uint32_t, SUB_HISTOGRAMS * 3 * HISTOGRAM_VALUES> sub{};
+    forEachRun(bgr, [&](const uchar* p, int pixels) { countValuesRun(p, pixels, sub.data()); });
+    for (int s = 0; s < SUB_HISTOGRAMS; s++) {
+        for (int i = 0; i < 3 * HISTOGRAM_VALUES; i++) {
+            counts[i] += sub[s * 3 * HISTOGRAM_VALUES + i];
+        }
+    }
+}
+
+void makeBinLut(int bins, float rangeStart, float rangeEnd, int16_t lut[HISTOGRAM_VALUES]) {
+    float binWidth = (rangeEnd - rangeStart) / bins;
+    for (int v = 0; v < HISTOGRAM_VALUES; v++) {
+        uchar val = static_cast<uchar>(v);
+        int bin = static_cast<int>((val - rangeStart) / binWidth);
+        lut[v] = static_cast<int16_t>(bin >= 0 && bin < bins ? bin : -1);
+    }
+}
+
+void foldValueCounts(const uint32_t* valueCounts, const int16_t lut[HISTOGRAM_VALUES], int bins, uint32_t* binCounts) {
+    memset(binCounts, 0, bins * sizeof(uint32_t));
+    for (int v = 0; v < HISTOGRAM_VALUES; v++) {
+        if (lut[v] >= 0) {
+            binCounts[lut[v]] += valueCounts[v];
+        }
+    }
+}
+
+// Fixed-point reciprocals: (n * reciprocal[s]) >> 32 == n / s for every numerator the chromaticity bins produce
+static const std::array<uint64_t, MAX_CHANNEL_SUM + 1>& channelSumReciprocals() {
+    static const std::array<uint64_t, MAX_CHANNEL_SUM + 1> table = [] {
+        std::array<uint64_t, MAX_CHANNEL_SUM + 1> t{};
+        for (int s = 1; s <= MAX_CHANNEL_SUM; s++) {
+            t[s] = 0xFFFFFFFFull / s + 1;
+        }
+        return t;
+    }();
+    return table;
+}
+
+struct ChromaticityState {
+    const uint64_t* reciprocal;
+    uint32_t bins;
+    uint32_t* rSub;
+    uint32_t* gSub;
+};
+
+// bin = floor((bins * c - 1) / (B + G + R)) for c > 0, i.e. floor(bins * c / sum) moved down one bin on an exact edge
+static inline uint32_t chromaticityBin(uint32_t c, uint32_t bins, uint64_t reciprocal) {
+    uint64_t numerator = bins * c - (c != 0);
+    return static_cast<uint32_t>((numerator * reciprocal) >> 32);
+}
+
+static void countChromaticityRun(const uchar* p, int pixels, const ChromaticityState& s) {
+    const uint64_t* reciprocal = s.reciprocal;
+    const uint32_t bins = s.bins;
+    uint32_t* rSub = s.rSub;
+    uint32_t* gSub = s.gSub;
+    int x = 0;
+    for (; x + SUB_HISTOGRAMS <= pixels; x += SUB_HISTOGRAMS, p += 3 * SUB_HISTOGRAMS) {
+        for (int k = 0; k < SUB_HISTOGRAMS; k++) {
+            const uchar* px = p + 3 * k;
+            uint64_t rec = reciprocal[px[0] + px[1] + px[2]];
+            rSub[k * bins + chromaticityBin(px[2], bins, rec)]++;
+            gSub[k * bins + chromaticityBin(px[1], bins, rec)]++;
+        }
+    }
+    for (; x < pixels; x++, p += 3) {
+        uint64_t rec = reciprocal[p[0] + p[1] + p[2]];
+        rSub[chromaticityBin(p[2], bins, rec)]++;
+        gSub[chromaticityBin(p[1], bins, rec)]++;
+    }
+}
+
+void countChromaticity(const cv::Mat& bgr, int bins, uint32_t* rCounts, uint32_t* gCounts) {
+    std::vector<uint32_t> rSub(SUB_HISTOGRAMS * bins, 0), gSub(SUB_HISTOGRAMS * bins, 0);
+    ChromaticityState state{channelSumReciprocals().data(), static_cast<uint32_t>(bins), rSub.data(), gSub.data()};
+    forEachRun(bgr, [&](const uchar* p, int pixels) { countChromaticityRun(p, pixels, state); });
+    for (int b = 0; b < bins; b++) {
+        rCounts[b] = 0;
+        gCounts[b] = 0;
+        for (int s = 0; s < SUB_HISTOGRAMS; s++) {
+            rCounts[b] += rSub[s * bins + b];
+            gCounts[b] += gSub[s * bins + b];
+        }
+    }
+}
+
+// Magnitude bin of every squared magnitude below GRADIENT_M2_LIMIT, with the float steps of cartToPolar and
+// customCalcHist, or NO_BIN. Built once per thread and bin count.
+static const uint8_t* magnitudeBinLut(int bins) {
+    thread_local std::vector<uint8_t> lut;
+    thread_local int lutBins = 0;
+    if (lutBins != bins) {
+        float binWidth = 256.0f / bins;
+        lut.resize(GRADIENT_M2_LIMIT);
+        for (int m2 = 0; m2 < GRADIENT_M2_LIMIT; m2++) {
+            int bin = static_cast<int>(std::sqrt(static_cast<float>(m2)) / binWidth);
+            lut[m2] = static_cast<uint8_t>(bin < bins ? bin : NO_BIN);
+        }
+        lutBins = bins;
+    }
+    return lut.data();
+}
+
+// Orientation in degrees of the gradient (gx, gy), computed as cv::fastAtan2: the angle is approximated in the octant
+// where the smaller component over the larger is in [0, 1] and then reflected into place
+static inline float gradientAngle(int gx, int gy) {
+    static const float p1 = 0.9997878412794807f * static_cast<float>(180 / CV_PI);
+    static const float p3 = -0.3258083974640975f * static_cast<float>(180 / CV_PI);
+    static const float p5 = 0.1555786518463281f * static_cast<float>(180 / CV_PI);
+    static const float p7 = -0.04432655554792128f * static_cast<float>(180 / CV_PI);
+    float ax = static_cast<float>(std::abs(gx)), ay = static_cast<float>(std::abs(gy));
+    float a;
+    if (ax >= ay) {
+        float c = ay / (ax + static_cast<float>(DBL_EPSILON)), c2 = c * c;
+        a = (((p7 * c2 + p5) * c2 + p3) * c2 + p1) * c;
+    } else {
+        float c = ax / (ay + static_cast<float>(DBL_EPSILON)), c2 = c * c;
+        a = 90.f - (((p7 * c2 + p5) * c2 + p3) * c2 + p1) * c;
+    }
+    if (gx < 0) {
+        a = 180.f - a;
+    }
+    if (gy < 0) {
+        a = 360.f - a;
+    }
+    return a;
+}
+
+// Border index of cv::BORDER_REFLECT_101, Sobel's default
+static inline int reflect101(int i, int n) {
+    if (n == 1) {
+        return 0;
+    }
+    return i < 0 ? -i : (i >= n ? 2 * n - 2 - i : i);
+}
+
+// Gray values of row y, with one reflected column on each side
+static void grayRow(const cv::Mat& bgr, int y, int16_t* out) {
+    const uchar* p = bgr.ptr<uchar>(y);
+    for (int x = 0; x < bgr.cols; x++, p += 3) {
+        out[x + 1] = static_cast<int16_t>((p[0] * GRAY_B + p[1] * GRAY_G + p[2] * GRAY_R + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+    }
+    out[0] = out[reflect101(-1, bgr.cols) + 1];
+    out[bgr.cols + 1] = out[reflect101(bgr.cols, bgr.cols) + 1];
+}
+
+void countGradientBins(const cv::Mat& bgr, int magBins, int angleBins, uint32_t* magCounts, uint32_t* angleCounts) {
+    memset(magCounts, 0, magBins * sizeof(uint32_t));
+    memset(angleCounts, 0, angleBins * sizeof(uint32_t));
+    const int rows = bgr.rows, cols = bgr.cols;
+    if (rows == 0 || cols == 0) {
+        return;
+    }
+    const uint8_t* magLut = magnitudeBinLut(magBins);
+    const float angleBinWidth = 360.0f / angleBins;
+
+    // Three rolling gray rows, and per column the vertical [1 2 1] smoothing (for gx) and [-1 0 1] difference (for gy)
+    const int width = cols + 2;
+    std::vector<int16_t> gray(3 * width), smooth(width), diff(width);
+    int16_t* above = gray.data();
+    int16_t* center = above + width;
+    int16_t* below = center + width;
+    grayRow(bgr, reflect101(-1, rows), above);
+    grayRow(bgr, 0, center);
+    grayRow(bgr, reflect101(1, rows), below);
+
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < width; x++) {
+            smooth[x] = static_cast<int16_t>(above[x] + 2 * center[x] + below[x]);
+            diff[x] = static_cast<int16_t>(below[x] - above[x]);
+        }
+        for (int x = 0; x < cols; x++) {
+            int gx = smooth[x + 2] - smooth[x];
+            int gy = diff[x] + 2 * diff[x + 1] + diff[x + 2];
+            int m2 = gx * gx + gy * gy;
+            if (m2 < GRADIENT_M2_LIMIT && magLut[m2] != NO_BIN) {
+                magCounts[magLut[m2]]++;
+            }
+            int bin = static_cast<int>(gradientAngle(gx, gy) / angleBinWidth);
+            if (bin < angleBins) {
+                angleCounts[bin]++;
+            }
+        }
+
+        if (y + 1 < rows) {
+            int16_t* recycled = above;
+            above = center;
+            center = below;
+            below = recycled;
+            grayRow(bgr, reflect101(y + 2, rows), below);
+        }
+    }
+}
+
+std::vector<int> uniformEdges(int length, int cells) {
+    std::vector<int> edges(cells + 1);
+    for (int i = 0; i <= cells; i++) {
+        edges[i] = static_cast<int>(static_cast<int64_t>(length) * i / cells);
+    }
+    return edges;
+}
+
+void buildCellHistogramGrid(const cv::Mat& bgr, const std::vector<int>& rowEdges, const std::vector<int>& colEdges,
+                            CellHistogramGrid& grid) {
+    const int cellValues = 3 * HISTOGRAM_VALUES;
+    grid.rowEdges = rowEdges;
+    grid.colEdges = colEdges;
+    const int gridRows = grid.gridRows(), gridCols = grid.gridCols();
+    const size_t corners = static_cast<size_t>(gridCols + 1);
+    grid.table.assign(static_cast<size_t>(gridRows + 1) * corners * cellValues, 0);
+
+    std::vector<uint32_t> cell(cellValues);
+    for (int i = 0; i < gridRows; i++) {
+        for (int j = 0; j < gridCols; j++) {
+            std::fill(cell.begin(), cell.end(), 0);
+            if (rowEdges[i + 1] > rowEdges[i] && colEdges[j + 1] > colEdges[j]) {
+                countChannelValues(bgr(cv::Range(rowEdges[i], rowEdges[i + 1]), cv::Range(colEdges[j], colEdges[j + 1])), cell.data());
+            }
+
+            // corner (i + 1, j + 1) = cell + corner (i, j + 1) + corner (i + 1, j) - corner (i, j)
+            uint32_t* out = grid.table.data() + ((i + 1) * corners + j + 1) * cellValues;
+            const uint32_t* up = grid.table.data() + (i * corners + j + 1) * cellValues;
+            const uint32_t* left = grid.table.data() + ((i + 1) * corners + j) * cellValues;
+            const uint32_t* diagonal = grid.table.data() + (i * corners + j) * cellValues;
+            for (int v = 0; v < cellValues; v++) {
+                out[v] = cell[v] + up[v] + left[v] - diagonal[v];
+            }
+        }
+    }
+}
+
+size_t regionValueCounts(const CellHistogramGrid& grid, const CellRegion& region, uint32_t* counts) {
+    const int cellValues = 3 * HISTOGRAM_VALUES;
+    const size_t corners = static_cast<size_t>(grid.gridCols() + 1);
+    auto corner = [&](int i, int j) { return grid.table.data() + (i * corners + j) * cellValues; };
+    const uint32_t* a = corner(region.row0, region.col0);
+    const uint32_t* b = corner(region.row0, region.col1);
+    const uint32_t* c = corner(region.row1, region.col0);
+    const uint32_t* d = corner(region.row1, region.col1);
+    for (int v = 0; v < cellValues; v++) {
+        counts[v] = d[v] - b[v] - c[v] + a[v];   // unsigned wrap-around cancels out
+    }
+    size_t pixels = static_cast<size_t>(grid.rowEdges[region.row1] - grid.rowEdges[region.row0]) *
+                    static_cast<size_t>(grid.colEdges[region.col1] - grid.colEdges[region.col0]);
+    if (!region.surround) {
+        return pixels;
+    }
+
+    const uint32_t* whole = corner(grid.gridRows(), grid.gridCols());
+    for (int v = 0; v < cellValues; v++) {
+        counts[v] = whole[v] - counts[v];
+    }
+    return static_cast<size_t>(grid.rowEdges.back()) * static_cast<size_t>(grid.colEdges.back()) - pixels;
+}
+
+void appendNormalizedCounts(const uint32_t* counts, int bins, size_t total, std::vector<float>& features) {
+    size_t start = features.size();
+    float sum = 0.0f;
+    for (int b = 0; b < bins; b++) {
+        float val = static_cast<float>(counts[b]);
+        val /= total;
+        features.push_back(val);
+        sum += val;
+    }
+
+    if (sum > 0) {
+        for (size_t i = start; i < features.size(); i++) {
+            features[i] /= sum;
+        }
+    }
+}
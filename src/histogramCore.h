@@ -0,0 +1,73 @@
+// histogramCore.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for histogramCore.cpp, the single-pass histogram engine behind the colour and texture histogram
+//          extractors. It reads interleaved 8-bit BGR rows directly, maps values to bins through lookup tables and
+//          counts into several sub-histograms, so no float copy, channel split or per-pixel divide is needed.
+
+#ifndef HISTOGRAM_CORE_H
+#define HISTOGRAM_CORE_H
+
+#include "opencv2/opencv.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define HISTOGRAM_VALUES 256
+
+// Adds the raw value counts of the three channels of a CV_8UC3 image to counts, laid out as
+// counts[channel * HISTOGRAM_VALUES + value] in B, G, R order
+void countChannelValues(const cv::Mat& bgr, uint32_t* counts);
+
+// Bin of every 8-bit value for `bins` equal-width bins over [rangeStart, rangeEnd), or -1 for values outside the
+// range. The bin is computed with the same float arithmetic customCalcHist uses per pixel.
+void makeBinLut(int bins, float rangeStart, float rangeEnd, int16_t lut[HISTOGRAM_VALUES]);
+
+// Folds the raw value counts of one channel into binCounts (bins entries, cleared first) through a bin lookup table
+void foldValueCounts(const uint32_t* valueCounts, const int16_t lut[HISTOGRAM_VALUES], int bins, uint32_t* binCounts);
+
+// r = R / (B + G + R) and g = G / (B + G + R) chromaticity histograms of a CV_8UC3 image, bins entries each. A ratio
+// landing exactly on a bin edge goes to the lower bin and a black pixel to bin 0, as the 1e-6 guard of the float
+// formula makes it.
+void countChromaticity(const cv::Mat& bgr, int bins, uint32_t* rCounts, uint32_t* gCounts);
+
+// Gradient magnitude and orientation histograms of a CV_8UC3 image, computed as extractTextureFeatures' float path
+// does (cvtColor to gray, 3x3 Sobel with reflected borders, cartToPolar in degrees) but fused into one pass over the
+// rows: gray and the Sobel sums are kept in three rolling 16-bit rows, magnitudes are binned from the integer squared
+// magnitude through a lookup table, and orientations with the octant reduction and polynomial of cv::fastAtan2.
+// magCounts gets magBins (< 255) bins over [0, 256) and angleCounts angleBins bins over [0, 360).
+void countGradientBins(const cv::Mat& bgr, int magBins, int angleBins, uint32_t* magCounts, uint32_t* angleCounts);
+
+// Raw channel value counts of an 8-bit BGR image over a grid of cells, kept as a summed-area table over the cells, so
+// the counts of any rectangle of cells come from four table entries instead of another pass over its pixels
+struct CellHistogramGrid {
+    std::vector<int> rowEdges;     // gridRows + 1 pixel rows; cell row i covers rows [rowEdges[i], rowEdges[i + 1])
+    std::vector<int> colEdges;     // gridCols + 1 pixel columns
+    std::vector<uint32_t> table;   // (gridRows + 1) x (gridCols + 1) corners of 3 * HISTOGRAM_VALUES counts each
+
+    int gridRows() const { return static_cast<int>(rowEdges.size()) - 1; }
+    int gridCols() const { return static_cast<int>(colEdges.size()) - 1; }
+};
+
+// The cells [row0, row1) x [col0, col1) of a grid or, with surround set, every cell outside them
+struct CellRegion {
+    int row0, col0, row1, col1;
+    bool surround;
+};
+
+// length split into `cells` near-equal spans: edge i is length * i / cells
+std::vector<int> uniformEdges(int length, int cells);
+
+// Counts every cell of a CV_8UC3 image once and builds the summed-area table. The edges must start at 0, end at the
+// image size and not decrease.
+void buildCellHistogramGrid(const cv::Mat& bgr, const std::vector<int>& rowEdges, const std::vector<int>& colEdges,
+                            CellHistogramGrid& grid);
+
+// Writes the 3 * HISTOGRAM_VALUES raw channel value counts of region to counts and returns its number of pixels
+size_t regionValueCounts(const CellHistogramGrid& grid, const CellRegion& region, uint32_t* counts);
+
+// Appends counts / total normalized to sum to 1, with the float steps of customCalcHist followed by customNormalizeL1,
+// so the features are bit-identical to the per-pixel float path
+void appendNormalizedCounts(const uint32_t* counts, int bins, size_t total, std::vector<float>& features);
+
+#endif
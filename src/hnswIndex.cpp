@@ -0,0 +1,485 @@
+// hnswIndex.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Building, saving, mapping and searching HNSW graphs over feature indexes (Malkov & Yashunin, 2016).
+//
+// Every row gets a random top level with P(level >= l) = M^-l. Insertion descends greedily from the entry point to
+// the new node's level, then on each level down to 0 collects efConstruction candidates and links the node to up to
+// M of them chosen with the neighbour-diversity heuristic; neighbours whose lists overflow are re-pruned with the
+// same heuristic. Levels are drawn up front so all link storage can be allocated before the threads start, and
+// concurrent inserts only take the lock of the one node whose list they read or change.
+
+#include "hnswIndex.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include "distanceKernels.h"
+#include "trace.h"
+
+#define HNSW_ALIGNMENT 64
+#define HNSW_MAX_LEVEL 16
+
+struct HnswCandidate {
+    float distance;
+    uint32_t id;
+};
+
+struct CloserFirst {
+    bool operator()(const HnswCandidate& a, const HnswCandidate& b) const { return a.distance > b.distance; }
+};
+
+struct FartherFirst {
+    bool operator()(const HnswCandidate& a, const HnswCandidate& b) const { return a.distance < b.distance; }
+};
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Marks nodes visited during one search without clearing an array per search: a node is visited when its tag
+// equals the current epoch. One list per thread is reused across searches.
+class VisitedList {
+public:
+    void reset(size_t count) {
+        if (tags_.size() != count || epoch_ == UINT32_MAX) {
+            tags_.assign(count, 0);
+            epoch_ = 0;
+        }
+        epoch_++;
+    }
+    bool visit(uint32_t node) {
+        if (tags_[node] == epoch_) {
+            return false;
+        }
+        tags_[node] = epoch_;
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> tags_;
+    uint32_t epoch_ = 0;
+};
+
+// Shared by building and searching; node locks are only passed (non-null) while the graph is being built
+class HnswSearcher {
+public:
+    HnswSearcher(const HnswIndex& index, const FeatureStore& store, std::vector<std::mutex>* locks)
+        : index_(index), store_(store), locks_(locks) {}
+
+    float distance(const float* query, float queryNorm, uint32_t node) const {
+        return cosineDistance(query, queryNorm, store_.row(node), index_.norms[node], store_.dim);
+    }
+
+    // Copies the neighbour list of node on level into out
+    void neighbours(uint32_t node, uint32_t level, std::vector<uint32_t>& out) const {
+        std::unique_lock<std::mutex> lock;
+        if (locks_) {
+            lock = std::unique_lock<std::mutex>((*locks_)[node]);
+        }
+        const uint32_t* list = index_.links(node, level);
+        out.assign(list + 1, list + 1 + list[0]);
+    }
+
+    // Greedy walk on one level: moves to the closest neighbour until none is closer
+    uint32_t greedyClosest(const float* query, float queryNorm, uint32_t entry, uint32_t level) {
+        uint32_t current = entry;
+        float currentDistance = distance(query, queryNorm, current);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            neighbours(current, level, buffer_);
+            for (uint32_t next : buffer_) {
+                float d = distance(query, queryNorm, next);
+                if (d < currentDistance) {
+                    currentDistance = d;
+                    current = next;
+                    changed = true;
+                }
+            }
+        }
+        return current;
+    }
+
+    // Beam search on one level from the given entry points; returns up to ef nodes, closest first
+    std::vector<HnswCandidate> searchLevel(const float* query, float queryNorm, const std::vector<uint32_t>& entries, size_t ef,
+                                           uint32_t level) {
+        static thread_local VisitedList visited;
+        visited.reset(index_.count);
+
+        std::priority_queue<HnswCandidate, std::vector<HnswCandidate>, CloserFirst> candidates;
+        std::priority_queue<HnswCandidate, std::vector<HnswCandidate>, FartherFirst> nearest;
+        for (uint32_t entry : entries) {
+            if (visited.visit(entry)) {
+                HnswCandidate c = {distance(query, queryNorm, entry), entry};
+                candidates.push(c);
+                nearest.push(c);
+            }
+        }
+        while (nearest.size() > ef) {
+            nearest.pop();
+        }
+
+        while (!candidates.empty()) {
+            HnswCandidate closest = candidates.top();
+            if (nearest.size() >= ef && closest.distance > nearest.top().distance) {
+                break;
+            }
+            candidates.pop();
+            neighbours(closest.id, level, buffer_);
+            for (uint32_t next : buffer_) {
+                if (!visited.visit(next)) {
+                    continue;
+                }
+                float d = distance(query, queryNorm, next);
+                if (nearest.size() < ef || d < nearest.top().distance) {
+                    candidates.push({d, next});
+                    nearest.push({d, next});
+                    if (nearest.size() > ef) {
+                        nearest.pop();
+                    }
+                }
+            }
+        }
+
+        std::vector<HnswCandidate> result(nearest.size());
+        for (size_t i = result.size(); i-- > 0;) {
+            result[i] = nearest.top();
+            nearest.pop();
+        }
+        return result;
+    }
+
+    // Neighbour-diversity heuristic: walking the candidates closest first, keep one only if it is closer to the base
+    // node than to every neighbour kept so far. Candidates must be sorted closest first.
+    std::vector<uint32_t> selectNeighbours(const std::vector<HnswCandidate>& candidates, size_t maxCount) const {
+        std::vector<uint32_t> selected;
+        for (const HnswCandidate& c : candidates) {
+            if (selected.size() >= maxCount) {
+                break;
+            }
+            bool keep = true;
+            const float* row = store_.row(c.id);
+            for (uint32_t s : selected) {
+                if (distance(row, index_.norms[c.id], s) < c.distance) {
+                    keep = false;
+                    break;
+                }
+            }
+            if (keep) {
+                selected.push_back(c.id);
+            }
+        }
+        return selected;
+    }
+
+private:
+    const HnswIndex& index_;
+    const FeatureStore& store_;
+    std::vector<std::mutex>* locks_;
+    std::vector<uint32_t> buffer_;
+};
+
+std::string hnswPathFor(const std::string& featureIndexPath) {
+    return featureIndexPath + HNSW_EXTENSION;
+}
+
+// Inserts node into a graph that already contains at least the entry point
+static void insertNode(HnswIndex& index, const FeatureStore& store, HnswSearcher& searcher, std::vector<std::mutex>& locks,
+                       std::mutex& entryLock, uint32_t node) {
+    const float* query = store.row(node);
+    float queryNorm = index.norms[node];
+    uint32_t level = index.levelOf(node);
+
+    // An insert that raises the top level holds the entry lock throughout, so the entry point stays consistent
+    std::unique_lock<std::mutex> entryGuard(entryLock);
+    uint32_t maxLevel = index.maxLevel;
+    uint32_t entry = index.entryPoint;
+    if (level <= maxLevel) {
+        entryGuard.unlock();
+    }
+
+    for (uint32_t l = maxLevel; l > level; --l) {
+        entry = searcher.greedyClosest(query, queryNorm, entry, l);
+    }
+
+    std::vector<uint32_t> entries(1, entry);
+    for (uint32_t l = std::min(level, maxLevel) + 1; l-- > 0;) {
+        std::vector<HnswCandidate> candidates = searcher.searchLevel(query, queryNorm, entries, index.efConstruction, l);
+        std::vector<uint32_t> selected = searcher.selectNeighbours(candidates, index.M);
+        size_t capacity = l == 0 ? 2 * index.M : index.M;
+
+        {
+            std::lock_guard<std::mutex> lock(locks[node]);
+            uint32_t* list = const_cast<uint32_t*>(index.links(node, l));
+            list[0] = static_cast<uint32_t>(selected.size());
+            std::copy(selected.begin(), selected.end(), list + 1);
+        }
+
+        // Link back from each neighbour, re-pruning its list if it is full
+        for (uint32_t neighbour : selected) {
+            std::lock_guard<std::mutex> lock(locks[neighbour]);
+            uint32_t* list = const_cast<uint32_t*>(index.links(neighbour, l));
+            if (list[0] < capacity) {
+                list[1 + list[0]] = node;
+                list[0]++;
+                continue;
+            }
+            const float* base = store.row(neighbour);
+            float baseNorm = index.norms[neighbour];
+            std::vector<HnswCandidate> pool;
+            pool.push_back({searcher.distance(base, baseNorm, node), node});
+            for (uint32_t i = 1; i <= list[0]; ++i) {
+                pool.push_back({searcher.distance(base, baseNorm, list[i]), list[i]});
+            }
+            std::sort(pool.begin(), pool.end(), [](const HnswCandidate& a, const HnswCandidate& b) { return a.distance < b.distance; });
+            std::vector<uint32_t> kept = searcher.selectNeighbours(pool, capacity);
+            list[0] = static_cast<uint32_t>(kept.size());
+            std::copy(kept.begin(), kept.end(), list + 1);
+        }
+
+        entries.clear();
+        for (const HnswCandidate& c : candidates) {
+            entries.push_back(c.id);
+        }
+    }
+
+    if (level > maxLevel) {
+        index.maxLevel = level;
+        index.entryPoint = node;
+    }
+}
+
+int buildHnswIndex(const FeatureStore& store, const HnswBuildParams& params, HnswIndex& index) {
+    if (params.M < 2 || params.efConstruction < 1) {
+        printf("HNSW needs M >= 2 and efConstruction >= 1\n");
+        return -1;
+    }
+    if (store.count == 0 || store.count > UINT32_MAX) {
+        printf("Cannot build an HNSW graph over %zu rows\n", store.count);
+        return -1;
+    }
+
+    index.M = params.M;
+    index.efConstruction = std::max(params.efConstruction, params.M);
+    index.count = store.count;
+    index.dim = store.dim;
+    computeRowNorms(store.data, store.count, store.dim, index.ownedNorms);
+
+    // Draw every node's level first so that the link storage never moves once insertion starts
+    std::mt19937 rng(params.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double levelScale = 1.0 / std::log(static_cast<double>(params.M));
+    index.ownedUpperOffsets.assign(store.count + 1, 0);
+    for (size_t i = 0; i < store.count; ++i) {
+        double level = std::floor(-std::log(1.0 - uniform(rng)) * levelScale);
+        index.ownedUpperOffsets[i + 1] = index.ownedUpperOffsets[i] + std::min<uint64_t>(static_cast<uint64_t>(level), HNSW_MAX_LEVEL) * (1 + params.M);
+    }
+    index.ownedLevel0.assign(store.count * (1 + 2 * params.M), 0);
+    index.ownedUpper.assign(index.ownedUpperOffsets.back(), 0);
+
+    index.norms = index.ownedNorms.data();
+    index.level0 = index.ownedLevel0.data();
+    index.upperOffsets = index.ownedUpperOffsets.data();
+    index.upper = index.ownedUpper.data();
+    index.entryPoint = 0;
+    index.maxLevel = index.levelOf(0);
+
+    std::vector<std::mutex> locks(store.count);
+    std::mutex entryLock;
+    std::atomic<size_t> next{1};
+    std::atomic<size_t> done{0};
+    auto worker = [&]() {
+        HnswSearcher searcher(index, store, &locks);
+        size_t node;
+        while ((node = next++) < store.count) {
+            insertNode(index, store, searcher, locks, entryLock, static_cast<uint32_t>(node));
+            size_t inserted = ++done;
+            if (inserted % 100000 == 0) {
+                printf("Inserted %zu of %zu\n", inserted, store.count);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < params.threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return 0;
+}
+
+static bool writeBlock(FILE* fp, uint64_t& position, uint64_t offset, const void* data, size_t bytes) {
+    static const char zeros[HNSW_ALIGNMENT] = {0};
+    if (offset < position || fwrite(zeros, 1, static_cast<size_t>(offset - position), fp) != offset - position) {
+        return false;
+    }
+    position = offset + bytes;
+    return bytes == 0 || fwrite(data, 1, bytes, fp) == bytes;
+}
+
+int writeHnswIndex(const std::string& path, const HnswIndex& index) {
+    HnswHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HNSW_MAGIC, sizeof(header.magic));
+    header.version = HNSW_VERSION;
+    header.M = static_cast<uint32_t>(index.M);
+    header.efConstruction = static_cast<uint32_t>(index.efConstruction);
+    header.maxLevel = index.maxLevel;
+    header.entryPoint = index.entryPoint;
+    header.count = index.count;
+    header.dim = index.dim;
+
+    uint64_t normsBytes = index.count * sizeof(float);
+    uint64_t level0Bytes = index.count * (1 + 2 * index.M) * sizeof(uint32_t);
+    uint64_t offsetsBytes = (index.count + 1) * sizeof(uint64_t);
+    uint64_t upperBytes = index.upperOffsets[index.count] * sizeof(uint32_t);
+    header.normsOffset = alignUp(sizeof(HnswHeader), HNSW_ALIGNMENT);
+    header.level0Offset = alignUp(header.normsOffset + normsBytes, HNSW_ALIGNMENT);
+    header.upperOffsetsOffset = alignUp(header.level0Offset + level0Bytes, HNSW_ALIGNMENT);
+    header.upperOffset = alignUp(header.upperOffsetsOffset + offsetsBytes, HNSW_ALIGNMENT);
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        printf("Unable to open output file %s\n", path.c_str());
+        return -1;
+    }
+    uint64_t position = 0;
+    bool ok = writeBlock(fp, position, 0, &header, sizeof(header)) &&
+              writeBlock(fp, position, header.normsOffset, index.norms, normsBytes) &&
+              writeBlock(fp, position, header.level0Offset, index.level0, level0Bytes) &&
+              writeBlock(fp, position, header.upperOffsetsOffset, index.upperOffsets, offsetsBytes) &&
+              writeBlock(fp, position, header.upperOffset, index.upper, upperBytes);
+    if (fclose(fp) != 0 || !ok) {
+        printf("Error writing HNSW graph %s\n", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// Checks the links of a mapped graph: each node's upper lists start where the previous node's end and fill whole
+// lists, no node reaches above maxLevel and the entry point reaches it, and every list holds at most its capacity of
+// neighbours, all of them rows of the index. upperCapacity is how many uint32 fit after upperOffset.
+static int validHnswLinks(const HnswHeader& header, const uint32_t* level0, const uint64_t* upperOffsets, const uint32_t* upper,
+                          uint64_t upperCapacity) {
+    const uint64_t level0List = 1 + 2 * static_cast<uint64_t>(header.M), upperList = 1 + static_cast<uint64_t>(header.M);
+    if (upperOffsets[0] != 0 || upperOffsets[header.count] > upperCapacity) {
+        return -1;
+    }
+    for (uint64_t node = 0; node < header.count; ++node) {
+        uint64_t upperValues = upperOffsets[node + 1] - upperOffsets[node];
+        if (upperOffsets[node + 1] < upperOffsets[node] || upperValues % upperList != 0 || upperValues / upperList > header.maxLevel) {
+            return -1;
+        }
+        if (node == header.entryPoint && upperValues / upperList != header.maxLevel) {
+            return -1;
+        }
+        for (uint64_t list = 0; list <= upperValues / upperList; ++list) {
+            const uint32_t* links = list == 0 ? level0 + node * level0List : upper + upperOffsets[node] + (list - 1) * upperList;
+            if (links[0] > (list == 0 ? 2 * header.M : header.M)) {
+                return -1;
+            }
+            for (uint32_t i = 1; i <= links[0]; ++i) {
+                if (links[i] >= header.count) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int openHnswIndex(const std::string& path, const FeatureStore& store, HnswIndex& index) {
+    if (mapFile(path, index.file) != 0) {
+        printf("Unable to map HNSW graph %s\n", path.c_str());
+        return -1;
+    }
+    HnswHeader header;
+    if (index.file.size < sizeof(header)) {
+        printf("HNSW graph %s is truncated\n", path.c_str());
+        return -1;
+    }
+    memcpy(&header, index.file.data, sizeof(header));
+    if (memcmp(header.magic, HNSW_MAGIC, sizeof(header.magic)) != 0 || header.version != HNSW_VERSION) {
+        printf("HNSW graph %s has an unsupported format\n", path.c_str());
+        return -1;
+    }
+    if (header.count != store.count || header.dim != store.dim) {
+        printf("HNSW graph %s was built for %llu rows of %llu values, the feature index has %zu of %zu\n", path.c_str(),
+               static_cast<unsigned long long>(header.count), static_cast<unsigned long long>(header.dim), store.count, store.dim);
+        return -1;
+    }
+
+    // Sizes are checked against the file before they are multiplied or added, so a corrupt header cannot overflow them
+    const uint64_t fileSize = index.file.size;
+    if (header.M < 2 || header.M > fileSize || header.count > fileSize / sizeof(uint64_t) || header.entryPoint >= header.count ||
+        header.normsOffset % HNSW_ALIGNMENT != 0 || header.level0Offset % HNSW_ALIGNMENT != 0 ||
+        header.upperOffsetsOffset % HNSW_ALIGNMENT != 0 || header.upperOffset % HNSW_ALIGNMENT != 0 ||
+        header.normsOffset > fileSize || header.level0Offset > fileSize || header.upperOffsetsOffset > fileSize ||
+        header.upperOffset > fileSize) {
+        printf("HNSW graph %s is corrupt\n", path.c_str());
+        return -1;
+    }
+    const uint64_t level0List = 1 + 2 * static_cast<uint64_t>(header.M);
+    if (header.count * sizeof(float) > fileSize - header.normsOffset ||
+        header.count > (fileSize - header.level0Offset) / sizeof(uint32_t) / level0List ||
+        (header.count + 1) * sizeof(uint64_t) > fileSize - header.upperOffsetsOffset) {
+        printf("HNSW graph %s is corrupt\n", path.c_str());
+        return -1;
+    }
+    const uint64_t* upperOffsets = reinterpret_cast<const uint64_t*>(index.file.data + header.upperOffsetsOffset);
+    const uint32_t* level0 = reinterpret_cast<const uint32_t*>(index.file.data + header.level0Offset);
+    const uint32_t* upper = reinterpret_cast<const uint32_t*>(index.file.data + header.upperOffset);
+    if (validHnswLinks(header, level0, upperOffsets, upper, (fileSize - header.upperOffset) / sizeof(uint32_t)) != 0) {
+        printf("HNSW graph %s is corrupt\n", path.c_str());
+        return -1;
+    }
+
+    index.M = header.M;
+    index.efConstruction = header.efConstruction;
+    index.count = static_cast<size_t>(header.count);
+    index.dim = static_cast<size_t>(header.dim);
+    index.maxLevel = header.maxLevel;
+    index.entryPoint = header.entryPoint;
+    index.norms = reinterpret_cast<const float*>(index.file.data + header.normsOffset);
+    index.level0 = level0;
+    index.upperOffsets = upperOffsets;
+    index.upper = upper;
+    return 0;
+}
+
+std::vector<ScoredId> searchHnswIndex(const HnswIndex& index, const FeatureStore& store, const float* query, size_t k,
+                                      size_t efSearch, uint32_t excludeId) {
+    TRACE_SCOPE("hnsw search");
+    std::vector<ScoredId> results;
+    if (index.count == 0 || k == 0) {
+        return results;
+    }
+
+    HnswSearcher searcher(index, store, nullptr);
+    float queryNorm = l2Norm(query, store.dim);
+    uint32_t entry = index.entryPoint;
+    for (uint32_t l = index.maxLevel; l > 0; --l) {
+        entry = searcher.greedyClosest(query, queryNorm, entry, l);
+    }
+
+    size_t wanted = k + (excludeId != TopKSelector::NO_EXCLUDE ? 1 : 0);
+    std::vector<HnswCandidate> nearest = searcher.searchLevel(query, queryNorm, std::vector<uint32_t>(1, entry), std::max(efSearch, wanted), 0);
+    for (const HnswCandidate& c : nearest) {
+        if (results.size() >= k) {
+            break;
+        }
+        if (c.id != excludeId) {
+            results.push_back({c.distance, c.id});
+        }
+    }
+    return results;
+}
@@ -0,0 +1,100 @@
+// hnswIndex.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for hnswIndex.cpp, a hierarchical navigable small world (HNSW) graph over the rows of a
+//          feature index for approximate cosine nearest-neighbour search. The graph is built offline by buildHnsw,
+//          saved next to the feature index and memory-mapped at query time; the vectors themselves stay in the
+//          feature index, so the graph file holds only the links and the row norms.
+
+#ifndef HNSW_INDEX_H
+#define HNSW_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "featureStore.h"
+#include "mappedFile.h"
+#include "topK.h"
+
+// Graph file layout (native little-endian, offsets from the start of the file):
+//   HnswHeader
+//   norms at normsOffset: count floats, the L2 norm of every feature row
+//   level 0 links at level0Offset: count fixed-size lists of (1 + 2M) uint32, a neighbour count then the neighbours
+//   upper level offsets at upperOffsetsOffset: (count + 1) uint64, the start of each node's upper lists in uint32 units
+//   upper level links at upperOffset: for each node, one list of (1 + M) uint32 per level above 0
+#define HNSW_MAGIC "CVHNSW01"
+#define HNSW_VERSION 1
+#define HNSW_EXTENSION ".hnsw"
+
+struct HnswHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t M;
+    uint32_t efConstruction;
+    uint32_t maxLevel;
+    uint32_t entryPoint;
+    uint32_t reserved0;
+    uint64_t count;
+    uint64_t dim;
+    uint64_t normsOffset;
+    uint64_t level0Offset;
+    uint64_t upperOffsetsOffset;
+    uint64_t upperOffset;
+    uint32_t reserved[8];
+};
+
+struct HnswBuildParams {
+    size_t M = 16;                 // links per node on the upper levels; level 0 keeps up to 2M
+    size_t efConstruction = 200;   // candidate list size while inserting; larger builds slower but gives better recall
+    uint32_t seed = 42;            // seeds the level draw; the whole graph is reproducible only with threads == 1,
+                                   // since parallel inserts link nodes in whatever order the threads reach them
+    int threads = 1;
+};
+
+// A built or mapped graph. The accessors work the same for both; the owned vectors are only used while building.
+struct HnswIndex {
+    size_t M = 0;
+    size_t efConstruction = 0;
+    size_t count = 0;
+    size_t dim = 0;
+    uint32_t maxLevel = 0;
+    uint32_t entryPoint = 0;
+
+    const float* norms = nullptr;
+    const uint32_t* level0 = nullptr;
+    const uint64_t* upperOffsets = nullptr;
+    const uint32_t* upper = nullptr;
+
+    MappedFile file;
+    std::vector<float> ownedNorms;
+    std::vector<uint32_t> ownedLevel0;
+    std::vector<uint64_t> ownedUpperOffsets;
+    std::vector<uint32_t> ownedUpper;
+
+    // Number of levels above 0 that node reaches
+    uint32_t levelOf(uint32_t node) const { return static_cast<uint32_t>((upperOffsets[node + 1] - upperOffsets[node]) / (1 + M)); }
+
+    // Neighbour list of node on level: element 0 is the count, the neighbours follow
+    const uint32_t* links(uint32_t node, uint32_t level) const {
+        return level == 0 ? level0 + node * (1 + 2 * M) : upper + upperOffsets[node] + (level - 1) * (1 + M);
+    }
+};
+
+// Default graph file for a feature index: features.cvfs -> features.cvfs.hnsw
+std::string hnswPathFor(const std::string& featureIndexPath);
+
+// Builds the graph over every row of store using cosine distance
+int buildHnswIndex(const FeatureStore& store, const HnswBuildParams& params, HnswIndex& index);
+
+int writeHnswIndex(const std::string& path, const HnswIndex& index);
+
+// Maps a graph file and checks that it was built for a feature index of store's shape
+int openHnswIndex(const std::string& path, const FeatureStore& store, HnswIndex& index);
+
+// Approximate k nearest rows to query by cosine distance, best first, searching with a candidate list of efSearch
+// (raised to k if smaller). excludeId, if given, is left out of the results, as the target's own row is.
+std::vector<ScoredId> searchHnswIndex(const HnswIndex& index, const FeatureStore& store, const float* query, size_t k,
+                                      size_t efSearch, uint32_t excludeId = TopKSelector::NO_EXCLUDE);
+
+#endif
@@ -0,0 +1,308 @@
+// imageCache.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: On-disk cache of decoded images, memory-mapped for reading and appended to as new images are decoded.
+
+#include "imageCache.h"
+#include "featureExtraction.h"
+#include "indexManifest.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool writePadding(FILE* fp, uint64_t from, uint64_t to) {
+    static const char zeros[IMAGE_CACHE_ALIGNMENT] = {0};
+    while (from < to) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(to - from, sizeof(zeros)));
+        if (fwrite(zeros, 1, n, fp) != n) {
+            return false;
+        }
+        from += n;
+    }
+    return true;
+}
+
+// Bytes an entry's block takes in the file, up to where the next block may start
+static uint64_t blockBytes(const ImageCacheEntry& entry) {
+    return alignUp(static_cast<uint64_t>(entry.rows) * entry.cols * 3, IMAGE_CACHE_ALIGNMENT);
+}
+
+// Rewrites the finished cache at path with only its referenced blocks, through a temporary file renamed over it
+static int compactImageCache(const std::string& path) {
+    TRACE_SCOPE("compact image cache");
+    MappedFile file;
+    if (mapFile(path, file) != 0) {
+        printf("Unable to map image cache %s\n", path.c_str());
+        return -1;
+    }
+    ImageCacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    std::vector<ImageCacheEntry> table(header.count);
+    memcpy(table.data(), file.data + header.entriesOffset, table.size() * sizeof(ImageCacheEntry));
+
+    std::string partial = path + ".compact";
+    FILE* fp = fopen(partial.c_str(), "wb");
+    if (!fp) {
+        printf("Unable to open %s for writing\n", partial.c_str());
+        unmapFile(file);
+        return -1;
+    }
+    uint64_t end = sizeof(header);
+    bool ok = writePadding(fp, 0, end);
+    for (size_t i = 0; ok && i < table.size(); ++i) {
+        uint64_t offset = alignUp(end, IMAGE_CACHE_ALIGNMENT);
+        uint64_t bytes = static_cast<uint64_t>(table[i].rows) * table[i].cols * 3;
+        ok = writePadding(fp, end, offset) && fwrite(file.data + table[i].offset, 1, bytes, fp) == bytes;
+        table[i].offset = offset;
+        end = offset + bytes;
+    }
+    header.entriesOffset = alignUp(end, sizeof(uint64_t));
+    header.deadBytes = 0;
+    const uint64_t namesOffset = header.namesOffset;
+    header.namesOffset = header.entriesOffset + table.size() * sizeof(ImageCacheEntry);
+    ok = ok && writePadding(fp, end, header.entriesOffset) &&
+         fwrite(table.data(), sizeof(ImageCacheEntry), table.size(), fp) == table.size() &&
+         fwrite(file.data + namesOffset, 1, header.namesBytes, fp) == header.namesBytes &&
+         fflush(fp) == 0 &&
+         fseek(fp, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    unmapFile(file);
+
+    std::error_code ec;
+    if (ok) {
+        std::filesystem::rename(partial, path, ec);
+    }
+    if (!ok || ec) {
+        printf("Unable to compact image cache %s\n", path.c_str());
+        std::filesystem::remove(partial, ec);
+        return -1;
+    }
+    return 0;
+}
+
+int openImageCache(const std::string& path, int decodeScale, ImageCache& cache) {
+    cache.path = path;
+    cache.decodeScale = decodeScale;
+    cache.entries.clear();
+    cache.added.clear();
+    cache.hits = 0;
+    cache.writeFailed = false;
+    cache.liveBytes = 0;
+    cache.deadBytes = 0;
+
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec)) {
+        return 0;
+    }
+    if (mapFile(path, cache.file) != 0) {
+        printf("Unable to map image cache %s\n", path.c_str());
+        return -1;
+    }
+
+    ImageCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    if (cache.file.size >= sizeof(header)) {
+        memcpy(&header, cache.file.data, sizeof(header));
+    }
+    if (header.magic[0] == 0) {
+        // An interrupted first run: the header is only written once the table is complete
+        printf("Image cache %s was never completed, rebuilding it\n", path.c_str());
+        unmapFile(cache.file);
+        return 0;
+    }
+    if (memcmp(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != IMAGE_CACHE_VERSION) {
+        printf("%s is not an image cache\n", path.c_str());
+        unmapFile(cache.file);
+        return -1;
+    }
+    if (header.decodeScale != static_cast<uint32_t>(decodeScale)) {
+        printf("Image cache %s holds images decoded at scale %u, rebuilding it at scale %d\n", path.c_str(), header.decodeScale, decodeScale);
+        unmapFile(cache.file);
+        return 0;
+    }
+
+    const uint64_t tableBytes = header.count * sizeof(ImageCacheEntry);
+    if (header.entriesOffset % sizeof(uint64_t) != 0 || header.entriesOffset + tableBytes != header.namesOffset ||
+        header.namesOffset + header.namesBytes > cache.file.size || header.namesBytes == 0 ||
+        cache.file.data[header.namesOffset + header.namesBytes - 1] != '\0') {
+        printf("Image cache %s is corrupt\n", path.c_str());
+        unmapFile(cache.file);
+        return -1;
+    }
+
+    const ImageCacheEntry* table = reinterpret_cast<const ImageCacheEntry*>(cache.file.data + header.entriesOffset);
+    const char* names = cache.file.data + header.namesOffset;
+    cache.entries.reserve(header.count);
+    for (uint64_t i = 0; i < header.count; ++i) {
+        const ImageCacheEntry& entry = table[i];
+        uint64_t bytes = static_cast<uint64_t>(entry.rows) * entry.cols * 3;
+        if (entry.offset % IMAGE_CACHE_ALIGNMENT != 0 || entry.offset + bytes > header.entriesOffset || entry.nameOffset >= header.namesBytes) {
+            printf("Image cache %s is corrupt\n", path.c_str());
+            cache.entries.clear();
+            unmapFile(cache.file);
+            return -1;
+        }
+        cache.entries.emplace(names + entry.nameOffset, entry);
+        cache.liveBytes += blockBytes(entry);
+    }
+    cache.deadBytes = header.deadBytes;
+    traceCount("bytes mapped", cache.file.size);
+    return 0;
+}
+
+// Appends the pixels of image as a new block; the entry only reaches the table on close
+static int appendCachedImage(ImageCache& cache, const std::string& path, const ManifestEntry& stat, const cv::Mat& image) {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.writeFailed) {
+        return -1;
+    }
+    if (!cache.fp) {
+        // A valid cache is extended past its current end; anything else is started over, header left blank until close
+        bool extend = cache.file.data != nullptr;
+        cache.fp = fopen(cache.path.c_str(), extend ? "r+b" : "w+b");
+        if (!cache.fp) {
+            printf("Unable to open image cache %s for writing\n", cache.path.c_str());
+            cache.writeFailed = true;
+            return -1;
+        }
+        bool ok = extend ? fseek(cache.fp, 0, SEEK_END) == 0 : writePadding(cache.fp, 0, sizeof(ImageCacheHeader));
+        if (!ok) {
+            printf("Unable to write to image cache %s\n", cache.path.c_str());
+            cache.writeFailed = true;
+            return -1;
+        }
+        cache.end = extend ? cache.file.size : sizeof(ImageCacheHeader);
+    }
+
+    ImageCacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = alignUp(cache.end, IMAGE_CACHE_ALIGNMENT);
+    entry.size = stat.size;
+    entry.mtime = stat.mtime;
+    entry.rows = static_cast<uint32_t>(image.rows);
+    entry.cols = static_cast<uint32_t>(image.cols);
+
+    const size_t rowBytes = static_cast<size_t>(image.cols) * 3;
+    bool ok = writePadding(cache.fp, cache.end, entry.offset);
+    for (int y = 0; ok && y < image.rows; ++y) {
+        ok = fwrite(image.ptr<uchar>(y), 1, rowBytes, cache.fp) == rowBytes;
+    }
+    if (!ok) {
+        printf("Unable to write to image cache %s\n", cache.path.c_str());
+        cache.writeFailed = true;
+        return -1;
+    }
+    cache.end = entry.offset + rowBytes * image.rows;
+    cache.added.emplace_back(path, entry);
+    return 0;
+}
+
+// The cache entry of path if the file is unchanged since it was cached, else nullptr; stat is filled in when it can be
+static const ImageCacheEntry* findCachedImage(const ImageCache& cache, const std::string& path, ManifestEntry& stat, bool& haveStat) {
+    haveStat = statImageFile(path, stat) == 0;
+    auto cached = cache.entries.find(path);
+    if (haveStat && cached != cache.entries.end() && cached->second.size == stat.size && cached->second.mtime == stat.mtime) {
+        return &cached->second;
+    }
+    return nullptr;
+}
+
+void prefetchUncachedImage(const ImageCache& cache, const std::string& path) {
+    ManifestEntry stat;
+    bool haveStat;
+    if (!findCachedImage(cache, path, stat, haveStat)) {
+        prefetchFile(path);
+    }
+}
+
+cv::Mat readCachedImage(ImageCache& cache, const std::string& path) {
+    ManifestEntry stat;
+    bool haveStat;
+    if (const ImageCacheEntry* entry = findCachedImage(cache, path, stat, haveStat)) {
+        TRACE_SCOPE("image cache");
+        cache.hits++;
+        traceCount("image cache hits", 1);
+        return cv::Mat(static_cast<int>(entry->rows), static_cast<int>(entry->cols), CV_8UC3, const_cast<char*>(cache.file.data + entry->offset));
+    }
+
+    cv::Mat image = readImage(path, cache.decodeScale);
+    if (haveStat && !image.empty() && image.type() == CV_8UC3) {
+        appendCachedImage(cache, path, stat, image);
+    }
+    return image;
+}
+
+int closeImageCache(ImageCache& cache) {
+    int status = 0;
+    if (cache.fp && cache.writeFailed) {
+        // Leave the header alone: an extended cache keeps its previous table, a new one is rebuilt on the next run
+        fclose(cache.fp);
+        cache.fp = nullptr;
+        status = -1;
+    }
+    if (cache.fp) {
+        // Images decoded again because their file changed replace their old entry; the old pixels, like the previous
+        // table, become unreferenced bytes until the cache is compacted
+        for (const auto& added : cache.added) {
+            cache.entries[added.first] = added.second;
+        }
+
+        std::vector<ImageCacheEntry> table;
+        std::string names;
+        table.reserve(cache.entries.size());
+        cache.liveBytes = 0;
+        for (const auto& cached : cache.entries) {
+            table.push_back(cached.second);
+            table.back().nameOffset = names.size();
+            names.append(cached.first);
+            names.push_back('\0');
+            cache.liveBytes += blockBytes(cached.second);
+        }
+
+        ImageCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic));
+        header.version = IMAGE_CACHE_VERSION;
+        header.decodeScale = static_cast<uint32_t>(cache.decodeScale);
+        header.count = table.size();
+        header.entriesOffset = alignUp(cache.end, sizeof(uint64_t));
+        header.namesOffset = header.entriesOffset + table.size() * sizeof(ImageCacheEntry);
+        header.namesBytes = names.size();
+        const uint64_t blocks = header.entriesOffset - sizeof(header);
+        header.deadBytes = blocks > cache.liveBytes ? blocks - cache.liveBytes : 0;
+        cache.deadBytes = header.deadBytes;
+
+        bool ok = writePadding(cache.fp, cache.end, header.entriesOffset) &&
+                  fwrite(table.data(), sizeof(ImageCacheEntry), table.size(), cache.fp) == table.size() &&
+                  fwrite(names.data(), 1, names.size(), cache.fp) == names.size() &&
+                  fflush(cache.fp) == 0 &&
+                  fseek(cache.fp, 0, SEEK_SET) == 0 &&
+                  fwrite(&header, sizeof(header), 1, cache.fp) == 1;
+        if (fclose(cache.fp) != 0 || !ok) {
+            printf("Unable to write image cache %s\n", cache.path.c_str());
+            status = -1;
+        }
+        cache.fp = nullptr;
+    }
+    unmapFile(cache.file);
+
+    if (status == 0 && cache.deadBytes > cache.liveBytes * IMAGE_CACHE_COMPACT_RATIO) {
+        printf("Image cache %s: compacting %.1f MB of unreferenced images\n", cache.path.c_str(), cache.deadBytes / 1048576.0);
+        if (compactImageCache(cache.path) == 0) {
+            cache.deadBytes = 0;
+        } else {
+            status = -1;
+        }
+    }
+    printf("Image cache %s: %zu images read from the cache, %zu added, %.1f MB of images, %.1f MB unreferenced\n",
+           cache.path.c_str(), cache.hits.load(), cache.added.size(), cache.liveBytes / 1048576.0, cache.deadBytes / 1048576.0);
+    cache.entries.clear();
+    cache.added.clear();
+    return status;
+}
@@ -0,0 +1,94 @@
+// imageCache.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for imageCache.cpp, an on-disk cache of decoded images. Re-indexing a corpus after a change to
+//          the extractors then reads raw BGR pixels straight from a memory mapping instead of decoding every JPEG again.
+
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "mappedFile.h"
+
+// Cache file layout (native little-endian, offsets from the start of the file):
+//   ImageCacheHeader
+//   pixel blocks, each 64-byte aligned: rows * cols continuous 8-bit BGR pixels of one image
+//   entry table at entriesOffset: count ImageCacheEntry records
+//   names at namesOffset: NUL-terminated image paths, indexed by ImageCacheEntry::nameOffset
+// Images are stored as readImage decodes them at the cache's decode scale, so features extracted from a cached image are
+// identical to those of a fresh decode; a cache built at scale 4 or 8 holds thumbnails, one built at scale 1 full images.
+// New images are appended after the existing blocks and the table is rewritten on close; the header goes last, so an
+// interrupted run leaves the previous cache intact. The blocks of replaced images and the old tables stay behind as
+// unreferenced bytes, counted in deadBytes; once they exceed IMAGE_CACHE_COMPACT_RATIO of the live pixel bytes, close
+// copies the live blocks into a fresh file that replaces the cache.
+#define IMAGE_CACHE_MAGIC "CVIMGCHE"
+#define IMAGE_CACHE_VERSION 1
+#define IMAGE_CACHE_ALIGNMENT 64
+#define IMAGE_CACHE_COMPACT_RATIO 0.25
+
+struct ImageCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t decodeScale;
+    uint64_t count;
+    uint64_t entriesOffset;
+    uint64_t namesOffset;
+    uint64_t namesBytes;
+    uint64_t deadBytes;     // bytes before entriesOffset that no entry references; 0 in caches that predate it
+    uint32_t reserved[6];
+};
+
+// One cached image. size and mtime are those of the image file when it was decoded; a file whose size or mtime has
+// changed since is decoded again.
+struct ImageCacheEntry {
+    uint64_t offset;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t rows;
+    uint32_t cols;
+    uint64_t nameOffset;
+};
+
+// An opened image cache. Lookups only read the entries found at open, so workers can share it without locking;
+// images decoded during the run are appended under the mutex and become visible from the next run.
+struct ImageCache {
+    std::string path;
+    int decodeScale = 1;
+    MappedFile file;
+    std::unordered_map<std::string, ImageCacheEntry> entries;
+
+    FILE* fp = nullptr;   // opened on the first append
+    bool writeFailed = false;
+    uint64_t end = 0;     // where the next pixel block goes
+    std::mutex mutex;
+    std::vector<std::pair<std::string, ImageCacheEntry>> added;
+    std::atomic<size_t> hits{0};
+    uint64_t liveBytes = 0;   // pixel bytes referenced by the table, as of open and then as of close
+    uint64_t deadBytes = 0;
+};
+
+// Opens the cache at path for images decoded at decodeScale. A missing cache is created on close; one built at another
+// decode scale is replaced. Returns -1 if the file exists but is not an image cache.
+int openImageCache(const std::string& path, int decodeScale, ImageCache& cache);
+
+// The image at path: a read-only view of the cached pixels when the file is unchanged, otherwise readImage at the
+// cache's decode scale, which is then added to the cache. Callers must not write to the returned pixels.
+// Safe to call from several threads at once.
+cv::Mat readCachedImage(ImageCache& cache, const std::string& path);
+
+// Prefetch function for the index pipeline: starts read-ahead of path only if it will have to be decoded
+void prefetchUncachedImage(const ImageCache& cache, const std::string& path);
+
+// Writes the entry table of the images added since open, compacts the file if too much of it is unreferenced, reports
+// the live and unreferenced sizes and releases the cache
+int closeImageCache(ImageCache& cache);
+
+#endif
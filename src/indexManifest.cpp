@@ -0,0 +1,140 @@
+// indexManifest.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Reading and writing the manifest of indexed image files used for incremental re-indexing.
+
+#include "indexManifest.h"
+#include "trace.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#define MANIFEST_HEADER "# readImages manifest v1"
+#define MANIFEST_SCALE " scale="
+
+std::string manifestPathFor(const std::string& indexPath) {
+    return indexPath + ".manifest";
+}
+
+int readManifest(const std::string& path, std::string& featureType, int& decodeScale, std::vector<ManifestEntry>& entries) {
+    TRACE_SCOPE("manifest");
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        return -1;
+    }
+
+    entries.clear();
+    char line[4096];
+    bool sawHeader = false;
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (line[0] == '#') {
+            // "# readImages manifest v1 <feature method>[ scale=<decode scale>]"; no scale means full size
+            size_t headerLen = strlen(MANIFEST_HEADER);
+            if (strncmp(line, MANIFEST_HEADER, headerLen) == 0) {
+                sawHeader = true;
+                featureType = line[headerLen] == ' ' ? line + headerLen + 1 : "";
+                decodeScale = 1;
+                size_t scalePos = featureType.find(MANIFEST_SCALE);
+                if (scalePos != std::string::npos) {
+                    decodeScale = atoi(featureType.c_str() + scalePos + strlen(MANIFEST_SCALE));
+                    featureType.erase(scalePos);
+                }
+            }
+            continue;
+        }
+
+        // hash,size,mtime,path -- the path is last so it may itself contain commas
+        ManifestEntry entry;
+        int consumed = 0;
+        if (sscanf(line, "%" SCNx64 ",%" SCNu64 ",%" SCNd64 ",%n", &entry.hash, &entry.size, &entry.mtime, &consumed) != 3 || consumed == 0) {
+            fclose(fp);
+            return -1;
+        }
+        entry.path = line + consumed;
+        entries.push_back(entry);
+    }
+    fclose(fp);
+
+    return sawHeader ? 0 : -1;
+}
+
+int writeManifest(const std::string& path, const std::string& featureType, int decodeScale, const std::vector<ManifestEntry>& entries) {
+    std::string tmpPath = path + ".partial";
+    FILE* fp = fopen(tmpPath.c_str(), "w");
+    if (!fp) {
+        printf("Unable to write manifest %s\n", path.c_str());
+        return -1;
+    }
+
+    if (decodeScale > 1) {
+        fprintf(fp, "%s %s%s%d\n", MANIFEST_HEADER, featureType.c_str(), MANIFEST_SCALE, decodeScale);
+    } else {
+        fprintf(fp, "%s %s\n", MANIFEST_HEADER, featureType.c_str());
+    }
+    for (const auto& entry : entries) {
+        fprintf(fp, "%016" PRIx64 ",%" PRIu64 ",%" PRId64 ",%s\n", entry.hash, entry.size, entry.mtime, entry.path.c_str());
+    }
+
+    if (fclose(fp) != 0) {
+        printf("Unable to write manifest %s\n", path.c_str());
+        return -1;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        printf("Unable to replace manifest %s\n", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int statImageFile(const std::string& path, ManifestEntry& entry) {
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return -1;
+    }
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return -1;
+    }
+
+    entry.path = path;
+    entry.size = static_cast<uint64_t>(size);
+    entry.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    return 0;
+}
+
+int hashFileContents(const std::string& path, uint64_t& hash) {
+    TRACE_SCOPE("hash");
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    hash = 14695981039346656037ULL;
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        traceCount("bytes read", n);
+        for (size_t i = 0; i < n; ++i) {
+            hash ^= buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    int status = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    return status;
+}
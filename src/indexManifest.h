@@ -0,0 +1,37 @@
+// indexManifest.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for indexManifest.cpp, the per-index record of which image files were indexed, used by
+//          readImages --incremental to re-extract only new or changed images.
+
+#ifndef INDEX_MANIFEST_H
+#define INDEX_MANIFEST_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ManifestEntry {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;      // filesystem clock ticks, only compared for equality
+    uint64_t hash = 0;      // hash of the file contents
+};
+
+// The manifest lives next to the index it describes: <index path>.manifest
+std::string manifestPathFor(const std::string& indexPath);
+
+// Reads a manifest written by writeManifest, including the feature method and decode scale the index was built with.
+// Returns -1 if it is missing or unreadable.
+int readManifest(const std::string& path, std::string& featureType, int& decodeScale, std::vector<ManifestEntry>& entries);
+
+// Writes the manifest (via a temporary file, so an interrupted run leaves the old manifest intact)
+int writeManifest(const std::string& path, const std::string& featureType, int decodeScale, const std::vector<ManifestEntry>& entries);
+
+// Fills in size and mtime for path. Returns -1 if the file cannot be stat'ed.
+int statImageFile(const std::string& path, ManifestEntry& entry);
+
+// 64-bit FNV-1a hash of the file's contents. Returns -1 if the file cannot be read.
+int hashFileContents(const std::string& path, uint64_t& hash);
+
+#endif
@@ -0,0 +1,179 @@
+// indexPipeline.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Threaded scan -> decode/extract -> ordered write pipeline used by readImages.
+
+#include "indexPipeline.h"
+#include "boundedQueue.h"
+#include "trace.h"
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+struct IndexJob {
+    size_t seq = 0;
+    std::string path;
+};
+
+int scanDirectory(const std::string& directory, std::vector<std::string>& paths) {
+    TRACE_SCOPE("scan directory");
+    std::error_code ec;
+    std::filesystem::directory_iterator it(directory, ec);
+    if (ec) {
+        printf("Unable to open directory %s\n", directory.c_str());
+        return -1;
+    }
+
+    for (const auto& entry : it) {
+        paths.push_back(entry.path().string());
+    }
+    return 0;
+}
+
+// Shared implementation; nextPath is the scanner stage and returns false when there are no more images
+static int runPipeline(const std::function<bool(std::string&)>& nextPath, int threads, const IndexExtractFn& extract,
+                       const IndexWriteFn& write, const IndexPrefetchFn& prefetch) {
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    // Images allowed between the scanner and the writer; keeps the reorder buffer small when one image is slow
+    const size_t window = static_cast<size_t>(threads) * 4;
+
+    BoundedQueue<IndexJob> jobs(static_cast<size_t>(threads) * 2);
+    BoundedQueue<IndexResult> results(static_cast<size_t>(threads) * 2);
+
+    std::mutex windowMutex;
+    std::condition_variable windowCv;
+    size_t written = 0;
+    bool aborted = false;
+
+    std::thread scanner([&]() {
+        size_t seq = 0;
+        IndexJob job;
+        while (nextPath(job.path)) {
+            {
+                std::unique_lock<std::mutex> lock(windowMutex);
+                windowCv.wait(lock, [&] { return aborted || seq - written < window; });
+                if (aborted) {
+                    break;
+                }
+            }
+            // Read-ahead is issued only once the image is inside the window, so it stays a bounded distance ahead
+            if (prefetch) {
+                TRACE_SCOPE("prefetch");
+                prefetch(job.path);
+            }
+            job.seq = seq++;
+            if (!jobs.push(std::move(job))) {
+                break;
+            }
+        }
+        jobs.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            IndexJob job;
+            while (jobs.pop(job)) {
+                IndexResult result;
+                result.seq = job.seq;
+                result.path = std::move(job.path);
+                try {
+                    result.ok = extract(result);
+                } catch (const std::exception&) {
+                    // e.g. an image too small for the extractor's region; reported like an unreadable image
+                    result.ok = false;
+                }
+                if (!results.push(std::move(result))) {
+                    break;
+                }
+            }
+        });
+    }
+
+    // Closes the result queue once every worker has finished
+    std::thread closer([&]() {
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        results.close();
+    });
+
+    // Writer stage: release results in scan order
+    int status = 0;
+    std::map<size_t, IndexResult> pending;
+    IndexResult result;
+    while (results.pop(result)) {
+        if (status != 0) {
+            continue; // drain so the workers can exit
+        }
+        pending.emplace(result.seq, std::move(result));
+
+        for (auto next = pending.find(written); next != pending.end(); next = pending.find(written)) {
+            status = write(next->second);
+            pending.erase(next);
+
+            std::lock_guard<std::mutex> lock(windowMutex);
+            written++;
+            if (status != 0) {
+                aborted = true;
+            }
+            windowCv.notify_all();
+            if (status != 0) {
+                break;
+            }
+        }
+    }
+
+    if (status != 0) {
+        jobs.close();
+    }
+
+    scanner.join();
+    closer.join();
+    return status;
+}
+
+int runIndexPipeline(const std::string& directory, int threads, const IndexExtractFn& extract, const IndexWriteFn& write,
+                     const IndexPrefetchFn& prefetch) {
+    std::error_code ec;
+    std::filesystem::directory_iterator it(directory, ec);
+    if (ec) {
+        printf("Unable to open directory %s\n", directory.c_str());
+        return -1;
+    }
+
+    std::filesystem::directory_iterator end;
+    auto nextPath = [&](std::string& path) {
+        if (it == end) {
+            return false;
+        }
+        path = it->path().string();
+        it.increment(ec);
+        if (ec) {
+            it = end;
+        }
+        return true;
+    };
+    return runPipeline(nextPath, threads, extract, write, prefetch);
+}
+
+int runIndexPipeline(const std::vector<std::string>& paths, int threads, const IndexExtractFn& extract, const IndexWriteFn& write,
+                     const IndexPrefetchFn& prefetch) {
+    size_t next = 0;
+    auto nextPath = [&](std::string& path) {
+        if (next >= paths.size()) {
+            return false;
+        }
+        path = paths[next++];
+        return true;
+    };
+    return runPipeline(nextPath, threads, extract, write, prefetch);
+}
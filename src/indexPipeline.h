@@ -0,0 +1,50 @@
+// indexPipeline.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for indexPipeline.cpp, the threaded scan -> decode/extract -> ordered write pipeline used by readImages.
+
+#ifndef INDEX_PIPELINE_H
+#define INDEX_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "mappedFile.h"
+
+// One image after the worker stage. seq is the image's position in the directory listing.
+struct IndexResult {
+    size_t seq = 0;
+    std::string path;
+    bool ok = false;
+    std::vector<std::vector<float>> features;   // one vector per feature method being indexed
+    uint64_t contentHash = 0;   // set by extractors that fingerprint the file (incremental indexing)
+};
+
+// Decodes the image at result.path and fills in its features; returns false if the image could not be read.
+// Called concurrently from the worker threads, so it must not touch shared state.
+typedef std::function<bool(IndexResult& result)> IndexExtractFn;
+
+// Consumes results on a single thread, strictly in directory order. A non-zero return aborts the run.
+typedef std::function<int(const IndexResult& result)> IndexWriteFn;
+
+// Called on the scanner thread for each image as it is queued, up to a window of images ahead of the workers, so the
+// file can be read from disk while earlier images are decoded. The default starts read-ahead of the whole file;
+// callers that will not read some files (cached images, indexed rows) pass their own.
+typedef std::function<void(const std::string& path)> IndexPrefetchFn;
+
+// Lists the entries of a directory in directory_iterator order, i.e. the order a serial run visits them
+int scanDirectory(const std::string& directory, std::vector<std::string>& paths);
+
+// Runs the pipeline over the directory: a scanner thread feeds a bounded job queue, `threads` workers decode and
+// extract, and the calling thread hands results to write in scan order, so the output is identical to a serial run.
+// At most a small window of images is in flight at once, which bounds memory regardless of directory size.
+int runIndexPipeline(const std::string& directory, int threads, const IndexExtractFn& extract, const IndexWriteFn& write,
+                     const IndexPrefetchFn& prefetch = prefetchFile);
+
+// Same pipeline over an explicit list of image paths, written in list order
+int runIndexPipeline(const std::vector<std::string>& paths, int threads, const IndexExtractFn& extract, const IndexWriteFn& write,
+                     const IndexPrefetchFn& prefetch = prefetchFile);
+
+#endif
@@ -4,93 +4,448 @@
   CS 5330
 
   Implementation of a K-means algorithm
+
+  The means are seeded with k-means++ and refined with Lloyd's algorithm using Hamerly's bounds: each pixel keeps an
+  upper bound on the distance to its own mean and a lower bound on the distance to every other mean, both moved by how
+  far the means drift, so most pixels are confirmed in their cluster without looking at any other mean. Only pixels
+  whose bounds overlap search for their nearest mean, and that search goes through a uniform grid over the color cube
+  so it visits the few means near the pixel rather than all K of them. Assignment steps run on several threads.
+  With a batch size, mini-batch k-means (Sculley 2010) updates the means from small random samples instead, which
+  is what makes thousands of colors on full-resolution images practical.
 */
 
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
 #include <opencv2/opencv.hpp>
 #include "kmeans.h"
 
+#define KMEANS_GRID_MIN_K 64        // below this many means one cell, i.e. a plain linear search, is fastest
+#define KMEANS_GRID_MAX_CELLS 64    // cells per axis at most
+#define KMEANS_SEED_SAMPLE 16384    // k-means++ picks the seeds from a sample of this many pixels (at least K)
+
+// Pixels or means as separate coordinate arrays, so the distance loops run over contiguous floats
+struct Points {
+  std::vector<float> x, y, z;
+
+  void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+};
+
+static inline float dist2( float ax, float ay, float az, float bx, float by, float bz ) {
+  float dx = ax - bx, dy = ay - by, dz = az - bz;
+  return dx*dx + dy*dy + dz*dz;
+}
+
+// The means bucketed into a uniform grid over [0, 256)^3, stored in cell order for nearest-mean queries
+struct MeanGrid {
+  int cells = 1;                  // cells per axis
+  float cellSize = 256.0f;
+  std::vector<int> cellStart;     // cells^3 + 1 offsets into the arrays below
+  Points means;
+  std::vector<int> id;            // index of each entry in the caller's means
+
+  int cellOf( float v ) const { return std::min( cells - 1, std::max( 0, (int)(v / cellSize) ) ); }
+  int cellIndex( int cx, int cy, int cz ) const { return (cz * cells + cy) * cells + cx; }
+};
+
+static void buildGrid( const Points &means, int K, MeanGrid &grid ) {
+  grid.cells = 1;
+  if( K >= KMEANS_GRID_MIN_K ) {
+    // about two means per cell
+    grid.cells = std::min( KMEANS_GRID_MAX_CELLS, std::max( 1, (int)std::lround( std::cbrt( K / 2.0 ) ) ) );
+  }
+  grid.cellSize = 256.0f / grid.cells;
+
+  int ncells = grid.cells * grid.cells * grid.cells;
+  std::vector<int> cellOfMean(K);
+  grid.cellStart.assign( ncells + 1, 0 );
+  for(int k=0;k<K;k++) {
+    cellOfMean[k] = grid.cellIndex( grid.cellOf(means.x[k]), grid.cellOf(means.y[k]), grid.cellOf(means.z[k]) );
+    grid.cellStart[ cellOfMean[k] + 1 ]++;
+  }
+  for(int c=0;c<ncells;c++) {
+    grid.cellStart[c+1] += grid.cellStart[c];
+  }
+
+  std::vector<int> fill( grid.cellStart.begin(), grid.cellStart.end() - 1 );
+  grid.means.resize(K);
+  grid.id.resize(K);
+  for(int k=0;k<K;k++) {
+    int e = fill[ cellOfMean[k] ]++;
+    grid.means.x[e] = means.x[k];
+    grid.means.y[e] = means.y[k];
+    grid.means.z[e] = means.z[k];
+    grid.id[e] = k;
+  }
+}
+
 /*
-  data: a std::vector of pixels
-  means: a std:vector of means, will contain the cluster means when the function returns
-  labels: an allocated array of type int, the same size as the data, contains the labels when the function returns
-  K: the number of clusters
-  maxIterations: maximum number of E-M interactions, default is 10
-  stopThresh: if the means change less than the threshold, the E-M loop terminates, default is 0
+  Finds the nearest mean to (px, py, pz), skipping mean `skip` (or none if -1), and returns its index; d1 and d2 are
+  set to the squared distances of the nearest and second nearest means (FLT_MAX if there is none).
 
-  Executes K-means clustering on the data
+  Cells are visited in rings of growing Chebyshev distance around the pixel's cell, and the search stops once every
+  unvisited cell is further away than the second nearest mean found so far.
  */
-int kmeans( std::vector<cv::Vec3b> &data, std::vector<cv::Vec3b> &means, int *labels, int K, int maxIterations, int stopThresh ) {
+static int nearestMean( const MeanGrid &grid, float px, float py, float pz, int skip, float &d1, float &d2 ) {
+  int best = -1;
+  d1 = d2 = FLT_MAX;
+  int cx = grid.cellOf(px), cy = grid.cellOf(py), cz = grid.cellOf(pz);
+  const float p[3] = {px, py, pz};
+  const int c[3] = {cx, cy, cz};
 
-  // error checking
-  if( K > data.size() ) {
-    printf("error: K must be less than the number of data points\n");
-    return(-1);
+  for(int r=0;;r++) {
+    if( r > 0 ) {
+      // distance from the pixel to the nearest cell of ring r, over the sides where the grid continues
+      float reach = FLT_MAX;
+      for(int a=0;a<3;a++) {
+        if( c[a] - r >= 0 ) {
+          reach = std::min( reach, p[a] - (c[a] - r + 1) * grid.cellSize );
+        }
+        if( c[a] + r < grid.cells ) {
+          reach = std::min( reach, (c[a] + r) * grid.cellSize - p[a] );
+        }
+      }
+      if( reach * reach >= d2 ) { // also ends the search once no side has cells left
+        break;
+      }
+    }
+
+    for(int iz=std::max(0, cz-r); iz<=std::min(grid.cells-1, cz+r); iz++) {
+      for(int iy=std::max(0, cy-r); iy<=std::min(grid.cells-1, cy+r); iy++) {
+        for(int ix=std::max(0, cx-r); ix<=std::min(grid.cells-1, cx+r); ix++) {
+          if( std::max( std::abs(ix-cx), std::max( std::abs(iy-cy), std::abs(iz-cz) ) ) != r ) {
+            continue; // inside the ring, already visited
+          }
+          int cell = grid.cellIndex(ix, iy, iz);
+          for(int e=grid.cellStart[cell]; e<grid.cellStart[cell+1]; e++) {
+            float d = dist2( px, py, pz, grid.means.x[e], grid.means.y[e], grid.means.z[e] );
+            if( d < d2 && grid.id[e] != skip ) {
+              if( d < d1 ) {
+                d2 = d1;
+                d1 = d;
+                best = grid.id[e];
+              }
+              else {
+                d2 = d;
+              }
+            }
+          }
+        }
+      }
+    }
   }
+  return(best);
+}
 
-  // clear the means vector
-  means.clear();
+// Runs fn(begin, end) over [0, n) split across threads
+template <typename Fn>
+static void parallelFor( size_t n, int threads, Fn fn ) {
+  size_t nthreads = std::min<size_t>( std::max(threads, 1), std::max<size_t>(n / 1024, 1) );
+  std::vector<std::thread> pool;
+  for(size_t t=1;t<nthreads;t++) {
+    pool.emplace_back( fn, t * n / nthreads, (t+1) * n / nthreads );
+  }
+  fn( (size_t)0, n / nthreads );
+  for(auto &thread : pool) {
+    thread.join();
+  }
+}
 
-  // initialize the K mean values
-  // use comb sampling to select K values
-  int delta = data.size() / K;
-  int istep = rand() % (data.size() % K);
-  for(int i=0;i<K;i++) {
-    int index = (istep + i*delta) % data.size();
-    means.push_back( data[index] );
-  }
-  // have K initial means
-
-  // loop the E-M steps
-  for(int i=0;i<maxIterations;i++) {
-
-    // classify each data point using SSD
-    for(int j=0;j<data.size();j++) {
-      int minssd = SSD( means[0], data[j] );
-      int minidx = 0;
-      for(int k=1;k<K;k++) {
-	int tssd = SSD( means[k], data[j] );
-	if( tssd < minssd ) {
-	  minssd = tssd;
-	  minidx = k;
-	}
+/*
+  k-means++ seeding: each new mean is a pixel drawn with probability proportional to its squared distance to the
+  nearest mean chosen so far. Drawn from a sample of the pixels, since each pick costs a pass over the sample.
+ */
+static void seedMeans( const Points &pts, int K, std::mt19937 &rng, Points &means ) {
+  size_t N = pts.x.size();
+  size_t S = std::min( N, std::max( (size_t)KMEANS_SEED_SAMPLE, (size_t)K ) );
+  std::vector<size_t> sample(N);
+  std::iota( sample.begin(), sample.end(), 0 );
+  if( S < N ) {
+    for(size_t i=0;i<S;i++) { // partial Fisher-Yates shuffle
+      std::swap( sample[i], sample[ i + rng() % (N - i) ] );
+    }
+    sample.resize(S);
+  }
+
+  means.resize(K);
+  if( (size_t)K == S ) {
+    // every sampled pixel becomes a mean, which is what the weighted draws would end up choosing anyway
+    for(int k=0;k<K;k++) {
+      means.x[k] = pts.x[sample[k]];
+      means.y[k] = pts.y[sample[k]];
+      means.z[k] = pts.z[sample[k]];
+    }
+    return;
+  }
+
+  Points s;
+  s.resize(S);
+  for(size_t i=0;i<S;i++) {
+    s.x[i] = pts.x[sample[i]];
+    s.y[i] = pts.y[sample[i]];
+    s.z[i] = pts.z[sample[i]];
+  }
+
+  std::vector<float> d(S, FLT_MAX);
+  size_t pick = rng() % S;
+  for(int k=0;k<K;k++) {
+    means.x[k] = s.x[pick];
+    means.y[k] = s.y[pick];
+    means.z[k] = s.z[pick];
+    double total = 0;
+    for(size_t i=0;i<S;i++) {
+      d[i] = std::min( d[i], dist2( s.x[i], s.y[i], s.z[i], means.x[k], means.y[k], means.z[k] ) );
+      total += d[i];
+    }
+
+    if( total <= 0 ) {
+      pick = rng() % S; // every pixel coincides with a mean already
+      continue;
+    }
+    double target = std::uniform_real_distribution<double>(0.0, total)(rng), cumulative = 0;
+    pick = S - 1;
+    for(size_t i=0;i<S;i++) {
+      cumulative += d[i];
+      if( cumulative > target ) {
+        pick = i;
+        break;
       }
-      labels[j] = minidx;
     }
+  }
+}
+
+// Assigns every pixel in [0, N) to its nearest mean
+static void assignAll( const Points &pts, const MeanGrid &grid, int threads, int *labels ) {
+  parallelFor( pts.x.size(), threads, [&](size_t begin, size_t end) {
+    float d1, d2;
+    for(size_t i=begin;i<end;i++) {
+      labels[i] = nearestMean( grid, pts.x[i], pts.y[i], pts.z[i], -1, d1, d2 );
+    }
+  } );
+}
 
-    // calculate the new means
-    std::vector<cv::Vec4i> tmeans(means.size(), cv::Vec4i(0, 0, 0, 0) ); // initialize with zeros
-    for(int j=0;j<data.size();j++) {
-      tmeans[ labels[j] ][0] += data[j][0];
-      tmeans[ labels[j] ][1] += data[j][1];
-      tmeans[ labels[j] ][2] += data[j][2];
-      tmeans[ labels[j] ][3] ++; // counter
+// Lloyd's algorithm with Hamerly's bounds; labels hold the assignment to the final means
+static void lloyd( const Points &pts, Points &means, int K, const KmeansParams &params, int threads, int *labels ) {
+  size_t N = pts.x.size();
+  std::vector<float> upper(N), lower(N);
+  MeanGrid grid;
+  buildGrid( means, K, grid );
+  parallelFor( N, threads, [&](size_t begin, size_t end) {
+    float d1, d2;
+    for(size_t i=begin;i<end;i++) {
+      labels[i] = nearestMean( grid, pts.x[i], pts.y[i], pts.z[i], -1, d1, d2 );
+      upper[i] = std::sqrt(d1);
+      lower[i] = d2 == FLT_MAX ? FLT_MAX : std::sqrt(d2);
     }
-    
-    int sum = 0;
-    for(int k=0;k<tmeans.size();k++) {
-      tmeans[k][0] /= tmeans[k][3];
-      tmeans[k][1] /= tmeans[k][3];
-      tmeans[k][2] /= tmeans[k][3];
+  } );
 
-      // compute the SSD between the new and old means
-      sum += SSD( tmeans[k], means[k] );
+  // running sums per cluster, updated only for the pixels that change cluster
+  std::vector<double> sx(K, 0), sy(K, 0), sz(K, 0);
+  std::vector<long> counts(K, 0);
+  for(size_t i=0;i<N;i++) {
+    sx[labels[i]] += pts.x[i];
+    sy[labels[i]] += pts.y[i];
+    sz[labels[i]] += pts.z[i];
+    counts[labels[i]]++;
+  }
+
+  std::vector<float> drift(K), halfGap(K);
+  for(int it=0;it<params.maxIterations;it++) {
 
-      means[k][0] = tmeans[k][0]; // update the mean
-      means[k][1] = tmeans[k][1]; // update the mean
-      means[k][2] = tmeans[k][2]; // update the mean
+    // move each mean to the centroid of its pixels; an empty cluster keeps its mean
+    double moved = 0;
+    int farthest = 0;
+    for(int k=0;k<K;k++) {
+      drift[k] = 0;
+      if( counts[k] > 0 ) {
+        float nx = (float)(sx[k] / counts[k]), ny = (float)(sy[k] / counts[k]), nz = (float)(sz[k] / counts[k]);
+        float d = dist2( nx, ny, nz, means.x[k], means.y[k], means.z[k] );
+        moved += d;
+        drift[k] = std::sqrt(d);
+        means.x[k] = nx;
+        means.y[k] = ny;
+        means.z[k] = nz;
+      }
+      if( drift[k] > drift[farthest] ) {
+        farthest = k;
+      }
     }
 
     // check if we can stop early
-    if( sum <= stopThresh ) {
+    if( moved <= params.stopThresh ) {
       break;
     }
+
+    float maxDrift = drift[farthest], otherDrift = 0;
+    for(int k=0;k<K;k++) {
+      if( k != farthest ) {
+        otherDrift = std::max( otherDrift, drift[k] );
+      }
+    }
+
+    // half the distance from each mean to its nearest other mean: a pixel closer than that to its mean stays
+    buildGrid( means, K, grid );
+    parallelFor( (size_t)K, threads, [&](size_t begin, size_t end) {
+      float d1, d2;
+      for(size_t k=begin;k<end;k++) {
+        nearestMean( grid, means.x[k], means.y[k], means.z[k], (int)k, d1, d2 );
+        halfGap[k] = d1 == FLT_MAX ? FLT_MAX : 0.5f * std::sqrt(d1);
+      }
+    } );
+
+    // reassign the pixels whose bounds no longer prove their cluster, collecting the moves per thread
+    std::vector<std::vector<std::pair<int, int>>> moves( std::max(threads, 1) );
+    std::vector<std::thread> pool;
+    size_t nthreads = moves.size();
+    auto reassign = [&](size_t t) {
+      float d1, d2;
+      for(size_t i=t*N/nthreads; i<(t+1)*N/nthreads; i++) {
+        int a = labels[i];
+        upper[i] += drift[a];
+        lower[i] -= a == farthest ? otherDrift : maxDrift;
+        float bound = std::max( halfGap[a], lower[i] );
+        if( upper[i] <= bound ) {
+          continue;
+        }
+        upper[i] = std::sqrt( dist2( pts.x[i], pts.y[i], pts.z[i], means.x[a], means.y[a], means.z[a] ) );
+        if( upper[i] <= bound ) {
+          continue;
+        }
+        int b = nearestMean( grid, pts.x[i], pts.y[i], pts.z[i], -1, d1, d2 );
+        upper[i] = std::sqrt(d1);
+        lower[i] = d2 == FLT_MAX ? FLT_MAX : std::sqrt(d2);
+        if( b != a ) {
+          labels[i] = b;
+          moves[t].push_back( std::make_pair( (int)i, a ) );
+        }
+      }
+    };
+    for(size_t t=1;t<nthreads;t++) {
+      pool.emplace_back( reassign, t );
+    }
+    reassign(0);
+    for(auto &thread : pool) {
+      thread.join();
+    }
+
+    size_t changed = 0;
+    for(const auto &list : moves) {
+      for(const auto &move : list) {
+        int i = move.first, from = move.second, to = labels[i];
+        sx[from] -= pts.x[i]; sy[from] -= pts.y[i]; sz[from] -= pts.z[i]; counts[from]--;
+        sx[to] += pts.x[i]; sy[to] += pts.y[i]; sz[to] += pts.z[i]; counts[to]++;
+      }
+      changed += list.size();
+    }
+    if( changed == 0 ) {
+      break; // the means would not move again
+    }
+  }
+}
+
+// Mini-batch k-means: each iteration moves the means toward a random sample of pixels, with a per-mean learning rate
+// of 1 / (pixels assigned to it so far); the labels come from a final full assignment
+static void miniBatch( const Points &pts, Points &means, int K, const KmeansParams &params, int threads, std::mt19937 &rng, int *labels ) {
+  size_t N = pts.x.size();
+  size_t B = std::min( (size_t)params.batchSize, N );
+  std::vector<size_t> batch(B);
+  std::vector<int> batchLabels(B);
+  std::vector<double> seen(K, 0);
+  MeanGrid grid;
+
+  for(int it=0;it<params.maxIterations;it++) {
+    for(size_t j=0;j<B;j++) {
+      batch[j] = rng() % N;
+    }
+    buildGrid( means, K, grid );
+    parallelFor( B, threads, [&](size_t begin, size_t end) {
+      float d1, d2;
+      for(size_t j=begin;j<end;j++) {
+        batchLabels[j] = nearestMean( grid, pts.x[batch[j]], pts.y[batch[j]], pts.z[batch[j]], -1, d1, d2 );
+      }
+    } );
+
+    for(size_t j=0;j<B;j++) {
+      int k = batchLabels[j];
+      float eta = (float)(1.0 / ++seen[k]);
+      means.x[k] += eta * (pts.x[batch[j]] - means.x[k]);
+      means.y[k] += eta * (pts.y[batch[j]] - means.y[k]);
+      means.z[k] += eta * (pts.z[batch[j]] - means.z[k]);
+    }
+  }
+
+  buildGrid( means, K, grid );
+  assignAll( pts, grid, threads, labels );
+}
+
+/*
+  data: a std::vector of pixels
+  means: a std:vector of means, will contain the cluster means when the function returns
+  labels: an allocated array of type int, the same size as the data, contains the labels when the function returns
+  K: the number of clusters
+  params: iteration limits, threads and mini-batch size, see KmeansParams
+
+  Executes K-means clustering on the data
+ */
+int kmeans( std::vector<cv::Vec3b> &data, std::vector<cv::Vec3b> &means, int *labels, int K, const KmeansParams &params ) {
+
+  // error checking
+  if( K < 1 || (size_t)K > data.size() ) {
+    printf("error: K must be between 1 and the number of data points\n");
+    return(-1);
+  }
+
+  size_t N = data.size();
+  Points pts;
+  pts.resize(N);
+  for(size_t j=0;j<N;j++) {
+    pts.x[j] = data[j][0];
+    pts.y[j] = data[j][1];
+    pts.z[j] = data[j][2];
+  }
+
+  int threads = params.threads > 0 ? params.threads : (int)std::max( 1u, std::thread::hardware_concurrency() );
+  std::mt19937 rng( params.seed ? params.seed : (unsigned int)rand() );
+
+  Points m;
+  seedMeans( pts, K, rng, m );
+  if( params.batchSize > 0 ) {
+    miniBatch( pts, m, K, params, threads, rng, labels );
+  }
+  else {
+    lloyd( pts, m, K, params, threads, labels );
   }
 
   // the labels and updated means are the final values
+  means.clear();
+  for(int k=0;k<K;k++) {
+    means.push_back( cv::Vec3b( cv::saturate_cast<uchar>(m.x[k]), cv::saturate_cast<uchar>(m.y[k]), cv::saturate_cast<uchar>(m.z[k]) ) );
+  }
 
   return(0);
 }
+
+/*
+  data: a std::vector of pixels
+  means: a std:vector of means, will contain the cluster means when the function returns
+  labels: an allocated array of type int, the same size as the data, contains the labels when the function returns
+  K: the number of clusters
+  maxIterations: maximum number of E-M interactions, default is 10
+  stopThresh: if the means change less than the threshold, the E-M loop terminates, default is 0
+
+  Executes K-means clustering on the data
+ */
+int kmeans( std::vector<cv::Vec3b> &data, std::vector<cv::Vec3b> &means, int *labels, int K, int maxIterations, int stopThresh ) {
+  KmeansParams params;
+  params.maxIterations = maxIterations;
+  params.stopThresh = stopThresh;
+  return( kmeans( data, means, labels, K, params ) );
+}
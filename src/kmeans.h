@@ -10,6 +10,25 @@
 
 #define SSD(a, b) ( ((int)a[0]-b[0])*(a[0]-b[0]) + (a[1]-b[1])*(a[1]-b[1]) + (a[2]-b[2])*(a[2]-b[2]) )
 
+/*
+  Options for kmeans()
+
+  maxIterations: maximum number of update steps, or of mini-batches when batchSize > 0
+  stopThresh: the E-M loop terminates once the squared movement of the means, summed, is at most this
+  threads: threads for the assignment steps, 0 uses every core
+  batchSize: if > 0, runs mini-batch k-means on this many sampled pixels per iteration instead of full passes
+  seed: seed for the k-means++ initialisation and the mini-batch sampling, 0 takes it from rand()
+ */
+struct KmeansParams {
+  int maxIterations = 10;
+  double stopThresh = 0;
+  int threads = 0;
+  int batchSize = 0;
+  unsigned int seed = 0;
+};
+
+int kmeans( std::vector<cv::Vec3b> &data, std::vector<cv::Vec3b> &means, int *labels, int K, const KmeansParams &params );
+
 int kmeans( std::vector<cv::Vec3b> &data, std::vector<cv::Vec3b> &means, int *labels, int K, int maxIterations=10, int stopThresh=0 );
 
 
@@ -0,0 +1,99 @@
+// mappedFile.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Read-only memory mapping of whole files, with a buffered fallback on platforms without mmap.
+
+#include "mappedFile.h"
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    unmapFile(*this);
+}
+
+int mapFile(const std::string& path, MappedFile& file) {
+    unmapFile(file);
+
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    file.size = static_cast<size_t>(st.st_size);
+    if (file.size == 0) {
+        // mmap rejects zero-length mappings; an empty file is still a valid (empty) view
+        close(fd);
+        return 0;
+    }
+
+    void* addr = mmap(nullptr, file.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        file.size = 0;
+        return -1;
+    }
+
+    file.data = static_cast<const char*>(addr);
+    file.mapped = true;
+    return 0;
+#else
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    file.buffer.resize(length > 0 ? static_cast<size_t>(length) : 0);
+    size_t got = file.buffer.empty() ? 0 : fread(file.buffer.data(), 1, file.buffer.size(), fp);
+    fclose(fp);
+    if (got != file.buffer.size()) {
+        file.buffer.clear();
+        return -1;
+    }
+
+    file.data = file.buffer.data();
+    file.size = file.buffer.size();
+    return 0;
+#endif
+}
+
+void unmapFile(MappedFile& file) {
+#ifndef _WIN32
+    if (file.mapped && file.data) {
+        munmap(const_cast<char*>(file.data), file.size);
+    }
+#endif
+    file.buffer.clear();
+    file.buffer.shrink_to_fit();
+    file.data = nullptr;
+    file.size = 0;
+    file.mapped = false;
+}
+
+void prefetchFile(const std::string& path) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
@@ -0,0 +1,37 @@
+// mappedFile.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for mappedFile.cpp, read-only memory mapping of whole files.
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A read-only view of a file's bytes. On POSIX systems the file is mmap'ed; elsewhere the
+// contents are read into an owned buffer so callers see the same interface either way.
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;       // true when data points into an mmap region
+    std::vector<char> buffer;  // owned copy used when mapping is unavailable
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+};
+
+// Maps the whole file at path. Returns 0 on success, -1 if the file cannot be opened or mapped.
+int mapFile(const std::string& path, MappedFile& file);
+
+// Releases the mapping (or buffer) held by file. Safe to call on an unmapped file.
+void unmapFile(MappedFile& file);
+
+// Asks the OS to start reading the whole file into the page cache and returns without waiting for it, so that a later
+// mapFile finds the bytes in memory. A no-op where read-ahead advice is unavailable or the file cannot be opened.
+void prefetchFile(const std::string& path);
+
+#endif
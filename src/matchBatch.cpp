@@ -0,0 +1,218 @@
+// matchBatch.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Matches a whole batch of target images against a feature index in one run. Targets come from a directory or
+//          from a list file with one path per line, and are scored together in one cache-blocked pass. All results go
+//          to a single output file, one line per match: target,rank,match,score. Targets that have to be extracted
+//          can be read from an image cache (--image-cache) built by readImages at the same decode scale.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "batchScoring.h"
+#include "featureExtraction.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "imageCache.h"
+#include "indexPipeline.h"
+#include "topK.h"
+#include "trace.h"
+
+// Reads the targets from a directory, or one path (or indexed filename) per line from a list file
+static int readTargets(const std::string& source, std::vector<std::string>& targets) {
+    if (std::filesystem::is_directory(source)) {
+        return scanDirectory(source, targets);
+    }
+    std::ifstream file(source);
+    if (!file) {
+        std::cerr << "Failed to open target list " << source << "\n";
+        return -1;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            targets.push_back(line);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 6) {
+        std::cerr << "Usage: " << argv[0] << " <targets_directory|targets_list> <feature_vectors_file> <feature_type> <top_n_matches> <output_file> [--metric name] [--threads N] [--scale 1|2|4|8] [--image-cache cache_file] [--trace trace.json]\n";
+        std::cerr << "       the metric defaults to the one matchImages uses for the feature type\n";
+        std::cerr << "       targets are decoded at the index's recorded scale unless --scale is given\n";
+        std::cerr << "       --image-cache reads unchanged targets from, and adds new ones to, a readImages image cache\n";
+        std::cerr << "       --trace writes per-stage spans as Chrome trace JSON plus a metrics summary\n";
+        return -1;
+    }
+
+    std::string targetSource = argv[1], featureVectorsFile = argv[2], featureType = argv[3], outputFile = argv[5];
+    int topN = std::stoi(argv[4]);
+    std::string metricName;
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    int decodeScale = 0;
+    std::string traceFile, imageCacheFile;
+    for (int i = 6; i < argc; ++i) {
+        if (strcmp(argv[i], "--metric") == 0 && i + 1 < argc) {
+            metricName = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            if (parseDecodeScale(argv[++i], decodeScale) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--image-cache") == 0 && i + 1 < argc) {
+            imageCacheFile = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return -1;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (!traceFile.empty()) {
+        startTracing();
+    }
+
+    // Feature types readImages cannot extract (e.g. deep network embeddings) are matched by indexed filename only
+    const FeatureMethod* method = findFeatureMethod(featureType);
+    if (metricName.empty()) {
+        if (!method) {
+            std::cerr << "Feature type " << featureType << " has no default metric, use --metric\n";
+            return -1;
+        }
+        metricName = method->defaultMetric;
+    }
+    const MatchMetric* metric = findMatchMetric(metricName);
+    if (!metric) {
+        std::cerr << "Unknown metric " << metricName << "\n";
+        return -1;
+    }
+
+    FeatureStore store;
+    if (openFeatureStore(featureVectorsFile, store) != 0) {
+        return -1;
+    }
+    if (!store.featureType.empty() && store.featureType != featureType) {
+        std::cerr << "Feature file " << featureVectorsFile << " holds " << store.featureType << " features, not " << featureType << "\n";
+        return -1;
+    }
+    if (decodeScale == 0) {
+        decodeScale = store.decodeScale > 0 ? static_cast<int>(store.decodeScale) : 1;
+    }
+
+    ImageCache imageCache;
+    if (!imageCacheFile.empty() && openImageCache(imageCacheFile, decodeScale, imageCache) != 0) {
+        return -1;
+    }
+
+    std::vector<std::string> targets;
+    if (readTargets(targetSource, targets) != 0) {
+        return -1;
+    }
+    std::unordered_map<std::string, uint32_t> rows;
+    rows.reserve(store.count);
+    for (size_t i = 0; i < store.count; ++i) {
+        rows.emplace(store.filename(i), static_cast<uint32_t>(i));
+    }
+
+    // Gather the query vectors: indexed images reuse their stored row, others are decoded and extracted in parallel
+    std::vector<std::string> queryNames;
+    std::vector<uint32_t> excludeIds;
+    std::vector<float> queries;
+    std::vector<uint32_t> selfRows(targets.size(), TopKSelector::NO_EXCLUDE); // each worker writes only its own slot
+    auto extract = [&](IndexResult& result) {
+        result.features.resize(1);
+        auto row = rows.find(std::filesystem::path(result.path).filename().string());
+        if (row != rows.end()) {
+            selfRows[result.seq] = row->second;
+            result.features[0].assign(store.row(row->second), store.row(row->second) + store.dim);
+            return true;
+        }
+        if (!method || !method->extract) {
+            return false;
+        }
+        cv::Mat image = imageCacheFile.empty() ? readImage(result.path, decodeScale) : readCachedImage(imageCache, result.path);
+        if (image.empty()) {
+            return false;
+        }
+        TRACE_SCOPE("extract");
+        PreparedImage prepared(image);
+        result.features[0] = method->extract(prepared);
+        return true;
+    };
+    auto collect = [&](const IndexResult& result) {
+        if (!result.ok) {
+            std::cerr << "Skipping target " << result.path << ": not in the index and not a readable image\n";
+            return 0;
+        }
+        if (result.features[0].size() != store.dim) {
+            std::cerr << "Target " << result.path << " has " << result.features[0].size() << " values, expected " << store.dim << "\n";
+            return -1;
+        }
+        queryNames.push_back(std::filesystem::path(result.path).filename().string());
+        excludeIds.push_back(selfRows[result.seq]);
+        queries.insert(queries.end(), result.features[0].begin(), result.features[0].end());
+        return 0;
+    };
+    if (threads > 1) {
+        cv::setNumThreads(1);
+    }
+    // Indexed targets are never read, and cached ones are read from the cache, so only the rest are read ahead
+    auto prefetch = [&](const std::string& path) {
+        if (rows.count(std::filesystem::path(path).filename().string()) != 0) {
+            return;
+        }
+        if (imageCacheFile.empty()) {
+            prefetchFile(path);
+        } else {
+            prefetchUncachedImage(imageCache, path);
+        }
+    };
+    int status = runIndexPipeline(targets, threads, extract, collect, prefetch);
+    if (!imageCacheFile.empty() && closeImageCache(imageCache) != 0) {
+        status = -1;
+    }
+    if (status != 0) {
+        return -1;
+    }
+
+    std::vector<std::vector<ScoredId>> results;
+    scoreQueryBatch(queries.data(), queryNames.size(), excludeIds, store, *metric, topN > 0 ? topN : 0, threads, results);
+
+    FILE* fp = fopen(outputFile.c_str(), "w");
+    if (!fp) {
+        std::cerr << "Unable to open output file " << outputFile << "\n";
+        return -1;
+    }
+    for (size_t q = 0; q < results.size(); ++q) {
+        for (size_t i = 0; i < results[q].size(); ++i) {
+            fprintf(fp, "%s,%zu,%s,%g\n", queryNames[q].c_str(), i + 1, store.filename(results[q][i].id), results[q][i].score);
+        }
+    }
+    if (fclose(fp) != 0) {
+        std::cerr << "Error writing " << outputFile << "\n";
+        return -1;
+    }
+
+    std::cout << "Matched " << queryNames.size() << " targets against " << store.count << " images with " << metric->name << " into " << outputFile << "\n";
+    if (!traceFile.empty() && writeTrace(traceFile) != 0) {
+        return -1;
+    }
+    return 0;
+}
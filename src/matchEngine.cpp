@@ -0,0 +1,119 @@
+// matchEngine.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Exact top-N matching of one query against a feature index.
+//
+// Rows are scored a block at a time into a small buffer with scanRows, which works on four rows per pass and whose
+// loop trip count is a compile-time constant for the registry's dimensions, and the buffer is then fed to the top-K
+// selector. Quantized histogram indexes are scanned on their integer codes with the query quantized the same way.
+
+#include "matchEngine.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include "distanceKernels.h"
+#include "trace.h"
+
+#define MATCH_ROW_BLOCK 256   // rows scored per scanRows call; the score buffer stays in L1
+
+int prepareMatchQuery(const FeatureStore& store, const MatchMetric& metric, const float* query, MatchQuery& prepared) {
+    prepared.values = query;
+    prepared.norm = metric.needsNorms ? l2Norm(query, store.dim) : 0.0f;
+    prepared.codes.clear();
+    if (store.data) {
+        return 0;
+    }
+
+    if (metric.scan != ROW_SCAN_INTERSECTION) {
+        printf("Quantized features are only scored with histogram intersection, not %s\n", metric.name);
+        return -1;
+    }
+    prepared.codes.resize(store.dim);
+    if (quantizeFeatureRow(query, store.dim, static_cast<FeatureDType>(store.dtype), prepared.codes.data()) != 0) {
+        printf("Target features cannot be quantized\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Integer intersection of the query codes with one quantized row, scaled back to the float range
+static float scoreQuantizedRow(const FeatureStore& store, const MatchQuery& query, size_t row) {
+    const float inverseScale = 1.0f / static_cast<float>(store.quantScale);
+    if (store.dtype == FEATURE_DTYPE_U8) {
+        return histogramIntersectionU8(reinterpret_cast<const uint8_t*>(query.codes.data()), store.rowU8(row), store.dim) * inverseScale;
+    }
+    return histogramIntersectionU16(query.codes.data(), store.rowU16(row), store.dim) * inverseScale;
+}
+
+void scoreMatchRows(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query, size_t first, size_t count, float* scores) {
+    if (store.data) {
+        scanRows(metric.scan, query.values, query.norm, store.row(first), count, store.dim, scores);
+        return;
+    }
+    for (size_t r = 0; r < count; ++r) {
+        scores[r] = scoreQuantizedRow(store, query, first + r);
+    }
+}
+
+float scoreMatchRow(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query, size_t row) {
+    float score;
+    scoreMatchRows(store, metric, query, row, 1, &score);
+    return score;
+}
+
+std::vector<ScoredId> findBestMatches(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query, size_t k,
+                                      uint32_t excludeId) {
+    TopKSelector best(k, metric.largerIsBetter, excludeId);
+    {
+        // Scoring and the top-K heap are interleaved block by block, so this span covers both
+        TRACE_SCOPE("score");
+        float scores[MATCH_ROW_BLOCK];
+        for (size_t r0 = 0; r0 < store.count; r0 += MATCH_ROW_BLOCK) {
+            size_t nr = std::min<size_t>(MATCH_ROW_BLOCK, store.count - r0);
+            scoreMatchRows(store, metric, query, r0, nr, scores);
+            for (size_t r = 0; r < nr; ++r) {
+                best.push(scores[r], static_cast<uint32_t>(r0 + r));
+            }
+        }
+    }
+    TRACE_SCOPE("select");
+    return best.results();
+}
+
+std::vector<ScoredId> rerankMatches(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query,
+                                    const std::vector<ScoredId>& candidates, const std::vector<int32_t>& rowOf, size_t k) {
+    TRACE_SCOPE("rerank");
+    TopKSelector best(k, metric.largerIsBetter);
+    for (const ScoredId& candidate : candidates) {
+        long row = rowOf.empty() ? static_cast<long>(candidate.id) : rowOf[candidate.id];
+        if (row >= 0) {
+            best.push(scoreMatchRow(store, metric, query, static_cast<size_t>(row)), candidate.id);
+        }
+    }
+    return best.results();
+}
+
+std::vector<int32_t> mapStoreRows(const FeatureStore& from, const FeatureStore& to) {
+    std::vector<int32_t> rowOf;
+    bool aligned = from.count == to.count;
+    for (size_t i = 0; aligned && i < from.count; ++i) {
+        aligned = strcmp(from.filename(i), to.filename(i)) == 0;
+    }
+    if (aligned) {
+        return rowOf;
+    }
+
+    std::unordered_map<std::string_view, int32_t> rows;
+    rows.reserve(to.count);
+    for (size_t i = 0; i < to.count; ++i) {
+        rows.emplace(to.filename(i), static_cast<int32_t>(i));
+    }
+    rowOf.resize(from.count);
+    for (size_t i = 0; i < from.count; ++i) {
+        auto it = rows.find(from.filename(i));
+        rowOf[i] = it == rows.end() ? -1 : it->second;
+    }
+    return rowOf;
+}
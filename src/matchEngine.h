@@ -0,0 +1,50 @@
+// matchEngine.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for matchEngine.cpp, exact top-N matching of one query vector against a feature index. It is
+//          the one hot path behind matchImages and matchServer: every feature type and metric is scored with the
+//          row scans of distanceKernels, which are specialized for the registry's fixed dimensions. Cascades re-rank the
+//          candidates of a cheap index's scan with a more expensive one through rerankMatches.
+
+#ifndef MATCH_ENGINE_H
+#define MATCH_ENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "topK.h"
+
+// A query vector prepared once for scoring against one feature index
+struct MatchQuery {
+    const float* values = nullptr;   // store.dim values, not owned
+    float norm = 0.0f;               // L2 norm, for the cosine metric
+    std::vector<uint16_t> codes;     // fixed-point codes, when the index is quantized and was opened without decoding
+};
+
+// Prepares query for scoring against store with metric. Quantized indexes opened without decoding are scored on their
+// integer codes, which only histogram intersection supports. Returns -1 (after printing why) if they cannot be scored.
+int prepareMatchQuery(const FeatureStore& store, const MatchMetric& metric, const float* query, MatchQuery& prepared);
+
+// Scores the count rows starting at first into scores, the values findBestMatches ranks those rows by
+void scoreMatchRows(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query, size_t first, size_t count, float* scores);
+
+// Score of one row, the same value findBestMatches ranks that row by
+float scoreMatchRow(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query, size_t row);
+
+// The k best rows of store, best first. excludeId, if given, is left out, as the target's own row is.
+std::vector<ScoredId> findBestMatches(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query, size_t k,
+                                      uint32_t excludeId = TopKSelector::NO_EXCLUDE);
+
+// Re-ranks candidates, the ids of rows of another index, by their rows in store and keeps the k best, best first.
+// rowOf maps a candidate id to its row in store (see mapStoreRows), or is empty if the ids are rows of store already;
+// candidates missing from store are dropped. The results keep the candidates' ids.
+std::vector<ScoredId> rerankMatches(const FeatureStore& store, const MatchMetric& metric, const MatchQuery& query,
+                                    const std::vector<ScoredId>& candidates, const std::vector<int32_t>& rowOf, size_t k);
+
+// The row of to holding each row of from, matched by filename, or -1 where to lacks the image. Returns an empty vector
+// when both indexes list the same images in the same order, the usual case for indexes built from one directory.
+std::vector<int32_t> mapStoreRows(const FeatureStore& from, const FeatureStore& to);
+
+#endif
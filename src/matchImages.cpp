@@ -0,0 +1,369 @@
+// matchImages.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Matches a target image against a feature index and prints its top N matches. The feature type selects the
+//          extractor, the default metric and the expected dimension from the feature registry, so one tool covers
+//          every feature set readImages builds; deep network embeddings, which are computed outside this project,
+//          are matched by the target's indexed filename and can also be searched with an HNSW graph or quantized codes.
+//          A cascade (--prefilter) scans a cheap feature index first and re-ranks only its best candidates with the
+//          expensive one. A cellGrid index can be matched on any rectangle of its cells (--region), summed from the
+//          stored cells without touching the images.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "featureExtraction.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "hnswIndex.h"
+#include "matchEngine.h"
+#include "quantizedIndex.h"
+#include "topK.h"
+#include "trace.h"
+
+// One --prefilter stage of a cascade: a cheaper feature index whose best `keep` rows go on to the next stage
+struct PrefilterStage {
+    const FeatureMethod* method = nullptr;
+    const MatchMetric* metric = nullptr;
+    std::string indexPath;
+    size_t keep = 0;
+    FeatureStore store;
+    std::vector<int32_t> rowOf;   // this stage's row of each first-stage row, empty if they line up
+    std::vector<float> features;
+    MatchQuery query;
+};
+
+// Parses "feature_type,index,M[,metric]"
+static int parsePrefilter(const std::string& spec, PrefilterStage& stage) {
+    std::vector<std::string> fields;
+    std::stringstream ss(spec);
+    std::string field;
+    while (std::getline(ss, field, ',')) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 3 || fields.size() > 4) {
+        std::cerr << "--prefilter takes feature_type,index,M[,metric], not " << spec << "\n";
+        return -1;
+    }
+    stage.method = findFeatureMethod(fields[0]);
+    if (!stage.method) {
+        std::cerr << "Unknown feature type " << fields[0] << "\n";
+        return -1;
+    }
+    stage.metric = findMatchMetric(fields.size() == 4 ? fields[3] : stage.method->defaultMetric);
+    if (!stage.metric) {
+        std::cerr << "Unknown metric " << fields[3] << "\n";
+        return -1;
+    }
+    stage.indexPath = fields[1];
+    int keep = std::stoi(fields[2]);
+    if (keep < 1) {
+        std::cerr << "--prefilter must keep at least one candidate\n";
+        return -1;
+    }
+    stage.keep = static_cast<size_t>(keep);
+    return 0;
+}
+
+// Checks that an opened index holds method's features
+static int checkIndex(const FeatureStore& store, const std::string& path, const FeatureMethod& method) {
+    if (!store.featureType.empty() && store.featureType != method.name) {
+        std::cerr << "Feature file " << path << " holds " << store.featureType << " features, not " << method.name << "\n";
+        return -1;
+    }
+    if (method.extract && store.dim != method.dim) {
+        std::cerr << "Feature file " << path << " has " << store.dim << " values per image, expected " << method.dim << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+// The target's features for method: extracted from the image, decoded at the scale the index was built at unless
+// decodeScale is given, or for methods without an extractor the target's own row of the index
+static int loadTargetFeatures(const std::string& path, const FeatureMethod& method, const FeatureStore& store, int decodeScale,
+                          std::vector<float>& features) {
+    if (method.extract) {
+        if (decodeScale == 0) {
+            decodeScale = store.decodeScale > 0 ? static_cast<int>(store.decodeScale) : 1;
+        }
+        cv::Mat targetImage = readImage(path, decodeScale);
+        if (targetImage.empty()) {
+            std::cerr << "Failed to open target image " << path << "\n";
+            return -1;
+        }
+        TRACE_SCOPE("extract");
+        PreparedImage prepared(targetImage);
+        features = method.extract(prepared);
+        return 0;
+    }
+    long row = store.find(std::filesystem::path(path).filename().string());
+    if (row >= 0 && store.data) {
+        features.assign(store.row(row), store.row(row) + store.dim);
+        return 0;
+    }
+    std::cerr << "Target image features not found in the file.\n";
+    return -1;
+}
+
+// Parses --region row0,col0,row1,col1[,surround]: cells [row0, row1) x [col0, col1) of the cellGrid grid, or all
+// other cells with surround
+static int parseRegion(const std::string& spec, CellRegion& region) {
+    std::stringstream ss(spec);
+    std::string field;
+    std::vector<std::string> fields;
+    while (std::getline(ss, field, ',')) {
+        fields.push_back(field);
+    }
+    region.surround = fields.size() == 5 && fields[4] == "surround";
+    if ((fields.size() != 4 && !region.surround) ||
+        sscanf(spec.c_str(), "%d,%d,%d,%d", &region.row0, &region.col0, &region.row1, &region.col1) != 4 ||
+        region.row0 < 0 || region.col0 < 0 || region.row1 > CELL_GRID_SIZE || region.col1 > CELL_GRID_SIZE ||
+        region.row0 >= region.row1 || region.col0 >= region.col1) {
+        std::cerr << "--region takes row0,col0,row1,col1[,surround] with 0 <= row0 < row1 <= " << CELL_GRID_SIZE
+                  << " and likewise for the columns, not " << spec << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+// An in-memory index of every image's region histograms, computed from a cellGrid index; the filenames stay in cells
+static void projectCellGridRegion(const FeatureStore& cells, const CellRegion& region, FeatureStore& out) {
+    TRACE_SCOPE("region");
+    out.featureType = cells.featureType;
+    out.decodeScale = cells.decodeScale;
+    out.dim = 3 * CELL_GRID_BINS;
+    out.count = cells.count;
+    out.ownedData.reserve(out.count * out.dim);
+    for (size_t i = 0; i < cells.count; ++i) {
+        std::vector<float> hist = cellGridRegion(cells.row(i), region);
+        out.ownedData.insert(out.ownedData.end(), hist.begin(), hist.end());
+    }
+    out.data = out.ownedData.data();
+    out.nameOffsets = cells.nameOffsets;
+    out.names = cells.names;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " <target_image> <feature_vectors_file> <feature_type> <top_n_matches> [--metric name] [--scale 1|2|4|8]\n";
+        std::cerr << "       [--hnsw graph_file] [--ef N] [--quantized code_file] [--rerank N] [--prefilter feature_type,index,M[,metric]]\n";
+        std::cerr << "       [--region row0,col0,row1,col1[,surround]] [--recall] [--trace trace.json]\n";
+        std::cerr << "       the metric defaults to the feature type's own; the target is decoded at the scale recorded in the\n";
+        std::cerr << "       index unless --scale is given. Feature types that are not extracted from images (deepNetwork)\n";
+        std::cerr << "       take the target's indexed filename. --hnsw searches the graph built by buildHnsw and --quantized\n";
+        std::cerr << "       scans the codes built by buildQuantizer, re-ranking the best --rerank of them exactly; both rank by\n";
+        std::cerr << "       cosine distance. --prefilter scans another feature's index first and re-ranks only its best M rows;\n";
+        std::cerr << "       repeat it for more stages, cheapest first, each keeping fewer rows. --recall also runs the exact scan\n";
+        std::cerr << "       and reports recall@N and both latencies. --region matches a cellGrid index on that rectangle of its\n";
+        std::cerr << "       " << CELL_GRID_SIZE << "x" << CELL_GRID_SIZE << " cells only, or with surround on all the others. --trace writes per-stage spans as\n";
+        std::cerr << "       Chrome trace JSON plus a metrics summary\n";
+        return -1;
+    }
+
+    std::string targetImagePath = argv[1];
+    std::string featureVectorsFile = argv[2];
+    std::string featureType = argv[3];
+    int topN = std::stoi(argv[4]);
+    std::string metricName, graphFile, codeFile, traceFile;
+    int decodeScale = 0;
+    size_t efSearch = 100, rerank = 100;
+    bool reportRecall = false;
+    bool useRegion = false;
+    CellRegion region{};
+    std::vector<std::unique_ptr<PrefilterStage>> prefilters;
+    for (int i = 5; i < argc; ++i) {
+        if (strcmp(argv[i], "--metric") == 0 && i + 1 < argc) {
+            metricName = argv[++i];
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            if (parseDecodeScale(argv[++i], decodeScale) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--hnsw") == 0 && i + 1 < argc) {
+            graphFile = argv[++i];
+        } else if (strcmp(argv[i], "--ef") == 0 && i + 1 < argc) {
+            efSearch = static_cast<size_t>(std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--quantized") == 0 && i + 1 < argc) {
+            codeFile = argv[++i];
+        } else if (strcmp(argv[i], "--rerank") == 0 && i + 1 < argc) {
+            rerank = static_cast<size_t>(std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--prefilter") == 0 && i + 1 < argc) {
+            prefilters.emplace_back(new PrefilterStage());
+            if (parsePrefilter(argv[++i], *prefilters.back()) != 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--region") == 0 && i + 1 < argc) {
+            if (parseRegion(argv[++i], region) != 0) {
+                return -1;
+            }
+            useRegion = true;
+        } else if (strcmp(argv[i], "--recall") == 0) {
+            reportRecall = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return -1;
+        }
+    }
+    size_t n = topN > 0 ? static_cast<size_t>(topN) : 0;
+    if (!traceFile.empty()) {
+        startTracing();
+    }
+    bool approximate = !graphFile.empty() || !codeFile.empty();
+
+    const FeatureMethod* method = findFeatureMethod(featureType);
+    if (!method) {
+        std::cerr << "Unknown feature type " << featureType << "\n";
+        return -1;
+    }
+    if (metricName.empty()) {
+        metricName = method->defaultMetric;
+    }
+    const MatchMetric* metric = findMatchMetric(metricName);
+    if (!metric) {
+        std::cerr << "Unknown metric " << metricName << "\n";
+        return -1;
+    }
+    if (!graphFile.empty() + !codeFile.empty() + !prefilters.empty() > 1) {
+        std::cerr << "Use only one of --hnsw, --quantized and --prefilter\n";
+        return -1;
+    }
+    if (useRegion && (method->name != std::string("cellGrid") || approximate || !prefilters.empty())) {
+        std::cerr << "--region needs a cellGrid index and an exact scan\n";
+        return -1;
+    }
+    if (approximate && metric->scan != ROW_SCAN_COSINE) {
+        std::cerr << "--hnsw and --quantized rank by cosine distance, not " << metric->name << "\n";
+        return -1;
+    }
+
+    // Quantized histogram indexes are intersected on their integer codes; every other metric, and summing regions of
+    // cells, needs the float rows
+    FeatureStore indexStore;
+    if (openFeatureStore(featureVectorsFile, indexStore, metric->scan != ROW_SCAN_INTERSECTION || approximate || useRegion) != 0) {
+        return -1;
+    }
+    if (checkIndex(indexStore, featureVectorsFile, *method) != 0) {
+        return -1;
+    }
+
+    std::vector<float> targetFeatures;
+    if (loadTargetFeatures(targetImagePath, *method, indexStore, decodeScale, targetFeatures) != 0) {
+        return -1;
+    }
+    FeatureStore regionStore;
+    if (useRegion) {
+        projectCellGridRegion(indexStore, region, regionStore);
+        targetFeatures = cellGridRegion(targetFeatures.data(), region);
+    }
+    const FeatureStore& store = useRegion ? regionStore : indexStore;
+
+    std::string targetFilename = std::filesystem::path(targetImagePath).filename().string();
+    long selfIndex = store.find(targetFilename);
+
+    // Each cascade stage has its own index, metric and target features; candidates are tracked as first-stage rows
+    for (size_t s = 0; s < prefilters.size(); ++s) {
+        PrefilterStage& stage = *prefilters[s];
+        if (openFeatureStore(stage.indexPath, stage.store, stage.metric->scan != ROW_SCAN_INTERSECTION) != 0 ||
+            checkIndex(stage.store, stage.indexPath, *stage.method) != 0 ||
+            loadTargetFeatures(targetImagePath, *stage.method, stage.store, decodeScale, stage.features) != 0 ||
+            prepareMatchQuery(stage.store, *stage.metric, stage.features.data(), stage.query) != 0) {
+            return -1;
+        }
+        if (s > 0) {
+            stage.rowOf = mapStoreRows(prefilters[0]->store, stage.store);
+        }
+    }
+    std::vector<int32_t> finalRowOf;
+    if (!prefilters.empty()) {
+        finalRowOf = mapStoreRows(prefilters[0]->store, store);
+    }
+
+    MatchQuery query;
+    if (prepareMatchQuery(store, *metric, targetFeatures.data(), query) != 0) {
+        return -1;
+    }
+
+    // Scores are labelled as the per-method tools always labelled them, unless another metric was asked for
+    const char* scoreName = method->scoreName && metric == findMatchMetric(method->defaultMetric) ? method->scoreName : metric->scoreName;
+
+    // Print the match with itself without counting it in the top N. Methods without an extractor take the target's
+    // own row as its features, so there is nothing to report for them.
+    if (selfIndex >= 0 && method->extract) {
+        std::cout << "Match with itself: " << store.filename(selfIndex) << " with " << scoreName << " "
+                  << scoreMatchRow(store, *metric, query, static_cast<size_t>(selfIndex)) << "\n";
+    }
+    uint32_t excludeId = selfIndex >= 0 ? static_cast<uint32_t>(selfIndex) : TopKSelector::NO_EXCLUDE;
+
+    std::vector<ScoredId> matches;
+    auto start = std::chrono::steady_clock::now();
+    if (!codeFile.empty()) {
+        QuantizedIndex codes;
+        if (openQuantizedIndex(codeFile, store, codes) != 0) {
+            return -1;
+        }
+        start = std::chrono::steady_clock::now();
+        matches = searchQuantizedIndex(codes, store, query.values, n, rerank, excludeId);
+    } else if (!graphFile.empty()) {
+        HnswIndex graph;
+        if (openHnswIndex(graphFile, store, graph) != 0) {
+            return -1;
+        }
+        start = std::chrono::steady_clock::now();
+        matches = searchHnswIndex(graph, store, query.values, n, efSearch, excludeId);
+    } else if (!prefilters.empty()) {
+        PrefilterStage& first = *prefilters[0];
+        long firstSelf = first.store.find(targetFilename);
+        matches = findBestMatches(first.store, *first.metric, first.query, first.keep,
+                                  firstSelf >= 0 ? static_cast<uint32_t>(firstSelf) : TopKSelector::NO_EXCLUDE);
+        for (size_t s = 1; s < prefilters.size(); ++s) {
+            PrefilterStage& stage = *prefilters[s];
+            matches = rerankMatches(stage.store, *stage.metric, stage.query, matches, stage.rowOf, stage.keep);
+        }
+        matches = rerankMatches(store, *metric, query, matches, finalRowOf, n);
+        for (ScoredId& match : matches) {
+            match.id = finalRowOf.empty() ? match.id : static_cast<uint32_t>(finalRowOf[match.id]);
+        }
+    } else {
+        matches = findBestMatches(store, *metric, query, n, excludeId);
+    }
+    double searchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Output the top N matches
+    for (size_t i = 0; i < matches.size(); ++i) {
+        std::cout << "Match " << i + 1 << ": " << store.filename(matches[i].id) << " with " << scoreName << " " << matches[i].score << "\n";
+    }
+
+    if (reportRecall && (approximate || !prefilters.empty())) {
+        start = std::chrono::steady_clock::now();
+        std::vector<ScoredId> exact = findBestMatches(store, *metric, query, n, excludeId);
+        double exactSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::unordered_set<uint32_t> found;
+        for (const ScoredId& match : matches) {
+            found.insert(match.id);
+        }
+        size_t hits = 0;
+        for (const ScoredId& match : exact) {
+            hits += found.count(match.id);
+        }
+        const char* mode = !prefilters.empty() ? "cascade " : graphFile.empty() ? "quantized " : "HNSW ";
+        std::cout << "Recall@" << n << ": " << (exact.empty() ? 1.0 : static_cast<double>(hits) / exact.size()) << " (" << mode
+                  << searchSeconds * 1e3 << " ms, exact scan " << exactSeconds * 1e3 << " ms, " << (exactSeconds - searchSeconds) * 1e3
+                  << " ms saved)\n";
+    }
+
+    if (!traceFile.empty() && writeTrace(traceFile) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,372 @@
+// matchServer.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Long-running match server. Loads one or more feature indexes once and answers top-N queries from local
+//          clients over a Unix domain socket, so a lookup no longer pays for starting a process and reloading the index.
+//
+// Protocol: one request per line, one response per request, on the same connection for as long as the client likes.
+//   QUERY <feature_type> <metric|default> <N> <target>
+//       target is the filename of an indexed image, or the path of an image file to extract features from.
+//       Responds "OK <n>" followed by n lines "<score> <filename>", best match first; the target's own row is left out.
+//   LIST
+//       Responds "OK <n>" followed by one line "<feature_type> <dim> <count>" per loaded index.
+//   QUIT
+//       Closes the connection.
+// A connection that sends nothing for --idle-timeout seconds (IDLE_TIMEOUT_SECONDS, 30, by default) is closed, so idle
+// clients cannot hold every worker and leave new connections waiting in the queue.
+// Errors are reported as a single "ERR <message>" line. For example:  printf 'QUERY baseline ssd 3 pic.0164.jpg\n' | nc -U /tmp/match.sock
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "opencv2/opencv.hpp"
+#include "boundedQueue.h"
+#include "featureExtraction.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "matchEngine.h"
+#include "topK.h"
+
+#define MAX_REQUEST_LINE 4096
+#define IDLE_TIMEOUT_SECONDS 30
+
+// One resident feature index
+struct ServedIndex {
+    std::string featureType;
+    const FeatureMethod* method = nullptr; // nullptr for feature types missing from the registry
+    FeatureStore store;   // with its names indexed, so targets are found by a hash lookup
+};
+
+static char socketPathForSignal[sizeof(sockaddr_un::sun_path)];
+
+static void removeSocketAndExit(int) {
+    unlink(socketPathForSignal);
+    _exit(0);
+}
+
+// Loads "<feature_type>=<file>", or "<file>" with the type taken from the store header or else the file name
+static int loadIndex(const std::string& spec, ServedIndex& index) {
+    std::string path = spec;
+    size_t eq = spec.find('=');
+    if (eq != std::string::npos) {
+        index.featureType = spec.substr(0, eq);
+        path = spec.substr(eq + 1);
+    }
+    if (openFeatureStore(path, index.store) != 0) {
+        return -1;
+    }
+    if (index.featureType.empty()) {
+        index.featureType = !index.store.featureType.empty() ? index.store.featureType : std::filesystem::path(path).stem().string();
+    }
+    index.method = findFeatureMethod(index.featureType);
+
+    index.store.indexNames();
+
+    std::cout << "Loaded " << index.store.count << " " << index.featureType << " vectors of " << index.store.dim << " values from " << path << "\n";
+    return 0;
+}
+
+static const ServedIndex* findIndex(const std::vector<std::unique_ptr<ServedIndex>>& indexes, const std::string& featureType) {
+    for (const auto& index : indexes) {
+        if (index->featureType == featureType) {
+            return index.get();
+        }
+    }
+    return nullptr;
+}
+
+// Answers one QUERY line, appending the response to out
+static void answerQuery(const std::vector<std::unique_ptr<ServedIndex>>& indexes, std::istringstream& request, std::string& out) {
+    std::string featureType, metricName, target;
+    long topN = 0;
+    if (!(request >> featureType >> metricName >> topN) || topN < 0) {
+        out += "ERR usage: QUERY <feature_type> <metric|default> <N> <target>\n";
+        return;
+    }
+    std::getline(request >> std::ws, target);
+    if (target.empty()) {
+        out += "ERR missing target\n";
+        return;
+    }
+
+    const ServedIndex* index = findIndex(indexes, featureType);
+    if (!index) {
+        out += "ERR no index loaded for feature type " + featureType + "\n";
+        return;
+    }
+    if (metricName == "default") {
+        if (!index->method) {
+            out += "ERR feature type " + featureType + " has no default metric\n";
+            return;
+        }
+        metricName = index->method->defaultMetric;
+    }
+    const MatchMetric* metric = findMatchMetric(metricName);
+    if (!metric) {
+        out += "ERR unknown metric " + metricName + "\n";
+        return;
+    }
+
+    // An indexed image is scored from its stored row; anything else must be an image file we can extract from
+    const float* targetFeatures = nullptr;
+    uint32_t selfRow = TopKSelector::NO_EXCLUDE;
+    std::vector<float> extracted;
+    long row = index->store.find(std::filesystem::path(target).filename().string());
+    if (row >= 0) {
+        selfRow = static_cast<uint32_t>(row);
+        targetFeatures = index->store.row(selfRow);
+    } else {
+        if (!index->method || !index->method->extract) {
+            out += "ERR " + target + " is not in the " + featureType + " index\n";
+            return;
+        }
+        // Decode at the scale the index was built at, so the target's features are comparable with its rows
+        cv::Mat image = readImage(target, index->store.decodeScale > 0 ? static_cast<int>(index->store.decodeScale) : 1);
+        if (image.empty()) {
+            out += "ERR failed to load target image " + target + "\n";
+            return;
+        }
+        PreparedImage prepared(image);
+        extracted = index->method->extract(prepared);
+        if (extracted.size() != index->store.dim) {
+            out += "ERR target has " + std::to_string(extracted.size()) + " values, index has " + std::to_string(index->store.dim) + "\n";
+            return;
+        }
+        targetFeatures = extracted.data();
+    }
+
+    // No more matches than rows can be returned, so a larger N is clamped rather than sized for
+    const FeatureStore& store = index->store;
+    size_t count = std::min(static_cast<size_t>(topN), store.count);
+    MatchQuery query;
+    if (prepareMatchQuery(store, *metric, targetFeatures, query) != 0) {
+        out += "ERR cannot score the " + featureType + " index with " + metricName + "\n";
+        return;
+    }
+    std::vector<ScoredId> matches = findBestMatches(store, *metric, query, count, selfRow);
+    out += "OK " + std::to_string(matches.size()) + "\n";
+    char score[32];
+    for (const ScoredId& match : matches) {
+        snprintf(score, sizeof(score), "%g ", match.score);
+        out += score;
+        out += store.filename(match.id);
+        out += "\n";
+    }
+}
+
+// Handles one request line. Returns false if the client asked to close the connection.
+static bool handleRequest(const std::vector<std::unique_ptr<ServedIndex>>& indexes, const std::string& line, std::string& out) {
+    std::istringstream request(line);
+    std::string command;
+    request >> command;
+    if (command == "QUERY") {
+        // A request that makes OpenCV or the allocator throw (e.g. a target image too small for its extractor) fails on
+        // its own instead of terminating the server; only the lines of its own reply are dropped
+        size_t replyStart = out.size();
+        try {
+            answerQuery(indexes, request, out);
+        } catch (const std::exception& e) {
+            out.resize(replyStart);
+            std::string what = e.what();
+            std::replace(what.begin(), what.end(), '\n', ' ');
+            out += "ERR " + what + "\n";
+        }
+    } else if (command == "LIST") {
+        out += "OK " + std::to_string(indexes.size()) + "\n";
+        for (const auto& index : indexes) {
+            out += index->featureType + " " + std::to_string(index->store.dim) + " " + std::to_string(index->store.count) + "\n";
+        }
+    } else if (command == "QUIT") {
+        return false;
+    } else if (!command.empty()) {
+        out += "ERR unknown command " + command + "\n";
+    }
+    return true;
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Serves requests from one client until it disconnects, sends QUIT or stays idle past the socket's receive timeout
+static void serveConnection(const std::vector<std::unique_ptr<ServedIndex>>& indexes, int fd) {
+    std::string pending, out;
+    char buffer[4096];
+    bool open = true;
+    while (open) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        pending.append(buffer, static_cast<size_t>(n));
+
+        // Answer every complete line received so far in one reply, so pipelined requests cost one send
+        out.clear();
+        size_t start = 0, end;
+        while (open && (end = pending.find('\n', start)) != std::string::npos) {
+            std::string line = pending.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            open = handleRequest(indexes, line, out);
+            start = end + 1;
+        }
+        pending.erase(0, start);
+        if (pending.size() > MAX_REQUEST_LINE) {
+            out += "ERR request line too long\n";
+            open = false;
+        }
+        if (!out.empty() && !sendAll(fd, out)) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <socket_path> <[feature_type=]feature_vectors_file>... [--threads N] [--idle-timeout S]\n";
+        std::cerr << "       the feature type defaults to the one recorded in a binary store, or else the file name without extension\n";
+        return -1;
+    }
+
+    std::string socketPath = argv[1];
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    int idleTimeout = IDLE_TIMEOUT_SECONDS;
+    std::vector<std::unique_ptr<ServedIndex>> indexes;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            idleTimeout = atoi(argv[++i]);
+            continue;
+        }
+        indexes.emplace_back(new ServedIndex());
+        if (loadIndex(argv[i], *indexes.back()) != 0) {
+            return -1;
+        }
+        if (findIndex(indexes, indexes.back()->featureType) != indexes.back().get()) {
+            std::cerr << "Feature type " << indexes.back()->featureType << " loaded twice\n";
+            return -1;
+        }
+    }
+    if (indexes.empty()) {
+        std::cerr << "No feature index given\n";
+        return -1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (idleTimeout < 1) {
+        idleTimeout = 1;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path " << socketPath << " is too long\n";
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    strcpy(socketPathForSignal, socketPath.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        perror("socket");
+        return -1;
+    }
+    // A socket left behind by a server that was killed is removed; anything else at the path is left alone
+    struct stat existing;
+    if (lstat(socketPath.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            std::cerr << socketPath << ": path exists and is not a socket\n";
+            close(listenFd);
+            return -1;
+        }
+        unlink(socketPath.c_str());
+    }
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+        perror(socketPath.c_str());
+        close(listenFd);
+        return -1;
+    }
+    signal(SIGINT, removeSocketAndExit);
+    signal(SIGTERM, removeSocketAndExit);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Each worker runs its queries single-threaded; the pool is what serves clients in parallel
+    cv::setNumThreads(1);
+
+    BoundedQueue<int> connections(static_cast<size_t>(threads) * 4);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&]() {
+            int fd;
+            while (connections.pop(fd)) {
+                serveConnection(indexes, fd);
+            }
+        });
+    }
+
+    std::cout << "Listening on " << socketPath << " with " << threads << " workers (" << distanceKernelIsa() << " kernels), closing connections idle for "
+              << idleTimeout << "s\n";
+    for (;;) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        // recv (or send, to a client that stops reading its replies) then fails with EAGAIN once the client has been idle
+        // this long, and the worker closes the connection
+        timeval timeout;
+        timeout.tv_sec = idleTimeout;
+        timeout.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        connections.push(fd);
+    }
+
+    connections.close();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return -1;
+}
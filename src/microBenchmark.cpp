@@ -0,0 +1,398 @@
+// microBenchmark.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Micro-benchmarks for the hot paths: image decode, every feature extractor on real images, every distance
+//          kernel and row scan at each fixed feature dimension, CSV feature import and export and top-N selection. Results are
+//          printed as ns/op, ops/s and GB/s, can be saved as JSON, and can be compared against a saved run to flag
+//          regressions.
+//
+// Each benchmark is calibrated to run for about --min-time seconds and repeated three times; the fastest repetition is
+// reported, which is the least noisy estimate on a shared machine. GB/s counts the bytes an op has to read: the file
+// for decode and CSV import (written, for CSV export), the decoded BGR pixels for extractors, one row for kernels and scans (the query stays in
+// cache) and the score array for top-N selection.
+//
+// JSON layout, one result per line so runs diff cleanly:
+//   {"isa": "avx2", "results": [
+//     {"name": "kernel/ssd/147", "unit": "pair", "ns_per_op": 21.3, "per_second": 4.69e+07, "gb_per_second": 27.6},
+//     ...
+//   ]}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "distanceKernels.h"
+#include "featureExtraction.h"
+#include "featureStore.h"
+#include "indexPipeline.h"
+#include "topK.h"
+
+#define BENCH_REPETITIONS 3
+#define BENCH_KERNEL_ROWS 1024      // rows per dimension for the kernel benchmarks; at most 2.7 MB, so they stay in cache
+#define BENCH_CSV_ROWS 5000
+#define BENCH_CSV_DIM 147
+#define BENCH_TOPK_SCORES 1000000
+
+struct BenchResult {
+    std::string name;
+    std::string unit;       // what one op is: "image", "pair", "row", "file", "score"
+    double nsPerOp;
+    double bytesPerOp;      // 0 if throughput in bytes is not meaningful
+};
+
+struct BenchOptions {
+    double minSeconds = 0.2;
+    std::string filter;     // only run benchmarks whose name contains this
+};
+
+static volatile float benchSink;  // results are stored here so the compiler cannot drop the work
+
+static bool selected(const BenchOptions& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// Seconds taken by op(0) ... op(iterations - 1)
+template <typename Op>
+static double timeIterations(Op& op, size_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        op(i);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs op enough times to fill minSeconds and records the best ns per op (divided by unitsPerCall for ops that
+// process several units per call) under name
+template <typename Op>
+static void runBenchmark(const BenchOptions& options, const std::string& name, const char* unit, double bytesPerOp, size_t unitsPerCall,
+                         Op op, std::vector<BenchResult>& results) {
+    if (!selected(options, name)) {
+        return;
+    }
+    size_t iterations = 1;
+    double seconds = timeIterations(op, iterations);
+    while (seconds < options.minSeconds && iterations < (size_t(1) << 40)) {
+        double grow = seconds > 0 ? options.minSeconds / seconds * 1.2 : 100.0;
+        iterations = static_cast<size_t>(static_cast<double>(iterations) * std::min(std::max(grow, 2.0), 100.0));
+        seconds = timeIterations(op, iterations);
+    }
+    double best = seconds;
+    for (int r = 1; r < BENCH_REPETITIONS; ++r) {
+        best = std::min(best, timeIterations(op, iterations));
+    }
+
+    BenchResult result = {name, unit, best * 1e9 / static_cast<double>(iterations * unitsPerCall), bytesPerOp};
+    printf("%-36s %12.1f ns/%-5s %14.0f %s/s", name.c_str(), result.nsPerOp, unit, 1e9 / result.nsPerOp, unit);
+    if (bytesPerOp > 0) {
+        printf(" %9.2f GB/s", bytesPerOp / result.nsPerOp);
+    }
+    printf("\n");
+    results.push_back(result);
+}
+
+// Up to maxImages readable images from directory, taken evenly across its listing
+static int loadImages(const std::string& directory, size_t maxImages, std::vector<std::string>& paths, std::vector<cv::Mat>& images) {
+    std::vector<std::string> all;
+    if (scanDirectory(directory, all) != 0) {
+        return -1;
+    }
+    std::sort(all.begin(), all.end());
+    size_t step = std::max<size_t>(1, all.size() / maxImages);
+    for (size_t i = 0; i < all.size() && paths.size() < maxImages; i += step) {
+        cv::Mat image = readImage(all[i]);
+        if (!image.empty()) {
+            paths.push_back(all[i]);
+            images.push_back(image);
+        }
+    }
+    return 0;
+}
+
+static void benchmarkImages(const BenchOptions& options, const std::vector<std::string>& paths, const std::vector<cv::Mat>& images,
+                            std::vector<BenchResult>& results) {
+    double fileBytes = 0, pixelBytes = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        fileBytes += static_cast<double>(std::filesystem::file_size(paths[i]));
+        pixelBytes += static_cast<double>(images[i].total() * images[i].elemSize());
+    }
+    fileBytes /= static_cast<double>(paths.size());
+    pixelBytes /= static_cast<double>(paths.size());
+
+    // Decode on its own, from the page cache, at every reduced scale readImages supports
+    const int scales[] = {1, 2, 4, 8};
+    for (int scale : scales) {
+        runBenchmark(options, "decode/scale" + std::to_string(scale), "image", fileBytes, 1, [&](size_t i) {
+            benchSink = static_cast<float>(readImage(paths[i % paths.size()], scale).cols);
+        }, results);
+    }
+
+    // Extractors on already decoded images; each op starts from a fresh PreparedImage as readImages does
+    struct NamedExtractor {
+        const char* name;
+        std::vector<float> (*extract)(PreparedImage& image);
+    };
+    const NamedExtractor extractors[] = {
+        {"extractFeatureVector", &extractFeatureVector},
+        {"extractColorHistogram", &extractColorHistogram},
+        {"extractRGBHistograms", &extractRGBHistograms},
+        {"extractWholeHistogram", &extractWholeHistogram},
+        {"extractQuadrantHistograms", &extractQuadrantHistograms},
+        {"extractGridHistograms", &extractGridHistograms},
+        {"extractCenterSurroundHistograms", &extractCenterSurroundHistograms},
+        {"extractCellGrid", &extractCellGrid},
+        {"extractTextureFeatures", &extractTextureFeatures},
+        {"extractCombinedFeatures", &extractCombinedFeatures},
+    };
+    for (const NamedExtractor& extractor : extractors) {
+        runBenchmark(options, std::string("extract/") + extractor.name, "image", pixelBytes, 1, [&](size_t i) {
+            PreparedImage prepared(images[i % images.size()]);
+            benchSink = extractor.extract(prepared)[0];
+        }, results);
+    }
+}
+
+static void benchmarkKernels(const BenchOptions& options, std::vector<BenchResult>& results) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    const size_t dims[] = {ROW_SCAN_DIMS};
+    for (size_t dim : dims) {
+        std::vector<float> rows(BENCH_KERNEL_ROWS * dim), query(dim), scores(BENCH_KERNEL_ROWS);
+        for (float& v : rows) {
+            v = uniform(rng);
+        }
+        for (float& v : query) {
+            v = uniform(rng);
+        }
+        const float queryNorm = l2Norm(query.data(), dim);
+        const double rowBytes = static_cast<double>(dim * sizeof(float));
+        const std::string suffix = "/" + std::to_string(dim);
+        auto row = [&](size_t i) { return rows.data() + (i % BENCH_KERNEL_ROWS) * dim; };
+
+        runBenchmark(options, "kernel/ssd" + suffix, "pair", rowBytes, 1,
+                     [&](size_t i) { benchSink = computeSSD(query.data(), row(i), dim); }, results);
+        runBenchmark(options, "kernel/euclidean" + suffix, "pair", rowBytes, 1,
+                     [&](size_t i) { benchSink = computeEuclideanDistance(query.data(), row(i), dim); }, results);
+        runBenchmark(options, "kernel/intersection" + suffix, "pair", rowBytes, 1,
+                     [&](size_t i) { benchSink = histogramIntersection(query.data(), row(i), dim); }, results);
+        runBenchmark(options, "kernel/cosine" + suffix, "pair", rowBytes, 1,
+                     [&](size_t i) { benchSink = cosineDistance(query.data(), queryNorm, row(i), dim); }, results);
+        runBenchmark(options, "kernel/dot" + suffix, "pair", rowBytes, 1,
+                     [&](size_t i) { benchSink = dotProduct(query.data(), row(i), dim); }, results);
+
+        const char* scanNames[ROW_SCAN_METRICS] = {"ssd", "euclidean", "intersection", "cosine"};
+        for (int metric = 0; metric < ROW_SCAN_METRICS; ++metric) {
+            runBenchmark(options, std::string("scan/") + scanNames[metric] + suffix, "row", rowBytes, BENCH_KERNEL_ROWS, [&](size_t) {
+                scanRows(static_cast<RowScanMetric>(metric), query.data(), queryNorm, rows.data(), BENCH_KERNEL_ROWS, dim, scores.data());
+                benchSink = scores[0];
+            }, results);
+        }
+    }
+}
+
+// Parses a generated CSV in the format readImages writes and writes it back out; reported per file, so GB/s is the
+// parse or format rate
+static int benchmarkCsv(const BenchOptions& options, std::vector<BenchResult>& results) {
+    if (!selected(options, "csv/import") && !selected(options, "csv/export")) {
+        return 0;
+    }
+    std::string path = (std::filesystem::temp_directory_path() / "microBenchmark.csv").string();
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        std::cerr << "Unable to create " << path << "\n";
+        return -1;
+    }
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> uniform(0.0f, 255.0f);
+    for (size_t r = 0; r < BENCH_CSV_ROWS; ++r) {
+        fprintf(fp, "pic.%04zu.jpg", r);
+        for (size_t d = 0; d < BENCH_CSV_DIM; ++d) {
+            fprintf(fp, ",%.4f", uniform(rng));
+        }
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+
+    double fileBytes = static_cast<double>(std::filesystem::file_size(path));
+    if (selected(options, "csv/import")) {
+        runBenchmark(options, "csv/import", "file", fileBytes, 1, [&](size_t) {
+            FeatureStore store;
+            importFeatureCSV(path, store);
+            benchSink = static_cast<float>(store.count);
+        }, results);
+    }
+    if (selected(options, "csv/export")) {
+        FeatureStore store;
+        if (importFeatureCSV(path, store) != 0) {
+            std::filesystem::remove(path);
+            return -1;
+        }
+        std::string exportPath = (std::filesystem::temp_directory_path() / "microBenchmark.export.csv").string();
+        runBenchmark(options, "csv/export", "file", fileBytes, 1, [&](size_t) {
+            benchSink = static_cast<float>(exportFeatureCSV(store, exportPath));
+        }, results);
+        std::filesystem::remove(exportPath);
+    }
+    std::filesystem::remove(path);
+    return 0;
+}
+
+static void benchmarkTopK(const BenchOptions& options, std::vector<BenchResult>& results) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> scores(BENCH_TOPK_SCORES);
+    for (float& v : scores) {
+        v = uniform(rng);
+    }
+    const size_t ks[] = {1, 10, 100, 1000};
+    for (size_t k : ks) {
+        runBenchmark(options, "topk/" + std::to_string(k), "score", sizeof(float), BENCH_TOPK_SCORES, [&](size_t) {
+            TopKSelector best(k, false);
+            for (size_t i = 0; i < scores.size(); ++i) {
+                best.push(scores[i], static_cast<uint32_t>(i));
+            }
+            benchSink = best.results()[0].score;
+        }, results);
+    }
+}
+
+static int writeJson(const std::string& path, const std::vector<BenchResult>& results) {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        std::cerr << "Unable to open output file " << path << "\n";
+        return -1;
+    }
+    fprintf(fp, "{\"isa\": \"%s\", \"results\": [\n", distanceKernelIsa());
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        fprintf(fp, "  {\"name\": \"%s\", \"unit\": \"%s\", \"ns_per_op\": %.6g, \"per_second\": %.6g, \"gb_per_second\": %.6g}%s\n",
+                r.name.c_str(), r.unit.c_str(), r.nsPerOp, 1e9 / r.nsPerOp, r.bytesPerOp > 0 ? r.bytesPerOp / r.nsPerOp : 0.0,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "]}\n");
+    if (fclose(fp) != 0) {
+        std::cerr << "Error writing " << path << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+// Reads name -> ns_per_op from a file written by writeJson
+static int readJson(const std::string& path, std::map<std::string, double>& nsPerOp) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Unable to open baseline " << path << "\n";
+        return -1;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t ns = line.find("\"ns_per_op\": ");
+        if (name == std::string::npos || ns == std::string::npos) {
+            continue;
+        }
+        name += strlen("\"name\": \"");
+        nsPerOp[line.substr(name, line.find('"', name) - name)] = atof(line.c_str() + ns + strlen("\"ns_per_op\": "));
+    }
+    return 0;
+}
+
+// Prints the change of every benchmark present in both runs. Returns the number slower than baseline by more than tolerance.
+static int compareWithBaseline(const std::vector<BenchResult>& results, const std::map<std::string, double>& baseline, double tolerance) {
+    int regressions = 0;
+    printf("\nAgainst baseline (tolerance %.0f%%):\n", tolerance * 100);
+    for (const BenchResult& r : results) {
+        auto base = baseline.find(r.name);
+        if (base == baseline.end() || base->second <= 0) {
+            continue;
+        }
+        double ratio = r.nsPerOp / base->second;
+        const char* verdict = ratio > 1 + tolerance ? "REGRESSION" : ratio < 1 - tolerance ? "faster" : "";
+        printf("%-36s %12.1f -> %12.1f ns/%-5s %+7.1f%% %s\n", r.name.c_str(), base->second, r.nsPerOp, r.unit.c_str(), (ratio - 1) * 100, verdict);
+        regressions += ratio > 1 + tolerance;
+    }
+    printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    return regressions;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <image_directory> [--images N] [--min-time seconds] [--isa name] [--filter text]\n";
+        std::cerr << "       [--json output.json] [--baseline baseline.json] [--tolerance 0.10]\n";
+        std::cerr << "       --filter runs only the benchmarks whose name contains text; --baseline compares against a saved\n";
+        std::cerr << "       --json run and exits with status 1 if any benchmark is slower by more than --tolerance\n";
+        return -1;
+    }
+
+    std::string directory = argv[1], jsonFile, baselineFile;
+    BenchOptions options;
+    size_t maxImages = 20;
+    double tolerance = 0.10;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--images") == 0 && i + 1 < argc) {
+            maxImages = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.minSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            if (selectDistanceKernels(argv[++i]) != 0) {
+                std::cerr << "Instruction set " << argv[i] << " is not available\n";
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselineFile = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return -1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baselineFile.empty() && readJson(baselineFile, baseline) != 0) {
+        return -1;
+    }
+
+    std::vector<std::string> paths;
+    std::vector<cv::Mat> images;
+    if (loadImages(directory, maxImages, paths, images) != 0) {
+        return -1;
+    }
+    cv::setNumThreads(1);
+    printf("Kernels: %s, %zu images from %s\n", distanceKernelIsa(), images.size(), directory.c_str());
+
+    std::vector<BenchResult> results;
+    if (images.empty()) {
+        std::cerr << "No readable images in " << directory << ", skipping the decode and extractor benchmarks\n";
+    } else {
+        benchmarkImages(options, paths, images, results);
+    }
+    benchmarkKernels(options, results);
+    if (benchmarkCsv(options, results) != 0) {
+        return -1;
+    }
+    benchmarkTopK(options, results);
+
+    if (!jsonFile.empty()) {
+        if (writeJson(jsonFile, results) != 0) {
+            return -1;
+        }
+        printf("Wrote %s\n", jsonFile.c_str());
+    }
+    if (!baselineFile.empty() && compareWithBaseline(results, baseline, tolerance) > 0) {
+        return 1;
+    }
+    return 0;
+}
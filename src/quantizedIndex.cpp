@@ -0,0 +1,364 @@
+// quantizedIndex.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Training, encoding, saving and searching int8 and product-quantized codes for feature index rows.
+//
+// Both modes score a query against the codes asymmetrically: the query stays in float and only the rows are
+// approximated. For int8 the dot product with a decoded row folds into one float x uint8 dot per row plus a constant;
+// for pq a table of the query's dot product with every centroid of every subspace is built once per query, and a row
+// then costs one table lookup and add per subspace.
+
+#include "quantizedIndex.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include "distanceKernels.h"
+#include "trace.h"
+
+#define QUANTIZED_ALIGNMENT 64
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Copies row scaled to unit length (or left at zero) into out
+static void normalizedRow(const float* row, size_t dim, float* out) {
+    float norm = l2Norm(row, dim);
+    float inverse = norm > 0.0f ? 1.0f / norm : 0.0f;
+    for (size_t j = 0; j < dim; ++j) {
+        out[j] = row[j] * inverse;
+    }
+}
+
+// Runs body(i) for i in [0, n) on up to `threads` threads
+template <typename Body>
+static void parallelFor(size_t n, int threads, Body body) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next++) < n) {
+            body(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads && static_cast<size_t>(t) < n; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+// Index of the centroid nearest to x. centroids is stored dimension-major (width x PQ_CENTROIDS) so the inner loop
+// runs over all centroids at once and vectorizes.
+static uint8_t nearestCentroid(const float* x, const float* centroidsByDim, size_t width, float* distances) {
+    std::fill(distances, distances + PQ_CENTROIDS, 0.0f);
+    for (size_t j = 0; j < width; ++j) {
+        const float* column = centroidsByDim + j * PQ_CENTROIDS;
+        float value = x[j];
+        for (size_t c = 0; c < PQ_CENTROIDS; ++c) {
+            float diff = value - column[c];
+            distances[c] += diff * diff;
+        }
+    }
+    return static_cast<uint8_t>(std::min_element(distances, distances + PQ_CENTROIDS) - distances);
+}
+
+// Lloyd's k-means with PQ_CENTROIDS clusters over n training vectors of the given width; writes centroids row-major
+static void trainCodebook(const std::vector<float>& training, size_t n, size_t width, int iterations, uint32_t seed, float* centroids) {
+    std::vector<float> byDim(width * PQ_CENTROIDS);
+    for (size_t c = 0; c < PQ_CENTROIDS; ++c) {
+        // Evenly spaced training rows as the initial centroids
+        const float* start = training.data() + (c * n / PQ_CENTROIDS) * width;
+        for (size_t j = 0; j < width; ++j) {
+            byDim[j * PQ_CENTROIDS + c] = start[j];
+        }
+    }
+
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> labels(n);
+    std::vector<float> sums(width * PQ_CENTROIDS);
+    std::vector<size_t> counts(PQ_CENTROIDS);
+    float distances[PQ_CENTROIDS];
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        bool changed = false;
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t label = nearestCentroid(training.data() + i * width, byDim.data(), width, distances);
+            changed = changed || label != labels[i] || iteration == 0;
+            labels[i] = label;
+        }
+        if (!changed) {
+            break;
+        }
+
+        std::fill(sums.begin(), sums.end(), 0.0f);
+        std::fill(counts.begin(), counts.end(), 0);
+        for (size_t i = 0; i < n; ++i) {
+            const float* x = training.data() + i * width;
+            for (size_t j = 0; j < width; ++j) {
+                sums[j * PQ_CENTROIDS + labels[i]] += x[j];
+            }
+            counts[labels[i]]++;
+        }
+        for (size_t c = 0; c < PQ_CENTROIDS; ++c) {
+            // An empty cluster restarts at a random training vector rather than staying unused
+            const float* restart = counts[c] == 0 ? training.data() + (rng() % n) * width : nullptr;
+            for (size_t j = 0; j < width; ++j) {
+                byDim[j * PQ_CENTROIDS + c] = restart ? restart[j] : sums[j * PQ_CENTROIDS + c] / static_cast<float>(counts[c]);
+            }
+        }
+    }
+
+    for (size_t c = 0; c < PQ_CENTROIDS; ++c) {
+        for (size_t j = 0; j < width; ++j) {
+            centroids[c * width + j] = byDim[j * PQ_CENTROIDS + c];
+        }
+    }
+}
+
+static void buildInt8(const FeatureStore& store, const QuantizerParams& params, QuantizedIndex& index) {
+    size_t dim = store.dim;
+    index.codeBytes = dim;
+    index.ownedParams.assign(2 * dim, 0.0f);
+    std::vector<float> low(dim, FLT_MAX), high(dim, -FLT_MAX), unit(dim);
+    for (size_t i = 0; i < store.count; ++i) {
+        normalizedRow(store.row(i), dim, unit.data());
+        for (size_t j = 0; j < dim; ++j) {
+            low[j] = std::min(low[j], unit[j]);
+            high[j] = std::max(high[j], unit[j]);
+        }
+    }
+    float* offsets = index.ownedParams.data();
+    float* scales = offsets + dim;
+    for (size_t j = 0; j < dim; ++j) {
+        offsets[j] = low[j];
+        scales[j] = high[j] > low[j] ? (high[j] - low[j]) / 255.0f : 1.0f;
+    }
+
+    index.ownedCodes.resize(store.count * dim);
+    parallelFor(store.count, params.threads, [&](size_t i) {
+        std::vector<float> row(dim);
+        normalizedRow(store.row(i), dim, row.data());
+        uint8_t* code = index.ownedCodes.data() + i * dim;
+        for (size_t j = 0; j < dim; ++j) {
+            float level = std::round((row[j] - offsets[j]) / scales[j]);
+            code[j] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, level)));
+        }
+    });
+}
+
+static void buildPQ(const FeatureStore& store, const QuantizerParams& params, QuantizedIndex& index) {
+    size_t dim = store.dim;
+    index.codeBytes = index.subspaces;
+    index.ownedParams.assign(PQ_CENTROIDS * dim, 0.0f);
+
+    size_t n = std::min(std::max<size_t>(params.trainingRows, PQ_CENTROIDS), store.count);
+    std::vector<float> sample(n * dim);
+    for (size_t i = 0; i < n; ++i) {
+        normalizedRow(store.row(i * store.count / n), dim, sample.data() + i * dim);
+    }
+
+    // Each subspace's codebook is independent, so they train in parallel
+    parallelFor(index.subspaces, params.threads, [&](size_t s) {
+        size_t start = index.subspaceStart(s), width = index.subspaceStart(s + 1) - start;
+        std::vector<float> training(n * width);
+        for (size_t i = 0; i < n; ++i) {
+            std::copy(sample.begin() + i * dim + start, sample.begin() + i * dim + start + width, training.begin() + i * width);
+        }
+        trainCodebook(training, n, width, params.iterations, static_cast<uint32_t>(s), index.ownedParams.data() + PQ_CENTROIDS * start);
+    });
+
+    // Transposed copies of the codebooks for nearestCentroid
+    std::vector<float> byDim(PQ_CENTROIDS * dim);
+    for (size_t s = 0; s < index.subspaces; ++s) {
+        size_t start = index.subspaceStart(s), width = index.subspaceStart(s + 1) - start;
+        const float* centroids = index.ownedParams.data() + PQ_CENTROIDS * start;
+        for (size_t c = 0; c < PQ_CENTROIDS; ++c) {
+            for (size_t j = 0; j < width; ++j) {
+                byDim[PQ_CENTROIDS * start + j * PQ_CENTROIDS + c] = centroids[c * width + j];
+            }
+        }
+    }
+
+    index.ownedCodes.resize(store.count * index.subspaces);
+    parallelFor(store.count, params.threads, [&](size_t i) {
+        std::vector<float> row(dim);
+        float distances[PQ_CENTROIDS];
+        normalizedRow(store.row(i), dim, row.data());
+        uint8_t* code = index.ownedCodes.data() + i * index.subspaces;
+        for (size_t s = 0; s < index.subspaces; ++s) {
+            size_t start = index.subspaceStart(s), width = index.subspaceStart(s + 1) - start;
+            code[s] = nearestCentroid(row.data() + start, byDim.data() + PQ_CENTROIDS * start, width, distances);
+        }
+    });
+}
+
+std::string quantizedPathFor(const std::string& featureIndexPath) {
+    return featureIndexPath + QUANTIZED_EXTENSION;
+}
+
+int buildQuantizedIndex(const FeatureStore& store, const QuantizerParams& params, QuantizedIndex& index) {
+    if (store.count == 0 || store.dim == 0 || store.count > UINT32_MAX) {
+        printf("Cannot quantize a feature index of %zu rows of %zu values\n", store.count, store.dim);
+        return -1;
+    }
+
+    index.mode = params.mode;
+    index.dim = store.dim;
+    index.count = store.count;
+    if (params.mode == QUANTIZER_INT8) {
+        index.subspaces = store.dim;
+        buildInt8(store, params, index);
+    } else {
+        index.subspaces = params.subspaces > 0 ? params.subspaces : std::max<size_t>(1, store.dim / 4);
+        if (index.subspaces > store.dim) {
+            printf("Cannot split %zu values into %zu subspaces\n", store.dim, index.subspaces);
+            return -1;
+        }
+        buildPQ(store, params, index);
+    }
+    index.params = index.ownedParams.data();
+    index.codes = index.ownedCodes.data();
+    return 0;
+}
+
+int writeQuantizedIndex(const std::string& path, const QuantizedIndex& index) {
+    QuantizedHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, QUANTIZED_MAGIC, sizeof(header.magic));
+    header.version = QUANTIZED_VERSION;
+    header.mode = index.mode;
+    header.dim = index.dim;
+    header.count = index.count;
+    header.subspaces = index.subspaces;
+    header.codeBytes = index.codeBytes;
+    header.paramsOffset = alignUp(sizeof(header), QUANTIZED_ALIGNMENT);
+    header.paramsBytes = (index.mode == QUANTIZER_INT8 ? 2 * index.dim : PQ_CENTROIDS * index.dim) * sizeof(float);
+    header.codesOffset = alignUp(header.paramsOffset + header.paramsBytes, QUANTIZED_ALIGNMENT);
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        printf("Unable to open output file %s\n", path.c_str());
+        return -1;
+    }
+    static const char zeros[QUANTIZED_ALIGNMENT] = {0};
+    size_t codesBytes = index.count * index.codeBytes;
+    size_t headerPad = static_cast<size_t>(header.paramsOffset - sizeof(header));
+    size_t paramsPad = static_cast<size_t>(header.codesOffset - header.paramsOffset - header.paramsBytes);
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(zeros, 1, headerPad, fp) == headerPad &&
+              fwrite(index.params, 1, header.paramsBytes, fp) == header.paramsBytes && fwrite(zeros, 1, paramsPad, fp) == paramsPad &&
+              fwrite(index.codes, 1, codesBytes, fp) == codesBytes;
+    if (fclose(fp) != 0 || !ok) {
+        printf("Error writing quantized index %s\n", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int openQuantizedIndex(const std::string& path, const FeatureStore& store, QuantizedIndex& index) {
+    if (mapFile(path, index.file) != 0) {
+        printf("Unable to map quantized index %s\n", path.c_str());
+        return -1;
+    }
+    QuantizedHeader header;
+    if (index.file.size < sizeof(header)) {
+        printf("Quantized index %s is truncated\n", path.c_str());
+        return -1;
+    }
+    memcpy(&header, index.file.data, sizeof(header));
+    if (memcmp(header.magic, QUANTIZED_MAGIC, sizeof(header.magic)) != 0 || header.version != QUANTIZED_VERSION ||
+        (header.mode != QUANTIZER_INT8 && header.mode != QUANTIZER_PQ)) {
+        printf("Quantized index %s has an unsupported format\n", path.c_str());
+        return -1;
+    }
+    if (header.count != store.count || header.dim != store.dim) {
+        printf("Quantized index %s was built for %llu rows of %llu values, the feature index has %zu of %zu\n", path.c_str(),
+               static_cast<unsigned long long>(header.count), static_cast<unsigned long long>(header.dim), store.count, store.dim);
+        return -1;
+    }
+    uint64_t expectedParams = (header.mode == QUANTIZER_INT8 ? 2 * header.dim : PQ_CENTROIDS * header.dim) * sizeof(float);
+    uint64_t expectedCode = header.mode == QUANTIZER_INT8 ? header.dim : header.subspaces;
+    // Each offset is checked against the file size before a section size is added to it, so no sum can wrap
+    const uint64_t fileSize = index.file.size;
+    if (header.subspaces == 0 || header.subspaces > header.dim || header.codeBytes != expectedCode || header.paramsBytes != expectedParams ||
+        header.paramsOffset % QUANTIZED_ALIGNMENT != 0 || header.codesOffset % QUANTIZED_ALIGNMENT != 0 ||
+        header.paramsOffset > fileSize || header.paramsBytes > fileSize - header.paramsOffset ||
+        header.codesOffset > fileSize || header.count > (fileSize - header.codesOffset) / header.codeBytes) {
+        printf("Quantized index %s is corrupt\n", path.c_str());
+        return -1;
+    }
+
+    index.mode = static_cast<QuantizerMode>(header.mode);
+    index.dim = static_cast<size_t>(header.dim);
+    index.count = static_cast<size_t>(header.count);
+    index.subspaces = static_cast<size_t>(header.subspaces);
+    index.codeBytes = static_cast<size_t>(header.codeBytes);
+    index.params = reinterpret_cast<const float*>(index.file.data + header.paramsOffset);
+    index.codes = reinterpret_cast<const uint8_t*>(index.file.data + header.codesOffset);
+    return 0;
+}
+
+std::vector<ScoredId> searchQuantizedIndex(const QuantizedIndex& index, const FeatureStore& store, const float* query, size_t k,
+                                           size_t rerank, uint32_t excludeId) {
+    TRACE_SCOPE("quantized search");
+    size_t dim = index.dim;
+    std::vector<float> unit(dim);
+    normalizedRow(query, dim, unit.data());
+
+    // Approximate cosine distance 1 - q.x for every code
+    TopKSelector candidates(std::max(rerank, k), false, excludeId);
+    if (index.mode == QUANTIZER_INT8) {
+        const float* offsets = index.params;
+        const float* scales = offsets + dim;
+        std::vector<float> weights(dim);
+        float base = 0.0f;
+        for (size_t j = 0; j < dim; ++j) {
+            weights[j] = unit[j] * scales[j];
+            base += unit[j] * offsets[j];
+        }
+        for (size_t i = 0; i < index.count; ++i) {
+            float dot = base + dotProductU8(weights.data(), index.codes + i * dim, dim);
+            candidates.push(1.0f - dot, static_cast<uint32_t>(i));
+        }
+    } else {
+        std::vector<float> table(index.subspaces * PQ_CENTROIDS);
+        for (size_t s = 0; s < index.subspaces; ++s) {
+            size_t start = index.subspaceStart(s), width = index.subspaceStart(s + 1) - start;
+            const float* centroids = index.params + PQ_CENTROIDS * start;
+            for (size_t c = 0; c < PQ_CENTROIDS; ++c) {
+                table[s * PQ_CENTROIDS + c] = dotProduct(unit.data() + start, centroids + c * width, width);
+            }
+        }
+        // Four partial sums keep four table lookups in flight instead of one serial chain of adds
+        size_t m = index.subspaces;
+        for (size_t i = 0; i < index.count; ++i) {
+            const uint8_t* code = index.codes + i * m;
+            float dot0 = 0.0f, dot1 = 0.0f, dot2 = 0.0f, dot3 = 0.0f;
+            size_t s = 0;
+            for (; s + 4 <= m; s += 4) {
+                dot0 += table[s * PQ_CENTROIDS + code[s]];
+                dot1 += table[(s + 1) * PQ_CENTROIDS + code[s + 1]];
+                dot2 += table[(s + 2) * PQ_CENTROIDS + code[s + 2]];
+                dot3 += table[(s + 3) * PQ_CENTROIDS + code[s + 3]];
+            }
+            for (; s < m; ++s) {
+                dot0 += table[s * PQ_CENTROIDS + code[s]];
+            }
+            candidates.push(1.0f - ((dot0 + dot1) + (dot2 + dot3)), static_cast<uint32_t>(i));
+        }
+    }
+
+    // Exact distances for the candidates only
+    float queryNorm = l2Norm(query, dim);
+    TopKSelector best(k, false, excludeId);
+    for (const ScoredId& candidate : candidates.results()) {
+        best.push(cosineDistance(query, queryNorm, store.row(candidate.id), dim), candidate.id);
+    }
+    return best.results();
+}
@@ -0,0 +1,91 @@
+// quantizedIndex.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for quantizedIndex.cpp, compact codes for the rows of a feature index (per-dimension int8
+//          scalar quantization or product quantization) that are scanned with asymmetric cosine distance; only the
+//          best candidates are re-ranked with the exact float vectors.
+
+#ifndef QUANTIZED_INDEX_H
+#define QUANTIZED_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "featureStore.h"
+#include "mappedFile.h"
+#include "topK.h"
+
+// Code file layout (native little-endian, offsets from the start of the file):
+//   QuantizedHeader
+//   parameters at paramsOffset: int8 - dim offsets then dim scales; pq - the codebook of every subspace in turn,
+//                               256 centroids of that subspace's width each
+//   codes at codesOffset: count rows of codeBytes bytes
+// Rows are L2-normalized before encoding, so a code approximates the direction of its row and the scan needs no norms.
+#define QUANTIZED_MAGIC "CVQUANT1"
+#define QUANTIZED_VERSION 1
+#define QUANTIZED_EXTENSION ".cvq"
+#define PQ_CENTROIDS 256
+
+enum QuantizerMode : uint32_t {
+    QUANTIZER_INT8 = 0,   // one byte per dimension: value = offset + scale * code
+    QUANTIZER_PQ = 1      // one byte per subspace: the nearest of 256 trained centroids
+};
+
+struct QuantizedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t mode;
+    uint64_t dim;
+    uint64_t count;
+    uint64_t subspaces;
+    uint64_t codeBytes;
+    uint64_t paramsOffset;
+    uint64_t paramsBytes;
+    uint64_t codesOffset;
+    uint32_t reserved[8];
+};
+
+struct QuantizerParams {
+    QuantizerMode mode = QUANTIZER_PQ;
+    size_t subspaces = 0;          // pq only; 0 picks dim / 4, i.e. 16x smaller than float rows
+    size_t trainingRows = 16384;   // rows sampled (evenly) to train the pq codebooks
+    int iterations = 20;           // k-means iterations per codebook
+    int threads = 1;
+};
+
+struct QuantizedIndex {
+    QuantizerMode mode = QUANTIZER_PQ;
+    size_t dim = 0;
+    size_t count = 0;
+    size_t subspaces = 0;
+    size_t codeBytes = 0;
+
+    const float* params = nullptr;
+    const uint8_t* codes = nullptr;
+
+    MappedFile file;
+    std::vector<float> ownedParams;
+    std::vector<uint8_t> ownedCodes;
+
+    // First dimension of pq subspace s; subspaces split dim as evenly as possible
+    size_t subspaceStart(size_t s) const { return s * dim / subspaces; }
+};
+
+// Default code file for a feature index: features.cvfs -> features.cvfs.cvq
+std::string quantizedPathFor(const std::string& featureIndexPath);
+
+// Trains the quantizer on store and encodes every row
+int buildQuantizedIndex(const FeatureStore& store, const QuantizerParams& params, QuantizedIndex& index);
+
+int writeQuantizedIndex(const std::string& path, const QuantizedIndex& index);
+
+// Maps a code file and checks that it was built for a feature index of store's shape
+int openQuantizedIndex(const std::string& path, const FeatureStore& store, QuantizedIndex& index);
+
+// Top k rows by cosine distance, best first: the codes are scanned for the best `rerank` candidates (at least k),
+// whose exact distances are then computed from store. excludeId, if given, is left out, as the target's own row is.
+std::vector<ScoredId> searchQuantizedIndex(const QuantizedIndex& index, const FeatureStore& store, const float* query, size_t k,
+                                           size_t rerank, uint32_t excludeId = TopKSelector::NO_EXCLUDE);
+
+#endif
@@ -2,88 +2,474 @@
 // Name: Mihir Chitre, Aditya Gurnani
 // Date: 02/01/2024
 // Purpose: Reads all the images in the given directory and generates an output csv file containing feature vectors for each image, using
-//          the selected feature set.
+//          the selected feature set. Several feature sets can be given as a comma-separated list; each image is then decoded once and
+//          one index is written per feature set. With --image-cache, decoded images are kept in a memory-mapped cache
+//          so that re-indexing after a change to the extractors skips decoding.
 
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <vector>
 #include <string>
+#include <thread>
 #include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
 #include "opencv2/opencv.hpp"
 #include "featureExtraction.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+#include "imageCache.h"
+#include "indexManifest.h"
+#include "indexPipeline.h"
+#include "trace.h"
 
-// Function to append image data to a CSV file
-int append_image_data_csv(const char *filename, const char *image_filename, std::vector<float> &image_data, int reset_file = 0)
+// How an image found in the directory is handled for one output index
+enum UpdateAction
 {
-    char mode[2] = {reset_file ? 'w' : 'a', '\0'};
-    FILE *fp = fopen(filename, mode);
-    if (!fp)
+    UPDATE_EXTRACT, // not in the previous index: decode and extract
+    UPDATE_REUSE,   // size and mtime unchanged: copy the previous row
+    UPDATE_VERIFY   // size or mtime changed: reuse the row only if the content hash still matches
+};
+
+struct UpdatePlan
+{
+    UpdateAction action = UPDATE_EXTRACT;
+    const ManifestEntry *previous = nullptr;
+    long row = -1;
+};
+
+// One output index: the feature method it holds and, for incremental runs, what it contained before
+struct IndexTarget
+{
+    const FeatureMethod *method = nullptr;
+    std::string output;
+    std::string writePath;
+
+    bool havePrevious = false;
+    bool appendOnly = false;
+    FeatureStore previousIndex;
+    std::vector<ManifestEntry> previousEntries;
+    std::vector<UpdatePlan> plans; // per scanned image; empty for a full rebuild
+    size_t removed = 0;
+
+    FeatureIndexWriter writer;
+    std::vector<ManifestEntry> manifest;
+    std::atomic<size_t> extracted{0};
+    std::atomic<size_t> changed{0};
+};
+
+// Output path for one method when several are indexed at once: features.csv -> features_baseline.csv
+static std::string outputPathFor(const std::string &output, const FeatureMethod *method, bool multiple)
+{
+    if (!multiple)
     {
-        printf("Unable to open output file %s\n", filename);
-        return -1;
+        return output;
     }
+    std::filesystem::path p(output);
+    return (p.parent_path() / (p.stem().string() + "_" + method->name + p.extension().string())).string();
+}
 
-    std::filesystem::path p(image_filename);
-    std::string filenameOnly = p.filename().string();
+// Temporary output name that keeps the extension, so the writer still picks the right format
+static std::string partialPathFor(const std::string &path)
+{
+    std::filesystem::path p(path);
+    std::filesystem::path partial = p.parent_path() / (p.stem().string() + ".partial" + p.extension().string());
+    return partial.string();
+}
 
-    fprintf(fp, "%s", filenameOnly.c_str());
-    for (float value : image_data)
+// Loads the previous manifest and index of a target and classifies every scanned image from its metadata. Rows
+// extracted at another decode scale or stored as another dtype are never reused: requantizing already quantized rows
+// would not give the values a fresh extraction does.
+static void planUpdate(IndexTarget &target, const std::vector<std::string> &paths, const std::vector<ManifestEntry> &current,
+                       FeatureDType dtype, int decodeScale)
+{
+    std::string previousMethod;
+    int previousScale = 1;
+    target.havePrevious = readManifest(manifestPathFor(target.output), previousMethod, previousScale, target.previousEntries) == 0 &&
+                          previousMethod == target.method->name && previousScale == decodeScale && std::filesystem::exists(target.output) &&
+                          openFeatureStore(target.output, target.previousIndex) == 0 &&
+                          target.previousIndex.dtype == static_cast<uint32_t>(dtype) &&
+                          (target.previousIndex.featureType.empty() || target.previousIndex.featureType == target.method->name);
+    if (!target.havePrevious)
     {
-        fprintf(fp, ",%.4f", value);
+        printf("No usable manifest for %s, indexing every image\n", target.output.c_str());
+        target.previousEntries.clear();
     }
-    fprintf(fp, "\n");
-    fclose(fp);
 
-    return 0;
+    std::unordered_map<std::string, const ManifestEntry *> previousByPath;
+    for (const auto &entry : target.previousEntries)
+    {
+        previousByPath[entry.path] = &entry;
+    }
+    std::unordered_map<std::string, long> rowByFilename;
+    for (size_t i = 0; target.havePrevious && i < target.previousIndex.count; ++i)
+    {
+        rowByFilename[target.previousIndex.filename(i)] = static_cast<long>(i);
+    }
+
+    size_t reused = 0, verify = 0;
+    target.plans.assign(paths.size(), UpdatePlan());
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        auto prev = previousByPath.find(paths[i]);
+        auto row = rowByFilename.find(std::filesystem::path(paths[i]).filename().string());
+        if (current[i].path.empty() || prev == previousByPath.end() || row == rowByFilename.end())
+        {
+            continue;
+        }
+
+        UpdatePlan &plan = target.plans[i];
+        plan.previous = prev->second;
+        plan.row = row->second;
+        if (plan.previous->size == current[i].size && plan.previous->mtime == current[i].mtime)
+        {
+            plan.action = UPDATE_REUSE;
+            reused++;
+        }
+        else
+        {
+            plan.action = UPDATE_VERIFY;
+            verify++;
+        }
+    }
+
+    std::unordered_set<std::string> seen(paths.begin(), paths.end());
+    for (const auto &entry : target.previousEntries)
+    {
+        if (seen.count(entry.path) == 0)
+        {
+            target.removed++;
+        }
+    }
+
+    // When images were only added to a CSV index, append their rows instead of rewriting the file
+    target.appendOnly = target.havePrevious && !isFeatureStorePath(target.output) && target.removed == 0 && verify == 0 &&
+                        reused == target.previousEntries.size() && reused == target.previousIndex.count;
+    if (target.appendOnly)
+    {
+        target.manifest = target.previousEntries;
+    }
+}
+
+// True if the target needs a row written for the image at position seq of the scan
+static bool needsRow(const IndexTarget &target, size_t seq)
+{
+    return !target.appendOnly || target.plans[seq].action == UPDATE_EXTRACT;
 }
 
-// Main function to process images in a directory and write feature vectors to CSV
+// Indexes the directory into every target. Images are decoded at most once and only when some target has no
+// reusable row for them; for incremental runs the manifests and previous indexes decide which rows can be reused.
+static int indexImages(const std::string &directory, std::vector<std::unique_ptr<IndexTarget>> &targets, bool incremental, int threads,
+                       FeatureDType dtype, int decodeScale, ImageCache *imageCache)
+{
+    std::vector<std::string> paths;
+    std::vector<ManifestEntry> current;
+    std::vector<size_t> jobSeq; // scan position of each pipeline job
+    std::vector<std::string> jobPaths;
+
+    if (incremental)
+    {
+        if (scanDirectory(directory, paths) != 0)
+        {
+            return -1;
+        }
+        current.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            if (statImageFile(paths[i], current[i]) != 0)
+            {
+                current[i] = ManifestEntry();
+            }
+        }
+        for (auto &target : targets)
+        {
+            planUpdate(*target, paths, current, dtype, decodeScale);
+        }
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            for (const auto &target : targets)
+            {
+                if (needsRow(*target, i))
+                {
+                    jobSeq.push_back(i);
+                    jobPaths.push_back(paths[i]);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (auto &target : targets)
+    {
+        target->writePath = (!incremental || target->appendOnly) ? target->output : partialPathFor(target->output);
+        if (openFeatureIndexWriter(target->writePath, target->method->name, target->writer, target->appendOnly, dtype) != 0)
+        {
+            return -1;
+        }
+        target->writer.decodeScale = static_cast<uint32_t>(decodeScale);
+    }
+
+    auto extract = [&](IndexResult &result)
+    {
+        size_t seq = incremental ? jobSeq[result.seq] : result.seq;
+        result.features.resize(targets.size());
+
+        bool hashed = false;
+        cv::Mat image;
+        std::unique_ptr<PreparedImage> prepared;
+        for (size_t k = 0; k < targets.size(); ++k)
+        {
+            IndexTarget &target = *targets[k];
+            if (incremental && !needsRow(target, seq))
+            {
+                continue;
+            }
+
+            const UpdatePlan *plan = incremental ? &target.plans[seq] : nullptr;
+            if (plan && plan->action == UPDATE_REUSE)
+            {
+                result.features[k].assign(target.previousIndex.row(plan->row), target.previousIndex.row(plan->row) + target.previousIndex.dim);
+                continue;
+            }
+
+            if (incremental && !hashed)
+            {
+                if (hashFileContents(result.path, result.contentHash) != 0)
+                {
+                    return false;
+                }
+                hashed = true;
+            }
+            if (plan && plan->action == UPDATE_VERIFY && result.contentHash == plan->previous->hash)
+            {
+                result.features[k].assign(target.previousIndex.row(plan->row), target.previousIndex.row(plan->row) + target.previousIndex.dim);
+                continue;
+            }
+
+            if (!prepared)
+            {
+                image = imageCache ? readCachedImage(*imageCache, result.path) : readImage(result.path, decodeScale);
+                if (image.empty())
+                {
+                    return false;
+                }
+                prepared.reset(new PreparedImage(image));
+            }
+            TraceScope extractSpan(target.method->name);
+            result.features[k] = target.method->extract(*prepared);
+            if (plan)
+            {
+                (plan->action == UPDATE_VERIFY ? target.changed : target.extracted)++;
+            }
+        }
+        return true;
+    };
+
+    auto write = [&](const IndexResult &result)
+    {
+        TRACE_SCOPE("write");
+        if (!result.ok)
+        {
+            printf("Failed to open image %s\n", result.path.c_str());
+            return 0;
+        }
+
+        size_t seq = incremental ? jobSeq[result.seq] : result.seq;
+        for (size_t k = 0; k < targets.size(); ++k)
+        {
+            IndexTarget &target = *targets[k];
+            if (incremental)
+            {
+                if (!needsRow(target, seq))
+                {
+                    continue;
+                }
+                const UpdatePlan &plan = target.plans[seq];
+                // An image that could not be stat'ed is recorded with size and mtime 0, so the next run verifies it
+                ManifestEntry entry = current[seq];
+                entry.path = paths[seq];
+                entry.hash = plan.action == UPDATE_REUSE ? plan.previous->hash : result.contentHash;
+                target.manifest.push_back(entry);
+            }
+            if (appendFeatureIndexRow(target.writer, result.path, result.features[k]) != 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    };
+
+    // Read ahead only the files that will be decoded; cached images come from the cache's mapping instead
+    IndexPrefetchFn prefetch = prefetchFile;
+    if (imageCache)
+    {
+        prefetch = [&](const std::string &path)
+        { prefetchUncachedImage(*imageCache, path); };
+    }
+    int status = incremental ? runIndexPipeline(jobPaths, threads, extract, write, prefetch)
+                             : runIndexPipeline(directory, threads, extract, write, prefetch);
+
+    for (auto &target : targets)
+    {
+        if (closeFeatureIndexWriter(target->writer) != 0)
+        {
+            status = -1;
+        }
+        // The previous index may be mapped, so release it before replacing the file
+        unmapFile(target->previousIndex.file);
+    }
+
+    std::error_code ec;
+    for (auto &target : targets)
+    {
+        if (status != 0)
+        {
+            if (target->writePath != target->output)
+            {
+                std::filesystem::remove(target->writePath, ec);
+            }
+            continue;
+        }
+
+        if (!incremental)
+        {
+            // A full rebuild invalidates any manifest left by an earlier incremental run
+            std::filesystem::remove(manifestPathFor(target->output), ec);
+            continue;
+        }
+
+        if (target->writePath != target->output)
+        {
+            std::filesystem::rename(target->writePath, target->output, ec);
+            if (ec)
+            {
+                printf("Unable to replace %s\n", target->output.c_str());
+                status = -1;
+                continue;
+            }
+        }
+        if (writeManifest(manifestPathFor(target->output), target->method->name, decodeScale, target->manifest) != 0)
+        {
+            status = -1;
+            continue;
+        }
+
+        size_t extracted = target->extracted.load(), changed = target->changed.load();
+        printf("Updated %s: %zu unchanged, %zu new, %zu changed, %zu removed%s\n", target->output.c_str(),
+               target->manifest.size() - extracted - changed, extracted, changed, target->removed,
+               target->appendOnly ? " (appended)" : "");
+    }
+    return status;
+}
+
+// Main function to process images in a directory and write feature vectors to CSV, or to a binary
+// feature store when the output file has the .cvfs extension
 int main(int argc, char *argv[])
 {
     if (argc < 4)
     {
-        printf("Usage: %s <directory> <output_csv_file> <feature_extraction_method>\n", argv[0]);
+        printf("Usage: %s <directory> <output_csv_file|output.cvfs> <feature_extraction_method[,method...]> [--threads N] [--incremental] [--dtype f32|u8|u16] [--scale 1|2|4|8] [--image-cache cache_file] [--trace trace.json]\n", argv[0]);
+        printf("       with several methods, one index per method is written as <output>_<method>.<ext>\n");
+        printf("       u8 and u16 store histogram features as fixed-point values in a %s output\n", FEATURE_STORE_EXTENSION);
+        printf("       --scale decodes images at 1/scale size (JPEGs in the DCT domain) before extracting features\n");
+        printf("       --image-cache keeps the decoded images in cache_file and reads unchanged ones from it on later runs\n");
+        printf("       --trace writes per-stage spans as Chrome trace JSON plus a metrics summary\n");
         return -1;
     }
 
     const std::string directory = argv[1];
-    const char *output_csv = argv[2];
+    const std::string output = argv[2];
     std::string featureExtractionMethod = argv[3];
 
-    std::vector<float> (*featureExtractionFunction)(const cv::Mat &);
-    if (featureExtractionMethod == "baseline")
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    bool incremental = false;
+    FeatureDType dtype = FEATURE_DTYPE_F32;
+    int decodeScale = 1;
+    std::string traceFile, imageCacheFile;
+    for (int i = 4; i < argc; i++)
     {
-        featureExtractionFunction = &extractFeatureVector;
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--incremental") == 0)
+        {
+            incremental = true;
+        }
+        else if (strcmp(argv[i], "--dtype") == 0 && i + 1 < argc)
+        {
+            if (parseFeatureDType(argv[++i], dtype) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+        {
+            if (parseDecodeScale(argv[++i], decodeScale) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--image-cache") == 0 && i + 1 < argc)
+        {
+            imageCacheFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            traceFile = argv[++i];
+        }
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
     }
-    else if (featureExtractionMethod == "histogramMatching")
+    if (threads < 1)
     {
-        featureExtractionFunction = &extractColorHistogram;
+        threads = 1;
     }
-    else if (featureExtractionMethod == "multiHistogramMatching")
+
+    std::vector<const FeatureMethod *> methods;
+    if (parseFeatureMethods(featureExtractionMethod, methods) != 0)
     {
-        featureExtractionFunction = &extractRGBHistograms;
+        return -1;
     }
-    else if (featureExtractionMethod == "combinedFeatures")
+
+    std::vector<std::unique_ptr<IndexTarget>> targets;
+    for (const FeatureMethod *method : methods)
     {
-        featureExtractionFunction = &extractCombinedFeatures;
+        targets.emplace_back(new IndexTarget());
+        targets.back()->method = method;
+        targets.back()->output = outputPathFor(output, method, methods.size() > 1);
     }
 
-    bool first_file = true;
-
-    for (const auto &entry : std::filesystem::directory_iterator(directory))
+    // The pipeline already keeps every core busy with one image per worker, so stop OpenCV from
+    // spawning its own threads inside each worker as well
+    if (threads > 1)
     {
-        std::string imagePath = entry.path().string();
-        cv::Mat image = cv::imread(imagePath);
-        if (image.empty())
-        {
-            printf("Failed to open image %s\n", imagePath.c_str());
-            continue;
-        }
-
-        std::vector<float> featureVector = featureExtractionFunction(image);
-        append_image_data_csv(output_csv, imagePath.c_str(), featureVector, first_file);
-        first_file = false;
+        cv::setNumThreads(1);
     }
 
-    return 0;
+    if (!traceFile.empty())
+    {
+        startTracing();
+    }
+    ImageCache imageCache;
+    if (!imageCacheFile.empty() && openImageCache(imageCacheFile, decodeScale, imageCache) != 0)
+    {
+        return -1;
+    }
+    int status = indexImages(directory, targets, incremental, threads, dtype, decodeScale, imageCacheFile.empty() ? nullptr : &imageCache);
+    if (!imageCacheFile.empty() && closeImageCache(imageCache) != 0)
+    {
+        status = -1;
+    }
+    if (!traceFile.empty() && writeTrace(traceFile) != 0)
+    {
+        status = -1;
+    }
+    return status;
 }
@@ -0,0 +1,193 @@
+// trace.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Span and counter recording for trace.h and its Chrome trace / metrics output.
+//
+// Every thread appends to its own buffer, registered once under a lock the first time the thread records anything, so
+// recording a span is an append with no locking or sharing. The buffers are owned by the registry and outlive their
+// threads, which lets writeTrace read the spans of pipeline workers that have already been joined.
+
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+std::atomic<bool> traceEnabled{false};
+
+struct TraceSpan {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+struct ThreadTrace {
+    uint32_t tid = 0;
+    std::vector<TraceSpan> spans;
+    std::vector<std::pair<const char*, uint64_t>> counters;   // a handful of names, so a linear search is fastest
+};
+
+static std::mutex traceMutex;
+static std::vector<std::unique_ptr<ThreadTrace>> threadTraces;
+static std::chrono::steady_clock::time_point traceOrigin = std::chrono::steady_clock::now();
+static thread_local ThreadTrace* currentThreadTrace = nullptr;
+
+static ThreadTrace& threadTrace() {
+    if (!currentThreadTrace) {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        threadTraces.emplace_back(new ThreadTrace());
+        currentThreadTrace = threadTraces.back().get();
+        currentThreadTrace->tid = static_cast<uint32_t>(threadTraces.size());
+        currentThreadTrace->spans.reserve(1024);
+    }
+    return *currentThreadTrace;
+}
+
+uint64_t traceNow() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceOrigin).count());
+}
+
+void recordTraceSpan(const char* name, uint64_t start, uint64_t end) {
+    threadTrace().spans.push_back({name, start, end});
+}
+
+void addTraceCount(const char* name, uint64_t value) {
+    ThreadTrace& trace = threadTrace();
+    for (auto& counter : trace.counters) {
+        if (counter.first == name) {
+            counter.second += value;
+            return;
+        }
+    }
+    trace.counters.emplace_back(name, value);
+}
+
+void startTracing() {
+    traceOrigin = std::chrono::steady_clock::now();
+    traceEnabled.store(true);
+}
+
+// Peak resident set size of the process in bytes, 0 where it is not available
+static uint64_t peakResidentBytes() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);          // bytes on macOS
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;   // kilobytes on Linux
+#endif
+#else
+    return 0;
+#endif
+}
+
+struct StageSummary {
+    std::vector<double> milliseconds;
+    double total = 0;
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Writes a name as a JSON string; stage names are identifiers, but escape the two characters that would break it
+static void writeJsonString(FILE* fp, const char* text) {
+    fputc('"', fp);
+    for (const char* c = text; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+int writeTrace(const std::string& path) {
+    traceEnabled.store(false);
+    std::lock_guard<std::mutex> lock(traceMutex);
+
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open trace file %s\n", path.c_str());
+        return -1;
+    }
+    std::map<std::string, StageSummary> stages;
+    std::map<std::string, uint64_t> counters;
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (const auto& trace : threadTraces) {
+        for (const TraceSpan& span : trace->spans) {
+            fprintf(fp, "%s{\"name\": ", first ? "" : ",\n");
+            writeJsonString(fp, span.name);
+            fprintf(fp, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}", trace->tid, span.start / 1e3,
+                    (span.end - span.start) / 1e3);
+            first = false;
+
+            StageSummary& stage = stages[span.name];
+            stage.milliseconds.push_back((span.end - span.start) / 1e6);
+            stage.total += stage.milliseconds.back();
+        }
+        for (const auto& counter : trace->counters) {
+            counters[counter.first] += counter.second;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing %s\n", path.c_str());
+        return -1;
+    }
+
+    std::string metricsPath = std::filesystem::path(path).replace_extension(".metrics.json").string();
+    fp = fopen(metricsPath.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "Unable to open metrics file %s\n", metricsPath.c_str());
+        return -1;
+    }
+    uint64_t peakRss = peakResidentBytes();
+    fprintf(fp, "{\"peak_rss_bytes\": %llu,\n \"stages\": [\n", static_cast<unsigned long long>(peakRss));
+    fprintf(stderr, "%-24s %8s %12s %10s %10s %10s\n", "stage", "count", "total ms", "p50 ms", "p95 ms", "p99 ms");
+    first = true;
+    for (auto& entry : stages) {
+        std::vector<double>& samples = entry.second.milliseconds;
+        std::sort(samples.begin(), samples.end());
+        double p50 = percentile(samples, 50), p95 = percentile(samples, 95), p99 = percentile(samples, 99);
+        fprintf(fp, "%s  {\"name\": ", first ? "" : ",\n");
+        writeJsonString(fp, entry.first.c_str());
+        fprintf(fp, ", \"count\": %zu, \"total_ms\": %.3f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f}", samples.size(),
+                entry.second.total, p50, p95, p99);
+        fprintf(stderr, "%-24s %8zu %12.3f %10.4f %10.4f %10.4f\n", entry.first.c_str(), samples.size(), entry.second.total, p50, p95, p99);
+        first = false;
+    }
+    fprintf(fp, "\n ],\n \"counters\": {");
+    first = true;
+    for (const auto& counter : counters) {
+        fprintf(fp, "%s", first ? "" : ", ");
+        writeJsonString(fp, counter.first.c_str());
+        fprintf(fp, ": %llu", static_cast<unsigned long long>(counter.second));
+        fprintf(stderr, "%s: %llu\n", counter.first.c_str(), static_cast<unsigned long long>(counter.second));
+        first = false;
+    }
+    fprintf(fp, "}}\n");
+    if (peakRss > 0) {
+        fprintf(stderr, "peak RSS: %.1f MB\n", peakRss / (1024.0 * 1024.0));
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing %s\n", metricsPath.c_str());
+        return -1;
+    }
+    fprintf(stderr, "Wrote %s and %s\n", path.c_str(), metricsPath.c_str());
+    return 0;
+}
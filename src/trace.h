@@ -0,0 +1,78 @@
+// trace.h
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Include file for trace.cpp, lightweight per-stage tracing for readImages and the match tools. Stages are
+//          marked with TRACE_SCOPE("name") and amounts with traceCount("name", n). Nothing is recorded until
+//          startTracing() is called (the tools' --trace flag), so a disabled scope costs one relaxed atomic load and a
+//          branch; building with DISABLE_TRACING removes the scopes entirely.
+//
+// writeTrace(path) writes the spans of every thread as Chrome trace-event JSON (open it in chrome://tracing or
+// Perfetto), writes a metrics file next to it with the count, total time and p50/p95/p99 of each stage, the counters
+// and the peak RSS, and prints the same summary to stderr.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern std::atomic<bool> traceEnabled;
+
+inline bool tracingEnabled() {
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+// Nanoseconds on the trace clock
+uint64_t traceNow();
+
+// Records a finished span of the calling thread. name must outlive the trace (a literal or a registry name).
+void recordTraceSpan(const char* name, uint64_t start, uint64_t end);
+
+// Adds value to the named counter, e.g. bytes read
+void addTraceCount(const char* name, uint64_t value);
+
+// Times the enclosing scope as one span
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(tracingEnabled() ? name : nullptr), start_(name_ ? traceNow() : 0) {}
+    ~TraceScope() {
+        if (name_) {
+            recordTraceSpan(name_, start_, traceNow());
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    uint64_t start_;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef DISABLE_TRACING
+#define TRACE_SCOPE(name)
+inline void traceCount(const char*, uint64_t) {}
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+inline void traceCount(const char* name, uint64_t value) {
+    if (tracingEnabled()) {
+        addTraceCount(name, value);
+    }
+}
+#endif
+
+// Nearest-rank percentile (p in 0-100) of non-empty sorted samples, as the metrics file and evaluateRetrieval report them
+double percentile(const std::vector<double>& sorted, double p);
+
+// Starts recording; the trace clock starts at zero here
+void startTracing();
+
+// Writes path (Chrome trace JSON) and <path stem>.metrics.json and prints the summary. Call it once the worker
+// threads have finished, since their spans are read without locking. Returns -1 if a file cannot be written.
+int writeTrace(const std::string& path);
+
+#endif
@@ -0,0 +1,153 @@
+// testBatchScoring.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Checks scoreQueryBatch against a brute-force scan of every row, for every instruction set
+//          selectDistanceKernels accepts on this CPU. The results must be the same rows in the same order with the same
+//          scores.
+//
+// The baseline case is the one the dot-product form gets wrong without exact re-scoring: 0-255 pixel values, whose
+// squared norms are around 10^6, and rows that are near-duplicates of the queries, a few units of SSD apart.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "batchScoring.h"
+#include "distanceKernels.h"
+#include "featureRegistry.h"
+#include "featureStore.h"
+
+#define NUM_ROWS 3000
+#define NUM_QUERIES 70       // two full query blocks and a partial one
+#define TOP_K 10
+
+static const char* isas[] = {"avx512", "avx2", "sse", "scalar"};
+
+static int failures = 0;
+
+// An in-memory store over rows, named by row number
+static void makeStore(const std::vector<float>& rows, size_t dim, FeatureStore& store) {
+    store.dim = dim;
+    store.count = rows.size() / dim;
+    store.ownedData = rows;
+    store.data = store.ownedData.data();
+    for (size_t i = 0; i < store.count; ++i) {
+        store.ownedOffsets.push_back(store.ownedNames.size());
+        store.ownedNames += std::to_string(i);
+        store.ownedNames.push_back('\0');
+    }
+    store.nameOffsets = store.ownedOffsets.data();
+    store.names = store.ownedNames.data();
+}
+
+// Scores every row with the kernel scoreQueryBatch must agree with: the metric's per-pair kernel, which it re-scores
+// dot-form candidates with, or for the other metrics the row scan it uses directly
+static std::vector<ScoredId> bruteForce(const float* query, uint32_t excludeId, const FeatureStore& store, const MatchMetric& metric) {
+    float queryNorm = l2Norm(query, store.dim);
+    std::vector<float> scores(store.count);
+    if (metric.fromDot) {
+        for (size_t i = 0; i < store.count; ++i) {
+            scores[i] = metric.score(query, queryNorm, store.row(i), l2Norm(store.row(i), store.dim), store.dim);
+        }
+    } else {
+        scanRows(metric.scan, query, queryNorm, store.data, store.count, store.dim, scores.data());
+    }
+    TopKSelector best(TOP_K, metric.largerIsBetter, excludeId);
+    for (size_t i = 0; i < store.count; ++i) {
+        best.push(scores[i], static_cast<uint32_t>(i));
+    }
+    return best.results();
+}
+
+static void compare(const char* isa, const char* data, const std::vector<float>& queries, const std::vector<uint32_t>& excludeIds,
+                    const FeatureStore& store, const char* metricName) {
+    const MatchMetric& metric = *findMatchMetric(metricName);
+    std::vector<std::vector<ScoredId>> results;
+    scoreQueryBatch(queries.data(), excludeIds.size(), excludeIds, store, metric, TOP_K, 2, results);
+    for (size_t q = 0; q < excludeIds.size(); ++q) {
+        std::vector<ScoredId> expected = bruteForce(queries.data() + q * store.dim, excludeIds[q], store, metric);
+        bool same = results[q].size() == expected.size();
+        for (size_t i = 0; same && i < expected.size(); ++i) {
+            same = results[q][i].id == expected[i].id && results[q][i].score == expected[i].score;
+        }
+        if (!same) {
+            if (failures < 20) {
+                printf("FAIL %s %s/%s query %zu: got row %u (%.9g), expected row %u (%.9g) first\n", isa, data, metricName, q,
+                       results[q].empty() ? 0 : results[q][0].id, results[q].empty() ? 0.0 : results[q][0].score,
+                       expected.empty() ? 0 : expected[0].id, expected.empty() ? 0.0 : expected[0].score);
+            }
+            failures++;
+        }
+    }
+}
+
+int main() {
+    std::mt19937 rng(5);
+
+    // Baseline: 0-255 values; each query is a row of the store, and the store holds near-duplicates of it with a few
+    // values moved by one or two, so the true neighbours are only a few units of SSD apart
+    const size_t baselineDim = findFeatureMethod("baseline")->dim;
+    std::uniform_int_distribution<int> pixel(0, 255), nudge(-2, 2), position(0, static_cast<int>(baselineDim) - 1);
+    std::vector<float> baselineRows(NUM_ROWS * baselineDim);
+    for (float& v : baselineRows) {
+        v = static_cast<float>(pixel(rng));
+    }
+    for (size_t i = NUM_QUERIES; i < NUM_ROWS; ++i) {
+        if (i % 3 == 0) {
+            continue;   // keep some unrelated rows
+        }
+        const float* source = baselineRows.data() + (i % NUM_QUERIES) * baselineDim;
+        float* row = baselineRows.data() + i * baselineDim;
+        std::copy(source, source + baselineDim, row);
+        for (int changes = 1 + static_cast<int>(i % 4); changes > 0; --changes) {
+            float& v = row[position(rng)];
+            v = std::min(255.0f, std::max(0.0f, v + nudge(rng)));
+        }
+    }
+    FeatureStore baseline;
+    makeStore(baselineRows, baselineDim, baseline);
+    std::vector<float> baselineQueries(baselineRows.begin(), baselineRows.begin() + NUM_QUERIES * baselineDim);
+    std::vector<uint32_t> selfIds(NUM_QUERIES);
+    for (uint32_t q = 0; q < NUM_QUERIES; ++q) {
+        selfIds[q] = q;
+    }
+
+    // Histograms: normalized random values at the deep network dimension, with queries that are not in the store
+    const size_t histogramDim = 512;
+    std::uniform_real_distribution<float> value(0.0f, 1.0f);
+    std::vector<float> histogramRows(NUM_ROWS * histogramDim), histogramQueries(NUM_QUERIES * histogramDim);
+    for (float& v : histogramRows) {
+        v = value(rng) / histogramDim;
+    }
+    for (float& v : histogramQueries) {
+        v = value(rng) / histogramDim;
+    }
+    FeatureStore histograms;
+    makeStore(histogramRows, histogramDim, histograms);
+    std::vector<uint32_t> noExclude(NUM_QUERIES, TopKSelector::NO_EXCLUDE);
+
+    int tested = 0;
+    for (const char* isa : isas) {
+        if (selectDistanceKernels(isa) != 0) {
+            printf("%s: not supported on this CPU, skipped\n", isa);
+            continue;
+        }
+        int before = failures;
+        for (const char* metric : {"ssd", "euclidean"}) {
+            compare(isa, "baseline", baselineQueries, selfIds, baseline, metric);
+        }
+        for (const char* metric : {"ssd", "euclidean", "intersection", "cosine"}) {
+            compare(isa, "histogram", histogramQueries, noExclude, histograms, metric);
+        }
+        printf("%s: %s\n", isa, failures == before ? "ok" : "FAILED");
+        tested++;
+    }
+
+    if (tested == 0 || failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
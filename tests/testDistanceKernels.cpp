@@ -0,0 +1,198 @@
+// testDistanceKernels.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Checks every distance kernel of every instruction set selectDistanceKernels accepts on this CPU against a
+//          double-precision scalar reference, at every dimension from 0 to 1000 (which covers each ROW_SCAN_DIMS value
+//          and every tail length of the vector loops) and from unaligned pointers.
+//
+// Float kernels may sum in any order, so a result passes if it is within TOLERANCE times the sum of the absolute
+// values of its terms (plus ABS_TOLERANCE for results near zero) of the reference; for 1000 terms this is several
+// times the worst-case float rounding error of any summation order. The integer intersections must match exactly.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "distanceKernels.h"
+
+#define MAX_DIM 1000
+#define SCAN_ROWS 7          // one group of four rows, then a tail of three
+#define TOLERANCE 1e-4
+#define ABS_TOLERANCE 1e-5
+
+static const char* isas[] = {"avx512", "avx2", "sse", "scalar"};
+static const size_t rowScanDims[] = {ROW_SCAN_DIMS};
+
+static int failures = 0;
+
+static void check(bool ok, const char* isa, const char* kernel, size_t dim, double got, double expected) {
+    if (!ok) {
+        if (failures < 20) {
+            printf("FAIL %s %s dim %zu: got %.9g, expected %.9g\n", isa, kernel, dim, got, expected);
+        }
+        failures++;
+    }
+}
+
+static void checkClose(const char* isa, const char* kernel, size_t dim, double got, double expected, double magnitude) {
+    check(std::fabs(got - expected) <= TOLERANCE * magnitude + ABS_TOLERANCE, isa, kernel, dim, got, expected);
+}
+
+// Reference sums in double, with the sum of absolute terms that scales the tolerance
+struct Reference {
+    double ssd = 0, ssdMagnitude = 0;
+    double intersection = 0, intersectionMagnitude = 0;
+    double dot = 0, dotMagnitude = 0;
+    double normA2 = 0, normB2 = 0;
+};
+
+static Reference reference(const float* a, const float* b, size_t n) {
+    Reference r;
+    for (size_t i = 0; i < n; ++i) {
+        double d = static_cast<double>(a[i]) - b[i];
+        r.ssd += d * d;
+        double m = std::min(a[i], b[i]);
+        r.intersection += m;
+        r.intersectionMagnitude += std::fabs(m);
+        double p = static_cast<double>(a[i]) * b[i];
+        r.dot += p;
+        r.dotMagnitude += std::fabs(p);
+        r.normA2 += static_cast<double>(a[i]) * a[i];
+        r.normB2 += static_cast<double>(b[i]) * b[i];
+    }
+    r.ssdMagnitude = r.ssd;
+    return r;
+}
+
+static double referenceCosine(const Reference& r) {
+    if (r.normA2 == 0 || r.normB2 == 0) {
+        return 1.0;
+    }
+    return 1.0 - r.dot / (std::sqrt(r.normA2) * std::sqrt(r.normB2));
+}
+
+// Error bound of a cosine distance: the dot product's tolerance relative to |a| |b|
+static double cosineMagnitude(const Reference& r) {
+    return r.normA2 == 0 || r.normB2 == 0 ? 0 : r.dotMagnitude / (std::sqrt(r.normA2) * std::sqrt(r.normB2)) + 1;
+}
+
+static void testPairKernels(const char* isa, const float* a, const float* b, size_t n) {
+    Reference r = reference(a, b, n);
+    checkClose(isa, "computeSSD", n, computeSSD(a, b, n), r.ssd, r.ssdMagnitude);
+    checkClose(isa, "computeEuclideanDistance", n, computeEuclideanDistance(a, b, n), std::sqrt(r.ssd), std::sqrt(r.ssdMagnitude));
+    checkClose(isa, "histogramIntersection", n, histogramIntersection(a, b, n), r.intersection, r.intersectionMagnitude);
+    checkClose(isa, "dotProduct", n, dotProduct(a, b, n), r.dot, r.dotMagnitude);
+    checkClose(isa, "l2Norm", n, l2Norm(a, n), std::sqrt(r.normA2), std::sqrt(r.normA2));
+
+    float normA = static_cast<float>(std::sqrt(r.normA2)), normB = static_cast<float>(std::sqrt(r.normB2));
+    checkClose(isa, "cosineDistance", n, cosineDistance(a, normA, b, n), referenceCosine(r), cosineMagnitude(r));
+    checkClose(isa, "cosineDistance(normB)", n, cosineDistance(a, normA, b, normB, n), referenceCosine(r), cosineMagnitude(r));
+}
+
+static void testCodeKernels(const char* isa, const float* a, const uint8_t* u8a, const uint8_t* u8b, const uint16_t* u16a,
+                            const uint16_t* u16b, size_t n) {
+    uint64_t u8 = 0, u16 = 0;
+    double dot = 0, dotMagnitude = 0;
+    for (size_t i = 0; i < n; ++i) {
+        u8 += std::min(u8a[i], u8b[i]);
+        u16 += std::min(u16a[i], u16b[i]);
+        dot += static_cast<double>(a[i]) * u8b[i];
+        dotMagnitude += std::fabs(static_cast<double>(a[i]) * u8b[i]);
+    }
+    uint64_t gotU8 = histogramIntersectionU8(u8a, u8b, n), gotU16 = histogramIntersectionU16(u16a, u16b, n);
+    check(gotU8 == u8, isa, "histogramIntersectionU8", n, static_cast<double>(gotU8), static_cast<double>(u8));
+    check(gotU16 == u16, isa, "histogramIntersectionU16", n, static_cast<double>(gotU16), static_cast<double>(u16));
+    checkClose(isa, "dotProductU8", n, dotProductU8(a, u8b, n), dot, dotMagnitude);
+}
+
+static void testRowScans(const char* isa, const float* query, const float* rows, size_t n) {
+    static const struct {
+        RowScanMetric metric;
+        const char* name;
+    } metrics[] = {{ROW_SCAN_SSD, "scanRows/ssd"}, {ROW_SCAN_EUCLIDEAN, "scanRows/euclidean"},
+                   {ROW_SCAN_INTERSECTION, "scanRows/intersection"}, {ROW_SCAN_COSINE, "scanRows/cosine"}};
+    Reference self = reference(query, query, n);
+    float queryNorm = static_cast<float>(std::sqrt(self.normA2));
+    std::vector<float> scores(SCAN_ROWS);
+    for (const auto& m : metrics) {
+        scanRows(m.metric, query, queryNorm, rows, SCAN_ROWS, n, scores.data());
+        for (size_t row = 0; row < SCAN_ROWS; ++row) {
+            Reference r = reference(query, rows + row * n, n);
+            switch (m.metric) {
+            case ROW_SCAN_SSD:
+                checkClose(isa, m.name, n, scores[row], r.ssd, r.ssdMagnitude);
+                break;
+            case ROW_SCAN_EUCLIDEAN:
+                checkClose(isa, m.name, n, scores[row], std::sqrt(r.ssd), std::sqrt(r.ssdMagnitude));
+                break;
+            case ROW_SCAN_INTERSECTION:
+                checkClose(isa, m.name, n, scores[row], r.intersection, r.intersectionMagnitude);
+                break;
+            default:
+                checkClose(isa, m.name, n, scores[row], referenceCosine(r), cosineMagnitude(r));
+                break;
+            }
+        }
+    }
+}
+
+int main() {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> signedValue(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> histogramValue(0.0f, 1.0f);
+
+    // One spare value in front of each buffer, so the kernels also run from pointers that are not 16-byte aligned
+    std::vector<float> a(MAX_DIM + 1), b(MAX_DIM + 1), ha(MAX_DIM + 1), hb(MAX_DIM + 1);
+    std::vector<float> rows(SCAN_ROWS * MAX_DIM + 1);
+    std::vector<uint8_t> u8a(MAX_DIM + 1), u8b(MAX_DIM + 1);
+    std::vector<uint16_t> u16a(MAX_DIM + 1), u16b(MAX_DIM + 1);
+    for (size_t i = 0; i <= MAX_DIM; ++i) {
+        a[i] = signedValue(rng);
+        b[i] = signedValue(rng);
+        ha[i] = histogramValue(rng);
+        hb[i] = histogramValue(rng);
+        u8a[i] = static_cast<uint8_t>(rng());
+        u8b[i] = static_cast<uint8_t>(rng());
+        u16a[i] = static_cast<uint16_t>(rng());
+        u16b[i] = static_cast<uint16_t>(rng());
+    }
+    for (float& v : rows) {
+        v = histogramValue(rng);
+    }
+    std::vector<float> zero(MAX_DIM, 0.0f);
+
+    int tested = 0;
+    for (const char* isa : isas) {
+        if (selectDistanceKernels(isa) != 0) {
+            printf("%s: not supported on this CPU, skipped\n", isa);
+            continue;
+        }
+        int before = failures;
+        for (size_t n = 0; n <= MAX_DIM; ++n) {
+            for (size_t offset = 0; offset <= 1; ++offset) {
+                testPairKernels(isa, a.data() + offset, b.data() + offset, n);
+                testPairKernels(isa, ha.data() + offset, hb.data() + offset, n);
+                testCodeKernels(isa, a.data() + offset, u8a.data() + offset, u8b.data() + offset, u16a.data() + offset,
+                                u16b.data() + offset, n);
+            }
+            testPairKernels(isa, a.data(), zero.data(), n);
+            testRowScans(isa, ha.data(), rows.data(), n);
+            testRowScans(isa, a.data() + 1, rows.data() + 1, n);
+        }
+        // The specialized scans are among the dimensions above; check each one actually dispatches to a specialization
+        for (size_t dim : rowScanDims) {
+            check(dim <= MAX_DIM && rowScanSpecialized(dim), isa, "rowScanSpecialized", dim, 0, 1);
+        }
+        printf("%s: %s\n", isa, failures == before ? "ok" : "FAILED");
+        tested++;
+    }
+
+    if (tested == 0 || failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
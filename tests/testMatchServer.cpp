@@ -0,0 +1,162 @@
+// testMatchServer.cpp
+// Name: Mihir Chitre, Aditya Gurnani
+// Date: 02/01/2024
+// Purpose: Starts the matchServer binary given on the command line over a small baseline index, with one worker and a
+//          one second idle timeout, and checks that requests which used to terminate it are answered with ERR and that
+//          an idle client does not keep later clients waiting:
+//            - a QUERY whose N is far larger than the index is answered with every other row
+//            - a QUERY for an image too small for the baseline extractor is answered with ERR
+//            - LIST is still answered on the same connection afterwards
+//            - while an idle connection holds the only worker, a second client's LIST is answered once it times out
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "opencv2/opencv.hpp"
+#include "featureRegistry.h"
+#include "featureStore.h"
+
+#define NUM_ROWS 5
+#define REPLY_TIMEOUT_MS 10000
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, const std::string& detail) {
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        printf("    got: %s\n", detail.c_str());
+        failures++;
+    }
+}
+
+// Connects to the server, retrying while it starts up. Returns -1 if it never listens.
+static int connectServer(const std::string& socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    for (int attempt = 0; attempt < REPLY_TIMEOUT_MS / 50; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        usleep(50 * 1000);
+    }
+    return -1;
+}
+
+// Reads until the reply holds `lines` lines, the connection closes or REPLY_TIMEOUT_MS passes
+static std::string readReply(int fd, size_t lines) {
+    std::string reply;
+    char buffer[4096];
+    while (static_cast<size_t>(std::count(reply.begin(), reply.end(), '\n')) < lines) {
+        pollfd ready = {fd, POLLIN, 0};
+        if (poll(&ready, 1, REPLY_TIMEOUT_MS) <= 0) {
+            break;
+        }
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        reply.append(buffer, static_cast<size_t>(n));
+    }
+    return reply;
+}
+
+static std::string request(int fd, const std::string& line, size_t lines) {
+    if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(line.size())) {
+        return "(send failed)";
+    }
+    return readReply(fd, lines);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <matchServer binary>\n", argv[0]);
+        return 1;
+    }
+
+    char dirTemplate[] = "/tmp/testMatchServerXXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dirTemplate;
+    std::string storePath = dir + "/baseline" + FEATURE_STORE_EXTENSION, imagePath = dir + "/tiny.png", socketPath = dir + "/match.sock";
+
+    // A baseline index of random rows, and a 3x3 image the 7x7 baseline patch does not fit in
+    const size_t dim = findFeatureMethod("baseline")->dim;
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> pixel(0, 255);
+    std::vector<std::string> names;
+    std::vector<float> data(NUM_ROWS * dim);
+    for (int i = 0; i < NUM_ROWS; ++i) {
+        names.push_back("pic." + std::to_string(i) + ".jpg");
+    }
+    for (float& v : data) {
+        v = static_cast<float>(pixel(rng));
+    }
+    if (writeFeatureStore(storePath, "baseline", names, data, dim) != 0 || !cv::imwrite(imagePath, cv::Mat(3, 3, CV_8UC3, cv::Scalar(1, 2, 3)))) {
+        printf("failed to write the test index or image in %s\n", dir.c_str());
+        return 1;
+    }
+
+    pid_t server = fork();
+    if (server == 0) {
+        execl(argv[1], argv[1], socketPath.c_str(), storePath.c_str(), "--threads", "1", "--idle-timeout", "1", static_cast<char*>(nullptr));
+        perror(argv[1]);
+        _exit(127);
+    }
+
+    int fd = connectServer(socketPath);
+    check(fd >= 0, "server listening", socketPath);
+    if (fd >= 0) {
+        std::string reply = request(fd, "QUERY baseline ssd 9223372036854775807 pic.0.jpg\n", NUM_ROWS);
+        check(reply.compare(0, 5, "OK " + std::to_string(NUM_ROWS - 1) + "\n") == 0, "oversized N", reply);
+
+        reply = request(fd, "QUERY baseline ssd 3 " + imagePath + "\n", 1);
+        check(reply.compare(0, 4, "ERR ") == 0, "image smaller than the extractor's patch", reply);
+
+        reply = request(fd, "LIST\n", 2);
+        check(reply == "OK 1\nbaseline " + std::to_string(dim) + " " + std::to_string(NUM_ROWS) + "\n", "LIST after failed queries", reply);
+
+        // fd is now idle and holds the only worker; the second client is served once the server closes it
+        int second = connectServer(socketPath);
+        reply = second >= 0 ? request(second, "LIST\n", 2) : "(connect failed)";
+        check(reply.compare(0, 5, "OK 1\n") == 0, "LIST while another client is idle", reply);
+        check(readReply(fd, 1).empty(), "idle connection closed", "data on the idle connection");
+        if (second >= 0) {
+            close(second);
+        }
+        close(fd);
+    }
+
+    kill(server, SIGTERM);
+    int status = 0;
+    waitpid(server, &status, 0);
+    check(access(socketPath.c_str(), F_OK) != 0, "socket removed on SIGTERM", socketPath);
+
+    unlink(storePath.c_str());
+    unlink(imagePath.c_str());
+    rmdir(dir.c_str());
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}